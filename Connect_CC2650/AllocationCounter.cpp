@@ -0,0 +1,58 @@
+// AllocationCounter.cpp : counts heap allocations to keep the acquisition path allocation free
+//
+
+#include "AllocationCounter.h"
+
+#ifdef CC2650_COUNT_ALLOCATIONS
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t allocations = 0;
+
+uint64_t allocationCount() {
+	return allocations;
+}
+
+bool AllocationGuard::check(const char *where) {
+	uint64_t count = allocationCount() - m_start;
+	m_start = allocationCount();
+	if (count == 0)
+		return true;
+	fprintf(stderr, "%llu heap allocation(s) in the %s\n", (unsigned long long)count, where);
+	assert(!"heap allocation in an allocation free path");
+	return false;
+}
+
+static void *countedAlloc(size_t size) {
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	allocations++;
+	return malloc(size ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	allocations++;
+	return malloc(size ? size : 1);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+#else
+
+uint64_t allocationCount() {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,37 @@
+// AllocationCounter.h : counts heap allocations to keep the acquisition path allocation free
+//
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <cstdint>
+
+/*
+Build with CC2650_COUNT_ALLOCATIONS defined to replace the global operator new
+with a counting one. AllocationGuard then reports (and in debug builds asserts)
+when the code between its construction and check() allocated. Without the
+define the guard compiles to nothing.
+
+	AllocationGuard guard;
+	... read, frame, decode ...
+	guard.check("acquisition path");
+*/
+
+// Allocations made so far by the calling thread (always 0 without CC2650_COUNT_ALLOCATIONS)
+uint64_t allocationCount();
+
+class AllocationGuard {
+public:
+#ifdef CC2650_COUNT_ALLOCATIONS
+	AllocationGuard() : m_start(allocationCount()) {}
+	bool check(const char *where);
+	void rearm() { m_start = allocationCount(); }
+private:
+	uint64_t m_start;
+#else
+	bool check(const char *) { return true; }
+	void rearm() {}
+#endif
+};
+
+#endif // ALLOCATIONCOUNTER_H
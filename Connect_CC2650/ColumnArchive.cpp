@@ -0,0 +1,563 @@
+// ColumnArchive.cpp : writer and reader of the columnar IMU archive
+//
+
+#include "ColumnArchive.h"
+#include "StreamProtocol.h"		// putU16()... little endian helpers
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ARCHIVE_SSE2 1
+#endif
+
+static const char ARCHIVE_MAGIC[4] = { 'C', 'C', 'A', '1' };
+static const char ARCHIVE_TRAILER_MAGIC[4] = { 'C', 'C', 'A', 'F' };
+static const uint16_t ARCHIVE_VERSION = 1;
+static const size_t ARCHIVE_HEADER_SIZE = 8;
+static const size_t ARCHIVE_TRAILER_SIZE = 16;
+static const size_t ARCHIVE_INDEX_ENTRY_SIZE = 30 + ARCHIVE_COLUMNS * 8 + IMU_AXES * 4;
+
+// Column encodings
+static const uint8_t COLUMN_BITPACK = 1;
+static const uint8_t COLUMN_VARINT  = 2;
+
+// Bit-packed deltas are stored in blocks of 128 values, 4 interleaved lanes of 32 values
+static const size_t BLOCK_VALUES = 128;
+static const size_t BLOCK_LANES = 4;
+
+uint16_t archiveAxisMask(uint8_t sensorMask) {
+	uint16_t mask = 0;
+	if (sensorMask & IMU_GYRO) mask |= 0x007;
+	if (sensorMask & IMU_ACC)  mask |= 0x038;
+	if (sensorMask & IMU_MAG)  mask |= 0x1C0;
+	return mask;
+}
+
+static bool seekFile(FILE *f, uint64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static uint64_t fileSize(FILE *f) {
+#ifdef _WIN32
+	_fseeki64(f, 0, SEEK_END);
+	return (uint64_t)_ftelli64(f);
+#else
+	fseeko(f, 0, SEEK_END);
+	return (uint64_t)ftello(f);
+#endif
+}
+
+static inline uint64_t zigzagEncode(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t zigzagDecode(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+static size_t varintSize(uint64_t v) {
+	size_t n = 1;
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+static bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+	v = 0;
+	for (int shift = 0; shift < 64 && p < end; shift += 7) {
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static int bitWidth(uint64_t v) {
+	int width = 0;
+	while (v) {
+		width++;
+		v >>= 1;
+	}
+	return width;
+}
+
+// Value k of the block goes to lane k % 4, at position k / 4 of that lane
+static void packBlock(const uint32_t *in, int width, uint8_t *out) {
+	uint32_t words[32 * BLOCK_LANES];
+	memset(words, 0, width * BLOCK_LANES * sizeof(uint32_t));
+	for (size_t k = 0; k < BLOCK_VALUES; k++) {
+		size_t lane = k % BLOCK_LANES;
+		int bit = (int)(k / BLOCK_LANES) * width;
+		int w = bit >> 5, s = bit & 31;
+		words[w * BLOCK_LANES + lane] |= in[k] << s;
+		if (s + width > 32)
+			words[(w + 1) * BLOCK_LANES + lane] |= in[k] >> (32 - s);
+	}
+	memcpy(out, words, width * BLOCK_LANES * sizeof(uint32_t));
+}
+
+static void unpackBlock(const uint8_t *in, int width, uint32_t *out) {
+	if (width == 0) {
+		memset(out, 0, BLOCK_VALUES * sizeof(uint32_t));
+		return;
+	}
+	uint32_t mask = width == 32 ? 0xFFFFFFFFu : (1u << width) - 1;
+#ifdef ARCHIVE_SSE2
+	// all 4 lanes are unpacked at once
+	const __m128i *words = (const __m128i *)in;
+	__m128i vmask = _mm_set1_epi32((int)mask);
+	for (int j = 0; j < 32; j++) {
+		int bit = j * width;
+		int w = bit >> 5, s = bit & 31;
+		__m128i v = _mm_srl_epi32(_mm_loadu_si128(words + w), _mm_cvtsi32_si128(s));
+		if (s + width > 32)
+			v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(words + w + 1), _mm_cvtsi32_si128(32 - s)));
+		_mm_storeu_si128((__m128i *)(out + j * BLOCK_LANES), _mm_and_si128(v, vmask));
+	}
+#else
+	uint32_t words[32 * BLOCK_LANES];
+	memcpy(words, in, width * BLOCK_LANES * sizeof(uint32_t));
+	for (int j = 0; j < 32; j++) {
+		int bit = j * width;
+		int w = bit >> 5, s = bit & 31;
+		for (size_t lane = 0; lane < BLOCK_LANES; lane++) {
+			uint32_t v = words[w * BLOCK_LANES + lane] >> s;
+			if (s + width > 32)
+				v |= words[(w + 1) * BLOCK_LANES + lane] << (32 - s);
+			out[j * BLOCK_LANES + lane] = v & mask;
+		}
+	}
+#endif
+}
+
+/* Zigzag decodes 128 deltas and turns them into values by a running sum,
+   starting from prev. Returns the last value. */
+static int32_t integrateBlock(const uint32_t *deltas, int32_t prev, int32_t *out) {
+#ifdef ARCHIVE_SSE2
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i carry = _mm_set1_epi32(prev);
+	for (size_t q = 0; q < BLOCK_VALUES; q += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(deltas + q));
+		x = _mm_xor_si128(_mm_srli_epi32(x, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(x, one)));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));		// prefix sum inside the register
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, carry);
+		_mm_storeu_si128((__m128i *)(out + q), x);
+		carry = _mm_shuffle_epi32(x, 0xFF);
+	}
+	return _mm_cvtsi128_si32(carry);
+#else
+	for (size_t q = 0; q < BLOCK_VALUES; q++) {
+		prev += (int32_t)(deltas[q] >> 1) ^ -(int32_t)(deltas[q] & 1);
+		out[q] = prev;
+	}
+	return prev;
+#endif
+}
+
+/* Column layout: uint8 encoding, uint8 bit width, varint zigzag(first value),
+   then the n - 1 deltas (bit-packed blocks or varints). */
+static void encodeColumn(const int64_t *values, size_t n, std::vector<uint8_t> &out, std::vector<uint32_t> &scratch) {
+	uint64_t maxDelta = 0;
+	size_t varintBytes = 0;
+	for (size_t i = 1; i < n; i++) {
+		uint64_t d = zigzagEncode(values[i] - values[i - 1]);
+		if (d > maxDelta)
+			maxDelta = d;
+		varintBytes += varintSize(d);
+	}
+	int width = bitWidth(maxDelta);
+	size_t blocks = (n - 1 + BLOCK_VALUES - 1) / BLOCK_VALUES;
+	bool bitpack = width <= 32 && blocks * width * BLOCK_LANES * 4 <= varintBytes;
+
+	out.push_back(bitpack ? COLUMN_BITPACK : COLUMN_VARINT);
+	out.push_back((uint8_t)width);
+	putVarint(out, zigzagEncode(values[0]));
+
+	if (!bitpack) {
+		for (size_t i = 1; i < n; i++)
+			putVarint(out, zigzagEncode(values[i] - values[i - 1]));
+		return;
+	}
+	scratch.assign(blocks * BLOCK_VALUES, 0);
+	for (size_t i = 1; i < n; i++)
+		scratch[i - 1] = (uint32_t)zigzagEncode(values[i] - values[i - 1]);
+	for (size_t b = 0; b < blocks; b++) {
+		size_t offset = out.size();
+		out.resize(offset + width * BLOCK_LANES * 4);
+		packBlock(&scratch[b * BLOCK_VALUES], width, &out[offset]);
+	}
+}
+
+struct ColumnHeader {
+	uint8_t encoding;
+	int width;
+	int64_t first;
+	const uint8_t *data;
+};
+
+static bool decodeColumnHeader(const uint8_t *p, const uint8_t *end, size_t n, ColumnHeader &h) {
+	if (end - p < 3)
+		return false;
+	h.encoding = p[0];
+	h.width = p[1];
+	p += 2;
+	uint64_t first;
+	if (!getVarint(p, end, first))
+		return false;
+	h.first = zigzagDecode(first);
+	h.data = p;
+	if (h.encoding == COLUMN_BITPACK) {
+		size_t blocks = (n - 1 + BLOCK_VALUES - 1) / BLOCK_VALUES;
+		return h.width <= 32 && (size_t)(end - p) >= blocks * h.width * BLOCK_LANES * 4;
+	}
+	return h.encoding == COLUMN_VARINT;
+}
+
+// out must have room for n + BLOCK_VALUES values (the last block is decoded whole)
+static bool decodeAxisColumn(const uint8_t *p, const uint8_t *end, size_t n, int32_t *out) {
+	ColumnHeader h;
+	if (!decodeColumnHeader(p, end, n, h))
+		return false;
+	out[0] = (int32_t)h.first;
+	if (h.encoding == COLUMN_BITPACK) {
+		uint32_t deltas[BLOCK_VALUES];
+		int32_t prev = out[0];
+		size_t blockBytes = h.width * BLOCK_LANES * 4;
+		for (size_t i = 1, b = 0; i < n; i += BLOCK_VALUES, b++) {
+			unpackBlock(h.data + b * blockBytes, h.width, deltas);
+			prev = integrateBlock(deltas, prev, out + i);
+		}
+		return true;
+	}
+	const uint8_t *q = h.data;
+	for (size_t i = 1; i < n; i++) {
+		uint64_t d;
+		if (!getVarint(q, end, d))
+			return false;
+		out[i] = out[i - 1] + (int32_t)zigzagDecode(d);
+	}
+	return true;
+}
+
+static bool decodeTimeColumn(const uint8_t *p, const uint8_t *end, size_t n, uint64_t *out) {
+	ColumnHeader h;
+	if (!decodeColumnHeader(p, end, n, h))
+		return false;
+	out[0] = (uint64_t)h.first;
+	if (h.encoding == COLUMN_BITPACK) {
+		uint32_t deltas[BLOCK_VALUES];
+		size_t blockBytes = h.width * BLOCK_LANES * 4;
+		for (size_t i = 1, b = 0; i < n; b++) {
+			unpackBlock(h.data + b * blockBytes, h.width, deltas);
+			for (size_t k = 0; k < BLOCK_VALUES && i < n; k++, i++)
+				out[i] = out[i - 1] + zigzagDecode(deltas[k]);
+		}
+		return true;
+	}
+	const uint8_t *q = h.data;
+	for (size_t i = 1; i < n; i++) {
+		uint64_t d;
+		if (!getVarint(q, end, d))
+			return false;
+		out[i] = out[i - 1] + zigzagDecode(d);
+	}
+	return true;
+}
+
+static void putIndexEntry(uint8_t *p, const ArchiveChunkInfo &c) {
+	putU16(p, c.deviceId);
+	putU32(p + 2, c.count);
+	putU64(p + 6, c.firstTimestamp);
+	putU64(p + 14, c.lastTimestamp);
+	putU64(p + 22, c.offset);
+	p += 30;
+	for (size_t i = 0; i < ARCHIVE_COLUMNS; i++, p += 8) {
+		putU32(p, c.columnOffset[i]);
+		putU32(p + 4, c.columnSize[i]);
+	}
+	for (size_t i = 0; i < IMU_AXES; i++, p += 4) {
+		putU16(p, (uint16_t)c.min[i]);
+		putU16(p + 2, (uint16_t)c.max[i]);
+	}
+}
+
+static void getIndexEntry(const uint8_t *p, ArchiveChunkInfo &c) {
+	c.deviceId = getU16(p);
+	c.count = getU32(p + 2);
+	c.firstTimestamp = getU64(p + 6);
+	c.lastTimestamp = getU64(p + 14);
+	c.offset = getU64(p + 22);
+	p += 30;
+	for (size_t i = 0; i < ARCHIVE_COLUMNS; i++, p += 8) {
+		c.columnOffset[i] = getU32(p);
+		c.columnSize[i] = getU32(p + 4);
+	}
+	for (size_t i = 0; i < IMU_AXES; i++, p += 4) {
+		c.min[i] = (int16_t)getU16(p);
+		c.max[i] = (int16_t)getU16(p + 2);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ArchiveWriter
+
+ArchiveWriter::ArchiveWriter() : m_file(0), m_chunkSize(ARCHIVE_DEFAULT_CHUNK), m_offset(0), m_writeFailed(false) {
+}
+
+ArchiveWriter::~ArchiveWriter() {
+	close();
+}
+
+bool ArchiveWriter::open(const std::string &path, size_t chunkSize) {
+	close();
+	m_file = fopen(path.c_str(), "wb");
+	if (!m_file) {
+		m_lastError = "cannot create " + path;
+		return false;
+	}
+	m_chunkSize = chunkSize > 1 ? chunkSize : 2;
+	m_offset = 0;
+	m_writeFailed = false;
+	m_index.clear();
+
+	std::vector<uint8_t> header(ARCHIVE_HEADER_SIZE, 0);
+	memcpy(&header[0], ARCHIVE_MAGIC, 4);
+	putU16(&header[4], ARCHIVE_VERSION);
+	return write(header);
+}
+
+bool ArchiveWriter::write(const std::vector<uint8_t> &data) {
+	if (m_writeFailed)
+		return false;
+	if (fwrite(data.data(), 1, data.size(), m_file) != data.size()) {
+		// part of it may be on disk: m_offset no longer matches the file
+		m_writeFailed = true;
+		m_lastError = "archive write failed";
+		return false;
+	}
+	m_offset += data.size();
+	return true;
+}
+
+void ArchiveWriter::append(const ImuSample &sample) {
+	if (!m_file || m_writeFailed)
+		return;
+	DeviceColumns &columns = m_pending[sample.deviceId];
+	if (columns.time.empty()) {
+		columns.time.reserve(m_chunkSize);
+		for (size_t a = 0; a < IMU_AXES; a++)
+			columns.axis[a].reserve(m_chunkSize);
+	}
+	columns.time.push_back(sample.timestamp);
+	for (size_t a = 0; a < IMU_AXES; a++)
+		columns.axis[a].push_back(sample.axis[a]);
+
+	if (columns.time.size() >= m_chunkSize)
+		writeChunk(sample.deviceId, columns);
+}
+
+bool ArchiveWriter::writeChunk(uint16_t deviceId, DeviceColumns &columns) {
+	size_t n = columns.time.size();
+	if (n == 0)
+		return true;
+
+	ArchiveChunkInfo info;
+	info.deviceId = deviceId;
+	info.count = (uint32_t)n;
+	info.firstTimestamp = columns.time.front();
+	info.lastTimestamp = columns.time.front();
+	info.offset = m_offset;
+
+	std::vector<int64_t> &values = m_values;
+	values.resize(n);
+	m_buffer.clear();
+	for (size_t c = 0; c < ARCHIVE_COLUMNS; c++) {
+		if (c == 0) {
+			for (size_t i = 0; i < n; i++) {
+				values[i] = (int64_t)columns.time[i];
+				if (columns.time[i] < info.firstTimestamp) info.firstTimestamp = columns.time[i];
+				if (columns.time[i] > info.lastTimestamp) info.lastTimestamp = columns.time[i];
+			}
+		}
+		else {
+			const std::vector<int16_t> &axis = columns.axis[c - 1];
+			info.min[c - 1] = info.max[c - 1] = axis[0];
+			for (size_t i = 0; i < n; i++) {
+				values[i] = axis[i];
+				if (axis[i] < info.min[c - 1]) info.min[c - 1] = axis[i];
+				if (axis[i] > info.max[c - 1]) info.max[c - 1] = axis[i];
+			}
+		}
+		size_t start = m_buffer.size();
+		encodeColumn(&values[0], n, m_buffer, m_scratch);
+		info.columnOffset[c] = (uint32_t)start;
+		info.columnSize[c] = (uint32_t)(m_buffer.size() - start);
+	}
+
+	columns.time.clear();
+	for (size_t a = 0; a < IMU_AXES; a++)
+		columns.axis[a].clear();
+	if (!write(m_buffer))
+		return false;
+	m_index.push_back(info);
+	return true;
+}
+
+bool ArchiveWriter::close() {
+	if (!m_file)
+		return true;
+
+	for (std::map<uint16_t, DeviceColumns>::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+		writeChunk(it->first, it->second);
+	m_pending.clear();
+	if (m_writeFailed) {
+		fclose(m_file);
+		m_file = 0;
+		m_index.clear();
+		return false;
+	}
+
+	uint64_t indexOffset = m_offset;
+	std::vector<uint8_t> footer(m_index.size() * ARCHIVE_INDEX_ENTRY_SIZE + ARCHIVE_TRAILER_SIZE);
+	for (size_t i = 0; i < m_index.size(); i++)
+		putIndexEntry(&footer[i * ARCHIVE_INDEX_ENTRY_SIZE], m_index[i]);
+	uint8_t *trailer = &footer[m_index.size() * ARCHIVE_INDEX_ENTRY_SIZE];
+	putU64(trailer, indexOffset);
+	putU32(trailer + 8, (uint32_t)m_index.size());
+	memcpy(trailer + 12, ARCHIVE_TRAILER_MAGIC, 4);
+	bool ok = write(footer);
+
+	if (fclose(m_file) != 0)
+		ok = false;
+	m_file = 0;
+	m_index.clear();
+	return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// ArchiveReader
+
+ArchiveReader::ArchiveReader() : m_file(0) {
+}
+
+ArchiveReader::~ArchiveReader() {
+	close();
+}
+
+void ArchiveReader::close() {
+	if (m_file)
+		fclose(m_file);
+	m_file = 0;
+	m_index.clear();
+}
+
+bool ArchiveReader::fail(const std::string &what) {
+	m_lastError = what;
+	close();
+	return false;
+}
+
+bool ArchiveReader::readAt(uint64_t offset, uint32_t size) {
+	m_buffer.resize(size);
+	return seekFile(m_file, offset) && fread(m_buffer.data(), 1, size, m_file) == size;
+}
+
+bool ArchiveReader::open(const std::string &path) {
+	close();
+	m_file = fopen(path.c_str(), "rb");
+	if (!m_file)
+		return fail("cannot open " + path);
+
+	uint64_t size = fileSize(m_file);
+	if (size < ARCHIVE_HEADER_SIZE + ARCHIVE_TRAILER_SIZE || !readAt(0, ARCHIVE_HEADER_SIZE) ||
+		memcmp(m_buffer.data(), ARCHIVE_MAGIC, 4) != 0)
+		return fail(path + " is not an IMU archive");
+	if (!readAt(size - ARCHIVE_TRAILER_SIZE, ARCHIVE_TRAILER_SIZE) ||
+		memcmp(&m_buffer[12], ARCHIVE_TRAILER_MAGIC, 4) != 0)
+		return fail(path + " has no index (the capture was not closed)");
+
+	uint64_t indexOffset = getU64(&m_buffer[0]);
+	uint32_t count = getU32(&m_buffer[8]);
+	if (indexOffset + (uint64_t)count * ARCHIVE_INDEX_ENTRY_SIZE + ARCHIVE_TRAILER_SIZE != size ||
+		!readAt(indexOffset, count * ARCHIVE_INDEX_ENTRY_SIZE))
+		return fail(path + " has a corrupt index");
+
+	m_index.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+		getIndexEntry(&m_buffer[i * ARCHIVE_INDEX_ENTRY_SIZE], m_index[i]);
+	return true;
+}
+
+bool ArchiveReader::read(uint16_t deviceId, uint16_t axisMask, uint64_t t0, uint64_t t1, std::vector<ImuSample> &out) {
+	if (!m_file) {
+		m_lastError = "archive is not open";
+		return false;
+	}
+
+	std::vector<uint32_t> rows;
+	for (size_t c = 0; c < m_index.size(); c++) {
+		const ArchiveChunkInfo &info = m_index[c];
+		// the per-chunk statistics skip everything outside the query
+		if (info.deviceId != deviceId || info.lastTimestamp < t0 || info.firstTimestamp >= t1)
+			continue;
+
+		size_t n = info.count;
+		m_time.resize(n + BLOCK_VALUES);
+		if (!readAt(info.offset + info.columnOffset[0], info.columnSize[0]) ||
+			!decodeTimeColumn(m_buffer.data(), m_buffer.data() + m_buffer.size(), n, &m_time[0])) {
+			m_lastError = "corrupt timestamp column";
+			return false;
+		}
+
+		// a chunk that lies inside the range is copied whole, without a row list
+		bool whole = info.firstTimestamp >= t0 && info.lastTimestamp < t1;
+		rows.clear();
+		if (!whole) {
+			for (size_t i = 0; i < n; i++) {
+				if (m_time[i] >= t0 && m_time[i] < t1)
+					rows.push_back((uint32_t)i);
+			}
+			if (rows.empty())
+				continue;
+		}
+		size_t selected = whole ? n : rows.size();
+		size_t base = out.size();
+		out.resize(base + selected);
+		ImuSample *dst = &out[base];
+		for (size_t k = 0; k < selected; k++) {
+			dst[k].deviceId = deviceId;
+			dst[k].timestamp = m_time[whole ? k : rows[k]];
+			memset(dst[k].axis, 0, sizeof(dst[k].axis));
+		}
+
+		m_values.resize(n + BLOCK_VALUES);
+		for (size_t a = 0; a < IMU_AXES; a++) {
+			if (!(axisMask & (1 << a)))
+				continue;
+			if (!readAt(info.offset + info.columnOffset[a + 1], info.columnSize[a + 1]) ||
+				!decodeAxisColumn(m_buffer.data(), m_buffer.data() + m_buffer.size(), n, &m_values[0])) {
+				m_lastError = "corrupt axis column";
+				return false;
+			}
+			for (size_t k = 0; k < selected; k++)
+				dst[k].axis[a] = (int16_t)m_values[whole ? k : rows[k]];
+		}
+	}
+	return true;
+}
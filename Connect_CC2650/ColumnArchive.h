@@ -0,0 +1,118 @@
+// ColumnArchive.h : compressed columnar archive for long term IMU storage
+//
+
+#ifndef COLUMNARCHIVE_H
+#define COLUMNARCHIVE_H
+
+#include "ImuSample.h"
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+Samples are grouped per device into chunks of a fixed number of samples. Inside
+a chunk every axis, and the timestamps, form one column:
+
+	header		"CCA1", uint16 version, uint16 reserved
+	chunk		10 columns: timestamp, Gx Gy Gz Ax Ay Az Mx My Mz
+	...
+	index		one ArchiveChunkInfo per chunk (statistics + column offsets)
+	trailer		uint64 index offset, uint32 chunk count, "CCAF"
+
+A column stores the first value and then the differences between neighbouring
+values, zigzag encoded. The differences are either bit-packed with the smallest
+width that fits (in blocks of 128 values spread over 4 interleaved 32-bit lanes,
+so that they are unpacked with SSE2) or written as varints, whichever is smaller.
+
+A reader only loads the index, then seeks to the columns it needs: chunks of
+other devices or outside the time range, and unrequested axes, are never read.
+The archive is only readable once ArchiveWriter::close() wrote the index.
+*/
+
+const size_t ARCHIVE_COLUMNS = 1 + IMU_AXES;		// timestamp + nine axes
+const size_t ARCHIVE_DEFAULT_CHUNK = 1024;		// samples per chunk
+
+// Bit i selects axis i (ImuAxis)
+const uint16_t ARCHIVE_ALL_AXES = (1 << IMU_AXES) - 1;
+uint16_t archiveAxisMask(uint8_t sensorMask);	// IMU_GYRO... to an axis mask
+
+struct ArchiveChunkInfo {
+	uint16_t deviceId;
+	uint32_t count;
+	uint64_t firstTimestamp;
+	uint64_t lastTimestamp;
+	uint64_t offset;							// file offset of the chunk
+	uint32_t columnOffset[ARCHIVE_COLUMNS];		// relative to offset
+	uint32_t columnSize[ARCHIVE_COLUMNS];
+	int16_t min[IMU_AXES];
+	int16_t max[IMU_AXES];
+};
+
+class ArchiveWriter {
+public:
+	ArchiveWriter();
+	~ArchiveWriter();
+
+	bool open(const std::string &path, size_t chunkSize = ARCHIVE_DEFAULT_CHUNK);
+	// After a failed write (disk full...) nothing more is written: the archive
+	// gets no index, so readers refuse it, and close() returns false
+	void append(const ImuSample &sample);
+	bool close();								// writes pending chunks and the index
+	bool failed() const { return m_writeFailed; }
+	bool isOpen() const { return m_file != 0; }
+
+	uint64_t bytesWritten() const { return m_offset; }
+	const std::string &lastError() const { return m_lastError; }
+
+private:
+	struct DeviceColumns {
+		std::vector<uint64_t> time;
+		std::vector<int16_t> axis[IMU_AXES];
+	};
+
+	bool writeChunk(uint16_t deviceId, DeviceColumns &columns);
+	bool write(const std::vector<uint8_t> &data);
+
+	FILE *m_file;
+	size_t m_chunkSize;
+	uint64_t m_offset;
+	bool m_writeFailed;
+	std::map<uint16_t, DeviceColumns> m_pending;
+	std::vector<ArchiveChunkInfo> m_index;
+	std::vector<uint8_t> m_buffer;			// encoding buffers, reused for every chunk
+	std::vector<int64_t> m_values;
+	std::vector<uint32_t> m_scratch;
+	std::string m_lastError;
+};
+
+class ArchiveReader {
+public:
+	ArchiveReader();
+	~ArchiveReader();
+
+	bool open(const std::string &path);
+	void close();
+
+	const std::vector<ArchiveChunkInfo> &chunks() const { return m_index; }
+
+	/* Appends the samples of deviceId with t0 <= timestamp < t1 to out. Only
+	   the axes in axisMask are read and decoded, the others are left at 0. */
+	bool read(uint16_t deviceId, uint16_t axisMask, uint64_t t0, uint64_t t1, std::vector<ImuSample> &out);
+
+	const std::string &lastError() const { return m_lastError; }
+
+private:
+	bool fail(const std::string &what);
+	bool readAt(uint64_t offset, uint32_t size);
+
+	FILE *m_file;
+	std::vector<ArchiveChunkInfo> m_index;
+	std::vector<uint8_t> m_buffer;
+	std::vector<uint64_t> m_time;
+	std::vector<int32_t> m_values;
+	std::string m_lastError;
+};
+
+#endif // COLUMNARCHIVE_H
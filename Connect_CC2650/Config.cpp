@@ -0,0 +1,349 @@
+// Config.cpp : acquisition settings from a config file and the command line
+//
+
+#include "Config.h"
+#include "HciAsync.h"
+#include "SerialTransport.h"
+#include <cstdlib>
+#include <fstream>
+
+AcquisitionConfig::AcquisitionConfig()
+	: port(SERIAL_DEFAULT_PORT), sensorMask(IMU_ALL), periodMs(100), daemon(false), console(true), consoleSet(false),
+	  archivePath("CC2650_archive.cca"), recordingPath("CC2650_capture.rec"),
+	  eventCapture(false), wakeOnMotion(false), preTriggerSeconds(5), postTriggerSeconds(5),
+	  realTime(false), rtPriority(0), latencyTargetUs(1000), latencyReportSeconds(0),
+	  sync(false), syncTickMs(0), syncMaxWaitMs(300), syncInterpolate(true),
+	  trace(false), traceFile("cc2650_trace"), traceThresholdUs(0), traceEvents(65536) {
+	stream.unixPath = "cc2650.sock";
+}
+
+EventCaptureConfig AcquisitionConfig::eventCaptureConfig() const {
+	EventCaptureConfig capture = motion;
+	capture.preSamples = (size_t)(preTriggerSeconds * 1000 / periodMs + 0.5);
+	capture.postSamples = (size_t)(postTriggerSeconds * 1000 / periodMs + 0.5);
+	capture.sensorMask = sensorMask;
+	return capture;
+}
+
+SyncConfig AcquisitionConfig::syncConfig() const {
+	SyncConfig sync;
+	sync.nominalPeriodUs = (uint64_t)periodMs * 1000;
+	sync.tickUs = (uint64_t)(syncTickMs ? syncTickMs : periodMs) * 1000;
+	sync.maxWaitUs = (uint64_t)syncMaxWaitMs * 1000;
+	sync.interpolate = syncInterpolate;
+	// a tag that is ahead keeps its samples for the whole wait, plus a connection event's batch
+	sync.ringSize = syncMaxWaitMs / periodMs + 16;
+	return sync;
+}
+
+static std::string trim(const std::string &s) {
+	size_t first = s.find_first_not_of(" \t\r\n");
+	if (first == std::string::npos)
+		return "";
+	size_t last = s.find_last_not_of(" \t\r\n");
+	std::string t = s.substr(first, last - first + 1);
+	// allow "" and '' for empty values
+	if (t.size() >= 2 && (t[0] == '"' || t[0] == '\'') && t[t.size() - 1] == t[0])
+		t = t.substr(1, t.size() - 2);
+	return t;
+}
+
+static bool parseBool(const std::string &value, bool &result) {
+	if (value == "on" || value == "true" || value == "yes" || value == "1")
+		result = true;
+	else if (value == "off" || value == "false" || value == "no" || value == "0")
+		result = false;
+	else
+		return false;
+	return true;
+}
+
+static bool isBoolKey(const std::string &key) {
+	return key == "daemon" || key == "console" || key == "wom" || key == "realtime" || key == "sync" ||
+		   key == "sync_interpolate" || key == "trace";
+}
+
+static bool parseInt(const std::string &value, long &result) {
+	char *end;
+	result = strtol(value.c_str(), &end, 10);
+	return !value.empty() && *end == '\0';
+}
+
+static bool parseDouble(const std::string &value, double &result) {
+	char *end;
+	result = strtod(value.c_str(), &end);
+	return !value.empty() && *end == '\0';
+}
+
+bool setConfigValue(AcquisitionConfig &config, const std::string &key, const std::string &value, std::string &error) {
+	long n;
+	if (key == "port") {
+		config.port = value;
+	}
+	else if (key == "mac") {
+		std::string mac;
+		if (!normaliseMac(value, mac)) {
+			error = "invalid MAC address: " + value;
+			return false;
+		}
+		config.macs.push_back(mac);
+	}
+	else if (key == "sensors") {
+		uint8_t mask = 0;
+		size_t start = 0;
+		while (start <= value.size()) {
+			size_t comma = value.find(',', start);
+			std::string name = trim(value.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+			if (name == "gyro") mask |= IMU_GYRO;
+			else if (name == "acc") mask |= IMU_ACC;
+			else if (name == "mag") mask |= IMU_MAG;
+			else if (name == "all") mask |= IMU_ALL;
+			else {
+				error = "unknown sensor: " + name;
+				return false;
+			}
+			if (comma == std::string::npos)
+				break;
+			start = comma + 1;
+		}
+		config.sensorMask = mask;
+	}
+	else if (key == "period_ms") {
+		if (!parseInt(value, n) || n < 100 || n > 2550 || n % 10 != 0) {
+			error = "period_ms must be 100..2550 in steps of 10";
+			return false;
+		}
+		config.periodMs = (unsigned)n;
+	}
+	else if (isBoolKey(key)) {
+		bool b;
+		if (!parseBool(value, b)) {
+			error = key + " must be on or off";
+			return false;
+		}
+		if (key == "daemon") {
+			config.daemon = b;
+		}
+		else if (key == "wom") {
+			config.wakeOnMotion = b;
+		}
+		else if (key == "realtime") {
+			config.realTime = b;
+		}
+		else if (key == "sync") {
+			config.sync = b;
+		}
+		else if (key == "sync_interpolate") {
+			config.syncInterpolate = b;
+		}
+		else if (key == "trace") {
+			config.trace = b;
+		}
+		else {
+			config.console = b;
+			config.consoleSet = true;
+		}
+	}
+	else if (key == "tcp_port" || key == "udp_port") {
+		if (!parseInt(value, n) || n < -1 || n > 65535) {
+			error = key + " must be a port number or -1";
+			return false;
+		}
+		(key == "tcp_port" ? config.stream.tcpPort : config.stream.udpPort) = (int)n;
+	}
+	else if (key == "bind") {
+		config.stream.bindAddress = value;
+	}
+	else if (key == "unix_socket") {
+		config.stream.unixPath = value;
+	}
+	else if (key == "archive") {
+		config.archivePath = value;
+	}
+	else if (key == "recording") {
+		config.recordingPath = value;
+	}
+	else if (key == "capture") {
+		if (value != "continuous" && value != "event") {
+			error = "capture must be continuous or event";
+			return false;
+		}
+		config.eventCapture = value == "event";
+	}
+	else if (key == "motion_acc_g" || key == "motion_gyro_dps" || key == "pre_trigger_s" || key == "post_trigger_s") {
+		double d;
+		if (!parseDouble(value, d) || d < 0 || d > 3600) {
+			error = key + " must be a non-negative number";
+			return false;
+		}
+		if (key == "motion_acc_g") config.motion.accThreshold = d;
+		else if (key == "motion_gyro_dps") config.motion.gyroThreshold = d;
+		else if (key == "pre_trigger_s") config.preTriggerSeconds = d;
+		else config.postTriggerSeconds = d;
+	}
+	else if (key == "cpus") {
+		std::vector<int> cpus;
+		size_t start = 0;
+		while (start < value.size()) {
+			size_t comma = value.find(',', start);
+			std::string cpu = trim(value.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+			if (!parseInt(cpu, n) || n < 0 || n > 1023) {
+				error = "invalid CPU number: " + cpu;
+				return false;
+			}
+			cpus.push_back((int)n);
+			if (comma == std::string::npos)
+				break;
+			start = comma + 1;
+		}
+		config.cpus = cpus;
+	}
+	else if (key == "rt_priority") {
+		if (!parseInt(value, n) || n < 0 || n > 99) {
+			error = "rt_priority must be 0..99";
+			return false;
+		}
+		config.rtPriority = (int)n;
+	}
+	else if (key == "latency_target_us" || key == "latency_report_s") {
+		if (!parseInt(value, n) || n < 0 || n > 1000000000) {
+			error = key + " must be a non-negative integer";
+			return false;
+		}
+		(key == "latency_target_us" ? config.latencyTargetUs : config.latencyReportSeconds) = (unsigned)n;
+	}
+	else if (key == "sync_tick_ms" || key == "sync_max_wait_ms") {
+		if (!parseInt(value, n) || n < 0 || n > 60000) {
+			error = key + " must be 0..60000";
+			return false;
+		}
+		(key == "sync_tick_ms" ? config.syncTickMs : config.syncMaxWaitMs) = (unsigned)n;
+	}
+	else if (key == "trace_file") {
+		if (value.empty()) {
+			error = "trace_file must not be empty";
+			return false;
+		}
+		config.traceFile = value;
+	}
+	else if (key == "trace_threshold_us") {
+		if (!parseInt(value, n) || n < 0 || n > 1000000000) {
+			error = key + " must be a non-negative integer";
+			return false;
+		}
+		config.traceThresholdUs = (unsigned)n;
+	}
+	else if (key == "trace_events") {
+		if (!parseInt(value, n) || n < 1024 || n > 16777216) {
+			error = "trace_events must be 1024..16777216";
+			return false;
+		}
+		config.traceEvents = (unsigned)n;
+	}
+	else {
+		error = "unknown setting: " + key;
+		return false;
+	}
+	return true;
+}
+
+bool loadConfigFile(const std::string &path, AcquisitionConfig &config, std::string &error) {
+	std::ifstream file(path.c_str());
+	if (!file) {
+		error = "cannot open config file " + path;
+		return false;
+	}
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+		size_t hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+		if (trim(line).empty())
+			continue;
+		size_t equals = line.find('=');
+		if (equals == std::string::npos) {
+			error = path + ":" + std::to_string(lineNumber) + ": expected key = value";
+			return false;
+		}
+		if (!setConfigValue(config, trim(line.substr(0, equals)), trim(line.substr(equals + 1)), error)) {
+			error = path + ":" + std::to_string(lineNumber) + ": " + error;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool parseCommandLine(int argc, char *argv[], AcquisitionConfig &config, std::string &error) {
+	// the config file is loaded first, so that the other options override it
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 9, "--config=") == 0) {
+			if (!loadConfigFile(arg.substr(9), config, error))
+				return false;
+		}
+		else if (arg == "--config" && i + 1 < argc) {
+			if (!loadConfigFile(argv[++i], config, error))
+				return false;
+		}
+	}
+
+	std::vector<std::string> macs;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			error.clear();
+			return false;
+		}
+		if (arg.compare(0, 2, "--") != 0) {
+			error = "unexpected argument: " + arg;
+			return false;
+		}
+		std::string key = arg.substr(2), value;
+		size_t equals = key.find('=');
+		if (equals != std::string::npos) {
+			value = key.substr(equals + 1);
+			key.erase(equals);
+		}
+		else if (isBoolKey(key)) {
+			// alone it means on; a following on/off, true/false... is its value
+			bool b;
+			value = i + 1 < argc && parseBool(argv[i + 1], b) ? argv[++i] : "on";
+		}
+		else if (i + 1 < argc) {
+			value = argv[++i];
+		}
+		else {
+			error = "missing value for --" + key;
+			return false;
+		}
+		if (key == "config")
+			continue;
+		// MACs given on the command line replace the ones from the file
+		if (key == "mac") {
+			AcquisitionConfig scratch;
+			if (!setConfigValue(scratch, key, value, error))
+				return false;
+			macs.push_back(scratch.macs[0]);
+			continue;
+		}
+		if (!setConfigValue(config, key, value, error))
+			return false;
+	}
+	if (!macs.empty())
+		config.macs = macs;
+	if (config.macs.empty())
+		config.macs.push_back("a0e6f8aed204");		// the lab SensorTag
+	return true;
+}
+
+void printUsage(std::ostream &out, const char *program) {
+	out << "Usage: " << program << " [--config file] [--daemon] [--key value...]\n"
+		<< "Keys: port, mac, sensors, period_ms, daemon, console, bind, tcp_port,\n"
+		<< "      udp_port, unix_socket, archive, recording, capture, wom, motion_acc_g,\n"
+		<< "      motion_gyro_dps, pre_trigger_s, post_trigger_s, realtime, cpus,\n"
+		<< "      rt_priority, latency_target_us, latency_report_s, sync, sync_tick_ms,\n"
+		<< "      sync_max_wait_ms, sync_interpolate, trace, trace_file, trace_threshold_us,\n"
+		<< "      trace_events (see Config.h)\n";
+}
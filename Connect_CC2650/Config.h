@@ -0,0 +1,100 @@
+// Config.h : acquisition settings from a config file and the command line
+//
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "EventCapture.h"
+#include "StreamServer.h"
+#include "Synchronizer.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+The config file holds one "key = value" per line, '#' starts a comment.
+The same keys are accepted on the command line as --key value or --key=value,
+and override the file given with --config. Keys:
+
+	port			serial port of the CC2540 dongle (COM8 on Windows, /dev/ttyACM0 elsewhere)
+	mac				SensorTag address, a0e6f8aed204 or A0:E6:F8:AE:D2:04 (repeatable: one device id per tag)
+	sensors			comma separated list of gyro, acc, mag (all)
+	period_ms		movement sensor period, 100..2550 in steps of 10 (100)
+	daemon			no prompts, stop with SIGINT/SIGTERM (off)
+	console			print every sample (on, off in daemon mode unless set)
+	bind			address of the stream server (0.0.0.0)
+	tcp_port		stream server TCP port, -1 disables (5760)
+	udp_port		stream server UDP port, -1 disables (5761)
+	unix_socket		stream server Unix socket path, "" disables (cc2650.sock)
+	archive			columnar archive path, "" disables (CC2650_archive.cca)
+	recording		indexed recording path, "" disables (CC2650_capture.rec)
+	capture			continuous, or event: only motion events reach the sinks (continuous)
+	wom				wake-on-motion on the tag, it stops sending while still (off)
+	motion_acc_g	event threshold, deviation of |acc| from 1 G (0.1)
+	motion_gyro_dps	event threshold, rotation rate in deg/s (20)
+	pre_trigger_s	seconds kept before an event (5)
+	post_trigger_s	seconds written after the last motion of an event (5)
+	realtime		busy-poll the port, lock memory, apply cpus/rt_priority (off)
+	cpus			comma separated cores the acquisition thread is pinned to (none)
+	rt_priority		real-time priority 1..99 (SCHED_FIFO), 0 keeps the normal one (0)
+	latency_target_us	p99.9 read-to-sink latency the report is checked against (1000)
+	latency_report_s	print the latency histograms every n seconds, 0 only at exit (0)
+	sync			merge the tags' samples into frames on a common timeline (off)
+	sync_tick_ms	spacing of the merged frames, 0 for period_ms (0)
+	sync_max_wait_ms	longest a frame waits for a lagging tag (300)
+	sync_interpolate	interpolate between samples, off holds the last one (on)
+	trace			record read/frame/decode/sync/sink spans of every sample (off)
+	trace_file		trace dumps are written to <trace_file>-<n>.json (cc2650_trace)
+	trace_threshold_us	dump the trace when a read-to-sink latency exceeds this, 0 never (0)
+	trace_events	events kept per thread (65536)
+
+Boolean values are on/off, true/false, yes/no or 1/0; on the command line a
+boolean key alone ("--daemon") means on, "--daemon off" and "--daemon=false" work too.
+*/
+
+struct AcquisitionConfig {
+	std::string port;
+	std::vector<std::string> macs;		// normalised: 12 lower case hex digits
+	uint8_t sensorMask;					// IMU_GYRO | IMU_ACC | IMU_MAG
+	unsigned periodMs;
+	bool daemon;
+	bool console;
+	bool consoleSet;					// console was given explicitly
+	StreamServerConfig stream;
+	std::string archivePath;
+	std::string recordingPath;
+	bool eventCapture;
+	bool wakeOnMotion;
+	EventCaptureConfig motion;			// thresholds; the windows follow from the seconds below
+	double preTriggerSeconds;
+	double postTriggerSeconds;
+	bool realTime;
+	std::vector<int> cpus;
+	int rtPriority;
+	unsigned latencyTargetUs;
+	unsigned latencyReportSeconds;
+	bool sync;
+	unsigned syncTickMs;				// 0: periodMs
+	unsigned syncMaxWaitMs;
+	bool syncInterpolate;
+	bool trace;
+	std::string traceFile;
+	unsigned traceThresholdUs;
+	unsigned traceEvents;
+
+	AcquisitionConfig();
+
+	EventCaptureConfig eventCaptureConfig() const;
+	SyncConfig syncConfig() const;
+
+	bool streamEnabled() const { return stream.tcpPort >= 0 || stream.udpPort >= 0 || !stream.unixPath.empty(); }
+	bool printSamples() const { return consoleSet ? console : !daemon; }
+};
+
+bool setConfigValue(AcquisitionConfig &config, const std::string &key, const std::string &value, std::string &error);
+bool loadConfigFile(const std::string &path, AcquisitionConfig &config, std::string &error);
+bool parseCommandLine(int argc, char *argv[], AcquisitionConfig &config, std::string &error);
+void printUsage(std::ostream &out, const char *program);
+
+#endif // CONFIG_H
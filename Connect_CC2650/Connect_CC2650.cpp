@@ -3,8 +3,9 @@ Copyright (c) 2016
 */
 
 /*
-This program uses the SerialPort class to connect to the CC2650 SensorTag using
-the CC2540 Bluetooth dongle manufactured by Texas Instruments.
+This program uses the cc2650 acquisition library (SerialTransport, DeviceManager)
+to connect to the CC2650 SensorTag using the CC2540 Bluetooth dongle manufactured
+by Texas Instruments.
 
 The algorithm to read from the IMU in 10 steps:
 	1. Initialize GAP and GATT parameters.
@@ -39,18 +40,32 @@ Future work:
 	In short: Make an open source software similar to BLE Device Monitor without the GUI.
 */
 
-//#define _AFXDLL
-
-#include "afxcoll.h"
-#include "SerialPort.h"
+#include "SerialTransport.h"
+#include "DeviceManager.h"
+#include "ImuSample.h"
+#include "StreamServer.h"
+#include "ColumnArchive.h"
+#include "Recording.h"
+#include "Config.h"
+#include "EventCapture.h"
+#include "RealTime.h"
+#include "LatencyHistogram.h"
+#include "Synchronizer.h"
+#include "Trace.h"
+#include <chrono>
+#include <csignal>
+#include <iomanip>
 #include <iostream>
 #include <string>
+#include <vector>
+#ifdef _WIN32
 #include <strsafe.h>
 #include <windows.h>
-#include <sstream>
+#endif
 
 using namespace std;
 
+#ifdef _WIN32
 // This is a code snippet taken from the webpage of MSDN library
 void ErrorExit(LPTSTR lpszFunction)
 {
@@ -84,15 +99,7 @@ void ErrorExit(LPTSTR lpszFunction)
 	LocalFree(lpDisplayBuf);
 	ExitProcess(dw);
 }
-
-string convertBufferToString(unsigned long long src) {
-	string tempBuffer;
-	std::stringstream stream;
-	stream << std::hex << src;	// << std::hex
-	tempBuffer = stream.str();
-
-	return tempBuffer;
-}
+#endif
 
 // Temperature (taken from TI SensorTag CC2650 wiki)
 float convertToRealData(unsigned short hexValue) {
@@ -107,65 +114,6 @@ float convertToRealData(unsigned short hexValue) {
 	return value;
 }
 
-/* The two functions below can be merged into a single function (one algorithm) to optimize memory use */
-// Little to Big Endian Conversion in pairs (1 byte = 1 pair = 2 chars)
-string *convertEndianness(string destination[], string source, int loopStart, int loopEnd) {
-	int j = 0;
-	int nextPosition = 1;
-
-	for (int i = loopStart; i >= loopEnd; i--) {
-		if (i % 2 == 1) {		// odd
-			destination[nextPosition] = source[i];
-		}
-		else {					// even
-			destination[j] = source[i];
-			j += 2;
-			nextPosition = j + 1;
-		}
-	}
-	return destination;
-}
-
-/* Organize the buffer to store values in the following order:
-   Gx(MSB) Gx(LSB) Gy(MSB)...Ax(MSB) Ax(LSB)...Mz(MSB),Mz(LSB) */
-string *organizeBuffer(string destination[], string source[], int loopStart, int loopEnd) {
-	
-	int j = 0;
-	int k;
-	for (int i = loopStart; i < loopEnd; i++) {
-		/* Algorithm to map the following
-		destination[0] = source[2];
-		destination[1] = source[3];
-		destination[2] = source[0];
-		destination[3] = source[1];
-		destination[4] = source[6];
-		destination[5] = source[7];
-		destination[6] = source[4];
-		destination[7] = source[5];
-		destination[8] = source[10];
-		destination[9] = source[11];
-		destination[10] = source[8];
-		destination[11] = source[9];
-		*/
-		k = i - loopStart;
-		if (k == 0 || k == 1 || k == 4 || k == 5 || k == 8 || k == 9)
-			j = k + 2;
-		else
-			j = k - 2;
-		destination[k] = source[j];
-	}
-	
-	return 0;
-}
-
-// 2's complement conversion of signed 16-bit int that has been presented as an unsigned 32-bit int
-int twosComplement(int decimal) {
-	if (decimal > 32767)
-		return (decimal - 65536);
-	else
-		return decimal;
-}
-
 // Gyroscope value
 double sensorMpu9250GyroConvert(int rawData)
 {
@@ -182,453 +130,546 @@ double sensorMpu9250AccConvert(int rawData)
 
 // Magnetometer data does not need conversion. It is done in the SensorTag firmware
 
-int main() {
+// Latency triggered trace dumps are at least this far apart
+const chrono::seconds TRACE_DUMP_INTERVAL(10);
 
-	// GAP
-	unsigned short GAP_initialize[] = { 0x01,0x00,0xFE,0x26,0x08,0x05,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-										0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-										0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,
-										0x00,0x00,0x00 };												// Connect with CC2540 USB dongle
-	unsigned short GAP_SetParam_MinInterval[] = { 0x01, 0x30, 0xFE, 0x03, 0x15, 0x50, 0x00 };
-	unsigned short GAP_SetParam_MaxInterval[] = { 0x01, 0x30, 0xFE, 0x03, 0x16, 0x50, 0x00 };
-	unsigned short GAP_SetParam_Latency[] = { 0x01, 0x30, 0xFE, 0x03, 0x1A, 0x00, 0x00 };
-	unsigned short GAP_SetParam_Timeout[] = { 0x01, 0x30, 0xFE, 0x03, 0x19, 0xD0, 0x07 };
-	unsigned short GAP_DeviceDiscoveryRequest[] = { 0x01, 0x04, 0xFE, 0x03, 0x02, 0x01, 0x00 };						// Search for SensorTag CC2650 (Limited Mode)
-	unsigned short GAP_EstablishLinkRequest[] = { 0x01, 0x09, 0xFE, 0x09, 0x00, 0x00, 0x00, 0x04, 0xD2, 0xAE, 0xF8, 0xE6, 0xA0 };	// Connect with SensorTag
-	unsigned short GAP_TerminateLinkRequest[] = { 0x01, 0x0A, 0xFE, 0x03, 0x00, 0x00, 0x13 };										// Terminate connection
+// Set by SIGINT/SIGTERM or when the console is closed; the acquisition loop then
+// switches the sensor off and terminates the link before exiting
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t shutdownDone = 0;
+// Set by SIGUSR1 (or the T key in interactive mode): the loop dumps the trace
+static volatile sig_atomic_t traceDumpRequested = 0;
+// Set by SIGUSR2 (or the E key): in event capture the loop starts an event on every tag
+static volatile sig_atomic_t eventTriggerRequested = 0;
 
-	// GATT
+void requestStop(int) {
+	stopRequested = 1;
+}
 
-	/*
-	// IR sensor
-	unsigned short GATT_IRTempOn[] = { 0x01, 0x92, 0xFD, 0x06, 0x00, 0x00, 0x22, 0x00, 0x01, 0x00 };		// enable notification (client charac. config: 01:00)
-	unsigned short GATT_IRTempRead_ON[] = { 0x01, 0x92, 0xFD, 0x05, 0x00, 0x00, 0x24, 0x00, 0x01 };			// activate sensor (IR temp config: 01)
-	unsigned short GATT_IRTempRead_OFF[] = { 0x01, 0x92, 0xFD, 0x05, 0x00, 0x00, 0x24, 0x00, 0x00 };		// deactivate sensor (IR temp config: 00)
-	*/
+void requestTraceDump(int) {
+	traceDumpRequested = 1;
+}
+
+void requestEventTrigger(int) {
+	eventTriggerRequested = 1;
+}
 
-	// IMU
-	unsigned short GATT_MovementOn[] = { 0x01, 0x92, 0xFD, 0x06, 0x00, 0x00, 0x3A, 0x00, 0x01, 0x00 };		// enable notification for IMU (client charac. config: 01:00)
-	unsigned short GATT_MovementPeriod[] = { 0x01, 0x92, 0xFD, 0x05, 0x00, 0x00, 0x3E, 0x00, 0x0A };		// movement sensor data readout frequency (input*10)ms
-																											// write last byte: here, it is 10*10 = 100ms (fastest)
-	unsigned short GATT_MovementRead_ON[] = { 0x01, 0x92, 0xFD, 0x06, 0x00, 0x00, 0x3C, 0x00, 0x7F, 0x03 };	// 7F: all IMU values (Gyro, Acc, Mag);
-																											// 0: WOM disabled; 3: 16G Acc range; Resultant bytes: 7F 03
-	unsigned short GATT_MovementRead_OFF[] = { 0x01, 0x92, 0xFD, 0x06, 0x00, 0x00, 0x3C, 0x00, 0x00, 0x03 };
+#ifdef _WIN32
+BOOL WINAPI consoleHandler(DWORD event) {
+	if (event == CTRL_C_EVENT)
+		return FALSE;			// handled by requestStop()
+	stopRequested = 1;
+	// Windows kills the process when this returns, give the loop time to clean up
+	for (int waited = 0; !shutdownDone && waited < 3000; waited += 50)
+		Sleep(50);
+	return TRUE;
+}
 
-	// Open and configure serial port
-start:
-	CSerialPort port;
+// Interactive mode keys: Space stops the readout, T dumps the trace, E triggers an event
+bool stopKeyPressed() {
+	return GetAsyncKeyState(VK_SPACE) != 0;
+}
 
-	HANDLE hPort;
-	hPort = port.OpenPort("COM8");
+bool traceKeyPressed() {
+	return (GetAsyncKeyState('T') & 1) != 0;
+}
 
-	port.ConfigurePort(115200, 8, 0, 0, 1);
+bool eventKeyPressed() {
+	return (GetAsyncKeyState('E') & 1) != 0;
+}
+#else
+// No keyboard polling outside the Windows console: Ctrl+C stops, SIGUSR1 dumps the trace,
+// SIGUSR2 triggers an event
+bool stopKeyPressed() {
+	return false;
+}
 
-	BOOL isTimeoutOk = 0;
-	isTimeoutOk = port.SetCommunicationTimeouts(0, 0, 100, 0, 0);
+bool traceKeyPressed() {
+	return false;
+}
 
-	BOOL isWriteOk = 0;
+bool eventKeyPressed() {
+	return false;
+}
+#endif
 
+// Setup progress of the DeviceManager
+void printSetupMessage(const char *message, void *) {
+	cout << "\n" << message << endl;
+}
 
-	// Connect with CC2540 USB dongle
-	int i = 0;
-	int j = 1;
-	int devAddrCounter = 0;
-	int terminate = 0;
-	int restart = 0;
+void printSample(const ImuSample &sample) {
+	// convert to decimal
+	TraceScope convertSpan("convert", sample.deviceId);
+	double Gx = sensorMpu9250GyroConvert(sample.axis[AXIS_GX]);
+	double Gy = sensorMpu9250GyroConvert(sample.axis[AXIS_GY]);
+	double Gz = sensorMpu9250GyroConvert(sample.axis[AXIS_GZ]);
+	double Ax = sensorMpu9250AccConvert(sample.axis[AXIS_AX]);
+	double Ay = sensorMpu9250AccConvert(sample.axis[AXIS_AY]);
+	double Az = sensorMpu9250AccConvert(sample.axis[AXIS_AZ]);
+	convertSpan.end();
+	int i;
+
+	cout << "\n\nGyroscope readout: " << hex << setfill('0');
+	for (i = AXIS_GX; i <= AXIS_GZ; i++)
+		cout << setw(4) << (unsigned short)sample.axis[i];
+	cout << dec;
+	cout << "\nGx = " << Gx;
+	cout << "\nGy = " << Gy;
+	cout << "\nGz = " << Gz;
+
+	cout << "\nAccelerometer readout: " << hex;
+	for (i = AXIS_AX; i <= AXIS_AZ; i++)
+		cout << setw(4) << (unsigned short)sample.axis[i];
+	cout << dec;
+	cout << "\nAx = " << Ax;
+	cout << "\nAy = " << Ay;
+	cout << "\nAz = " << Az;
+
+	cout << "\nMagnetometer readout: " << hex;
+	for (i = AXIS_MX; i <= AXIS_MZ; i++)
+		cout << setw(4) << (unsigned short)sample.axis[i];
+	cout << dec << setfill(' ');
+	cout << "\nMx = " << sample.axis[AXIS_MX];
+	cout << "\nMy = " << sample.axis[AXIS_MY];
+	cout << "\nMz = " << sample.axis[AXIS_MZ];
+
+	cout << "\n\n";
+}
 
-	int posCounter = 0;
+// Everything a sample is written to: directly in continuous capture, through EventCapture otherwise.
+// A sink left 0 does not get the sample.
+struct SampleSinks {
+	bool print;
+	StreamServer *stream;
+	ArchiveWriter *archive;
+	RecordingWriter *recording;
+};
+
+void writeSample(const ImuSample &sample, void *context) {
+	SampleSinks *sinks = (SampleSinks *)context;
+	if (sinks->print) {
+		TraceScope span("console", sample.deviceId);
+		printSample(sample);
+	}
+	if (sinks->stream && sinks->stream->isOpen()) {
+		TraceScope span("stream", sample.deviceId);
+		sinks->stream->publish(sample);
+	}
+	if (sinks->archive && sinks->archive->isOpen()) {
+		TraceScope span("archive", sample.deviceId);
+		sinks->archive->append(sample);
+	}
+	if (sinks->recording && sinks->recording->isOpen()) {
+		TraceScope span("recording", sample.deviceId);
+		sinks->recording->append(sample);
+	}
+}
 
-	BOOL isReadOk = 0;
-	char userInput;
+// Where a sample goes after decoding (or synchronization): the sinks, or event capture first
+struct SampleRoute {
+	bool eventCapture;
+	EventCapture *capture;
+	SampleSinks *sinks;
+	bool announce;				// print the start of each motion event
+};
+
+void routeSample(const ImuSample &sample, SampleRoute &route) {
+	if (route.eventCapture) {
+		TraceScope span("event capture", sample.deviceId);
+		if (route.capture->push(sample) && route.announce)
+			cout << "Motion event " << route.capture->events() << " on device " << sample.deviceId << endl;
+	}
+	else {
+		writeSample(sample, route.sinks);
+	}
+}
 
-	// unsigned short is 2 bytes or 16 bits
-	unsigned long long dataReceived;		// this stores the current reading from the SensorTag
-	//unsigned short dataReceived3;
-	string buffer, allBuffer;
+// One line per merged frame: time, then per tag gyro (deg/s), acc (G), mag (uT); * marks a stale row
+void printFrame(const SyncFrame &frame) {
+	cout << fixed << setprecision(3) << frame.timestamp / 1000000 << '.' << setw(6) << setfill('0')
+		 << frame.timestamp % 1000000 << setfill(' ');
+	for (size_t d = 0; d < frame.deviceCount; d++) {
+		const SyncRow &row = frame.rows[d];
+		cout << " | " << d << (row.flags & SYNC_STALE ? "*" : "");
+		if (!(row.flags & SYNC_VALID)) {
+			cout << " -";
+			continue;
+		}
+		for (int a = AXIS_GX; a <= AXIS_GZ; a++)
+			cout << ' ' << sensorMpu9250GyroConvert(row.axis[a]);
+		for (int a = AXIS_AX; a <= AXIS_AZ; a++)
+			cout << ' ' << sensorMpu9250AccConvert(row.axis[a]);
+		for (int a = AXIS_MX; a <= AXIS_MZ; a++)
+			cout << ' ' << row.axis[a];
+	}
+	cout << defaultfloat << setprecision(6) << '\n';
+}
 
-	// storage for sensor readouts after endian conversion (little to big endian)
-	string *reversed0, *reversed1, *reversed2;
-	string r0[10], r1[16], r2[10];
+// Synchronized mode: the frame is printed as one line, its rows go to the stream like decoded
+// samples stamped with the tick time (stale rows are left out, the tag has nothing new)
+struct FrameOutput {
+	bool print;
+	SampleRoute *route;
+};
+
+void writeFrame(const SyncFrame &frame, void *context) {
+	FrameOutput *output = (FrameOutput *)context;
+	if (output->print) {
+		TraceScope span("console");
+		printFrame(frame);
+	}
+	ImuSample sample;
+	sample.timestamp = frame.timestamp;
+	for (size_t d = 0; d < frame.deviceCount; d++) {
+		const SyncRow &row = frame.rows[d];
+		if (!(row.flags & SYNC_VALID) || (row.flags & SYNC_STALE))
+			continue;
+		sample.deviceId = (uint16_t)d;
+		for (int a = 0; a < IMU_AXES; a++)
+			sample.axis[a] = row.axis[a];
+		routeSample(sample, *output->route);
+	}
+}
 
-	// storage for the rearranged readouts (after converting endianness) which will lead to actual calculations
-	string Gyro_pre[12], Acc_pre[12], Mag_pre[12];
-	string Gyro[12], Acc[12], Mag[12];
-	string GyroX, GyroY, GyroZ, AccX, AccY, AccZ, MagX, MagY, MagZ;
+void reportLatency(const LatencyHistogram &decode, const LatencyHistogram &sink, unsigned targetUs) {
+	cout << "Latency from serial read to" << endl;
+	decode.report(cout, "decoded", 0);
+	sink.report(cout, "sinks", (uint64_t)targetUs * 1000);
+}
 
-	// storage for actual values
-	double Gx, Gy, Gz, Ax, Ay, Az;
+// Writes what the trace rings hold to <trace_file>-<n>.json
+void dumpTrace(const AcquisitionConfig &config, const char *reason) {
+	static int dumps = 0;
+	string path = config.traceFile + "-" + to_string(++dumps) + ".json", error;
+	if (traceDump(path, error))
+		cout << "Trace (" << reason << ") written to " << path << endl;
+	else
+		cout << "Trace not written: " << error << endl;
+}
 
-	while (i < 42) {
-		port.WriteByte(GAP_initialize[i], 1);
-		i++;
+// Write out what is still buffered in the sinks (the archive index is written here)
+void shutdownSinks(StreamServer &streamServer, ArchiveWriter &archive, RecordingWriter &recording,
+				   const EventCapture &eventCapture, Synchronizer &synchronizer, const AcquisitionConfig &config) {
+	if (config.sync) {
+		synchronizer.flush();
+		cout << synchronizer.framesEmitted() << " synchronized frame(s), " << synchronizer.staleRows() << " stale row(s), "
+			 << synchronizer.gaps() << " lost sample(s)" << endl;
+		for (size_t d = 0; d < synchronizer.deviceCount(); d++)
+			cout << "Device " << d << " clock drift " << fixed << setprecision(1) << synchronizer.clockDriftPpm((uint16_t)d)
+				 << defaultfloat << setprecision(6) << " ppm" << endl;
 	}
+	if (config.eventCapture)
+		cout << eventCapture.events() << " motion event(s), " << eventCapture.samplesOut() << " of "
+			 << eventCapture.samplesIn() << " samples kept" << endl;
+	streamServer.flush();
+	streamServer.close();
+	if (!archive.close())
+		cout << "Archive incomplete: " << archive.lastError() << endl;
+	if (!recording.close())
+		cout << "Recording incomplete: " << recording.lastError() << endl;
+	cout << "Shutdown complete" << endl;
+	shutdownDone = 1;
+}
 
-	cout << "\n\nSuccessfully connected with the CC2540 USB dongle " << endl;
-	while (j < 8) {
-		port.ReadByte(dataReceived, 8);
-		j++;
+int main(int argc, char *argv[]) {
+
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	AcquisitionConfig config;
+	string configError;
+	if (!parseCommandLine(argc, argv, config, configError)) {
+		if (!configError.empty())
+			cout << configError << endl;
+		printUsage(cout, argv[0]);
+		return configError.empty() ? 0 : 1;
 	}
+	bool printSamples = config.printSamples();
+
+	signal(SIGINT, requestStop);
+	signal(SIGTERM, requestStop);
+#ifdef SIGUSR1
+	signal(SIGUSR1, requestTraceDump);
+#endif
+#ifdef SIGUSR2
+	signal(SIGUSR2, requestEventTrigger);
+#endif
+#ifdef _WIN32
+	SetConsoleCtrlHandler(consoleHandler, TRUE);
+#endif
 
-	// Set connection intervals, slave latency and supervision timeout
-	i = 0;
-	cout << "\nSetting connection intervals and slave latency..." << endl;
-	while (i < 21) {
-		if (i < 7) {
-			port.WriteByte(GAP_SetParam_MinInterval[i], 1);
-			i++;
-		}
-		else if (i >= 7 && i < 14) {
-			port.WriteByte(GAP_SetParam_MaxInterval[i], 1);
-			i++;
-		}
-		else {
-			port.WriteByte(GAP_SetParam_Latency[i], 1);
-			i++;
-		}
+	/*
+	// IR sensor (GATT_WriteCharValue: connection handle, attribute handle, value)
+	unsigned short GATT_IRTempOn[] = { 0x01, 0x92, 0xFD, 0x06, 0x00, 0x00, 0x22, 0x00, 0x01, 0x00 };		// enable notification (client charac. config: 01:00)
+	unsigned short GATT_IRTempRead_ON[] = { 0x01, 0x92, 0xFD, 0x05, 0x00, 0x00, 0x24, 0x00, 0x01 };			// activate sensor (IR temp config: 01)
+	unsigned short GATT_IRTempRead_OFF[] = { 0x01, 0x92, 0xFD, 0x05, 0x00, 0x00, 0x24, 0x00, 0x00 };		// deactivate sensor (IR temp config: 00)
+	*/
+
+	// Movement sensor settings written to every SensorTag
+	uint8_t movementPeriod = (uint8_t)(config.periodMs / 10);		// (input*10)ms: 10*10 = 100ms (fastest)
+	uint8_t movementSensors = movementConfig(config.sensorMask, config.wakeOnMotion);	// 7F: all IMU values, WOM disabled
+
+	// Serve decoded samples to remote dashboards (see StreamProtocol.h)
+	StreamServer streamServer;
+	if (config.streamEnabled() && !streamServer.open(config.stream))
+		cout << "Stream server disabled: " << streamServer.lastError() << endl;
+
+	// Compressed archive of every sample (read it back with ArchiveReader)
+	ArchiveWriter archive;
+	if (!config.archivePath.empty() && !archive.open(config.archivePath))
+		cout << "Archive disabled: " << archive.lastError() << endl;
+
+	// Raw capture with a time index for seeking (RecordingReader::find)
+	RecordingWriter recording;
+	if (!config.recordingPath.empty() && !recording.open(config.recordingPath))
+		cout << "Recording disabled: " << recording.lastError() << endl;
+
+	// Synchronized mode: the archive and recording keep the decoded samples, the merged frames
+	// go to the console (as a whole instead of sample by sample) and the stream
+	SampleSinks sinks = { printSamples && !config.sync, config.sync ? 0 : &streamServer, &archive, &recording };
+	SampleSinks frameSinks = { false, &streamServer, 0, 0 };
+
+	// Event capture: idle samples only go to the pre-trigger rings (see EventCapture.h)
+	EventCapture eventCapture(config.eventCaptureConfig(), writeSample, &sinks);
+	EventCapture frameCapture(config.eventCaptureConfig(), writeSample, &frameSinks);
+	if (config.eventCapture)
+		cout << "Event capture: " << config.preTriggerSeconds << " s before and " << config.postTriggerSeconds
+			 << " s after motion" << (config.wakeOnMotion ? ", wake-on-motion on the tag" : "") << endl;
+	SampleRoute route = { config.eventCapture, &eventCapture, &sinks, true };
+	SampleRoute frameRoute = { config.eventCapture, &frameCapture, &frameSinks, false };
+
+	// Synchronized mode: one frame per tick with every tag's values on the host timeline (see Synchronizer.h)
+	FrameOutput frameOutput = { printSamples, &frameRoute };
+	Synchronizer synchronizer(config.syncConfig(), writeFrame, &frameOutput);
+	synchronizer.reserveDevices(config.macs.size());
+	if (config.sync)
+		cout << "Synchronized frames every " << config.syncConfig().tickUs / 1000 << " ms, waiting up to "
+			 << config.syncMaxWaitMs << " ms for a lagging tag" << endl;
+
+	bool firstSample = true;
+
+	// Time from the read that completed a notification until it is decoded / written to the sinks
+	LatencyHistogram decodeLatency, sinkLatency;
+	chrono::steady_clock::time_point lastLatencyReport = chrono::steady_clock::now();
+
+	// Real-time mode: this thread does all reading and decoding, keep it on its cores and in RAM
+	if (config.realTime) {
+		string rtError;
+		if (!config.cpus.empty() && !pinCurrentThread(config.cpus, rtError))
+			cout << "Acquisition thread not pinned: " << rtError << endl;
+		if (config.rtPriority > 0 && !setRealTimePriority(config.rtPriority, rtError))
+			cout << "No real-time priority: " << rtError << endl;
+		if (!lockAllMemory(rtError))
+			cout << "Memory not locked: " << rtError << endl;
+		prefaultStack();
 	}
-	j = 1;
-	while (j < 3) {							// Dongle sends exactly 9 bytes at this point
-		port.ReadByte(dataReceived, 8);
-		//cout << "Datastream (setparam interval-latency) " << j << "= " << dataReceived << endl;
-		j++;
+
+	// Tracing: this thread records its spans into a ring allocated here (see Trace.h)
+	if (config.trace) {
+		traceStart(config.traceEvents);
+		traceRegisterThread("acquisition");
 	}
+	chrono::steady_clock::time_point lastTraceDump = chrono::steady_clock::now() - TRACE_DUMP_INTERVAL;
 
-	cout << "\nSetting supervision timeout..." << endl;
-	i = 0;
-	while (i < 7) {
-		port.WriteByte(GAP_SetParam_Timeout[i], 1);
-		i++;
+	// Open and configure serial port (115200 8N1, a read returns as soon as any byte is there or after 100 ms)
+start:
+	SerialTransport port;
+	string portError;
+	if (!port.open(config.port, portError)) {
+		cout << portError << endl;
+		return 1;
 	}
-	j = 1;
-	while (j < 3) {							// Dongle sends another 5 bytes at this point
-		port.ReadByte(dataReceived, 8);
-		//cout << "Datastream (setparam timeout) " << j << "= " << dataReceived << endl;
-		j++;
+
+	// GAP/GATT exchanges go through the event loop (see HciAsync.h), a signal aborts them
+	DeviceManager tags(port);
+	tags.setAbortFlag(&stopRequested);
+	tags.setLogCallback(printSetupMessage, 0);
+	if (config.realTime) {
+		string rtError;
+		if (!lockMemory(tags.framePool().memory(), tags.framePool().memorySize(), rtError))
+			cout << "Frame pool not locked: " << rtError << endl;
 	}
 
+	char userInput = 'n';
 
-	// Scan for SensorTag
-	cout << "\nDiscovering SensorTag..." << endl;
-	i = 0;
-	while (i < 7) {
-		port.WriteByte(GAP_DeviceDiscoveryRequest[i], 1);
-		i++;
+	cout << "\nInitializing the CC2540 USB dongle and setting connection intervals, slave latency and supervision timeout..." << endl;
+	HciResult result = tags.initialize();
+	if (result.ok()) {
+		cout << "\nDiscovering SensorTag(s)..." << endl;
+		result = tags.connect(config.macs);
 	}
-
-	int m = 0;
-	BOOL readData = 0;
-	BOOL movementDataFound = 0;
-	j = 1;
-	std::stringstream stream;
-	string MAC = "a0e6f8aed204";										// MAC address for the sensortag
-	while (1) {
-		port.ReadByte(dataReceived, 8);
-		//cout << "Datastream " << j << "= " << dataReceived << endl;
-		if (j == 300 && devAddrCounter < 2) {
-			cout << "SensorTag discovery timed out. Restarting the session..." << endl;
-			cout << "_______________________________________________________" << endl;
-			restart = 1;
-			break;
+	if (!result.ok()) {
+		if (tags.deviceCount() > 0)
+			tags.disconnect();
+		port.close();
+		if (stopRequested) {
+			cout << "\nStopped during setup" << endl;
+			shutdownSinks(streamServer, archive, recording, eventCapture, synchronizer, config);
+			return 0;
 		}
+		cout << "SensorTag setup failed (status 0x" << hex << (int)result.status << dec << "). Restarting the session..." << endl;
+		cout << "_______________________________________________________" << endl;
+		goto start;		// Kind of cornered myself into using a goto statement because the sensor doesn't always respond on the first try
+	}
 
-		stream << std::hex << dataReceived;
-		buffer = stream.str();
-		stream.str(std::string());										// clear stringstream buffer for next read
-		//cout << "Datastream (string) " << j << "= " << buffer << endl;
-
-		if (buffer.find(MAC) != std::string::npos) {					// if SensorTag MAC address is found
-			devAddrCounter += 1;
-			cout << "\nDevice Address counter = " << devAddrCounter << "\n" << endl;			
-			if (devAddrCounter == 2) {
-
-				// Establish connection with SensorTag	
-				cout << "\nSensorTag found! Establishing connection..." << endl;
-				i = 0;
-				while (i < 13) {
-					port.WriteByte(GAP_EstablishLinkRequest[i], 1);
-					i++;
-				}
-				j = 0;
-				cout << "Connection established..." << endl;
-				cout << "Do you want to activate the Movement sensor? (y/n) ";
+	if (config.daemon) {
+		userInput = 'y';
+	}
+	else {
+		cout << "Do you want to activate the Movement sensor? (y/n) ";
+		cin >> userInput;
+	}
+	if (userInput == 'y' && !stopRequested) {
+		// Movement sensor ON: notifications and data transmission frequency, all tags in parallel
+		cout << "\nActivating movement sensor, setting data transmission frequency to " << config.periodMs << " milliseconds" << endl;
+		result = tags.enableMovement(movementPeriod);
+		if (!result.ok())
+			cout << "Activating the movement sensor failed (status 0x" << hex << (int)result.status << dec << ")" << endl;
+
+		if (result.ok()) {
+			cout << "\nSensor activated..." << endl;
+			if (config.daemon) {
+				userInput = 'y';
+			}
+			else {
+				cout << "\nDo you want to read from the Movement sensor? (Enter y/n) (Press SPACE or Ctrl+C to terminate after readout is done.)" << endl;
 				cin >> userInput;
-				if (userInput == 'y') {
-					// Movement sensor ON
-					cout << "\nActivating movement sensor..." << endl;
-					i = 0;
-					while (i < 10) {
-						//port.WriteByte(GATT_IRTempOn[i], 1);
-						port.WriteByte(GATT_MovementOn[i], 1);
-						i++;
-					}
-					j = 1;
-					while (j < 9) {
-						port.ReadByte(dataReceived, 8);
-						//cout << "Datastream (movement ON) " << j << "= " << hex << dataReceived << endl;
-						j++;
+			}
+		}
+		if (result.ok() && userInput == 'y' && !stopRequested) {
+			// the sensor configuration starts the samples; without it the loop would wait for nothing
+			result = tags.startMovement(movementSensors);
+			if (!result.ok())
+				cout << "Starting the movement sensor failed (status 0x" << hex << (int)result.status << dec << ")" << endl;
+		}
+		if (result.ok() && userInput == 'y' && !stopRequested) {
+			// in real-time mode a read returns at once and the loop spins on the port
+			if (config.realTime)
+				port.setReadTimeout(0);
+			SampleBatch batch;
+			while (1) {
+				// Stop on a signal, or when Spacebar is pressed (interactive mode only: no keyboard poll in daemon mode)
+				if (stopRequested || (!config.daemon && stopKeyPressed()))
+					break;
+				// Read sensor output: one read, framed and decoded in place (see DeviceManager.h)
+				if (tags.poll(batch) < 0) {
+					cout << "\nReading from " << config.port << " failed" << endl;
+					break;
+				}
+				chrono::steady_clock::time_point readTime = batch.readTime;
+				if (batch.count > 0) {
+					uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - readTime).count();
+					for (size_t d = 0; d < batch.count; d++)
+						decodeLatency.record(ns);
+				}
+
+				for (size_t d = 0; d < batch.count; d++) {
+					const ImuSample &sample = batch.samples[d];
+					if (firstSample) {
+						firstSample = false;
+						cout << "First sample " << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count()
+							 << " ms after start" << endl;
 					}
-					// set data transmission frequency
-					cout << "\nSetting data transmission frequency to 100 milliseconds" << endl;
-					i = 0;
-					while (i < 9) {
-						port.WriteByte(GATT_MovementPeriod[i], 1);
-						i++;
+
+					routeSample(sample, route);
+					if (config.sync) {
+						TraceScope span("sync", sample.deviceId);
+						synchronizer.push(sample, syncMonotonicUs(readTime));
 					}
-					j = 1;
-					while (j < 5) {
-						port.ReadByte(dataReceived, 8);
-						//cout << "Datastream (movement period) " << j << "= " << hex << dataReceived << endl;
-						j++;
+				}
+				// frames a lagging tag held back go out once the wait is over
+				if (config.sync)
+					synchronizer.poll(syncMonotonicUs());
+				if (batch.count > 0) {
+					chrono::steady_clock::time_point sinkTime = chrono::steady_clock::now();
+					uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(sinkTime - readTime).count();
+					for (size_t d = 0; d < batch.count; d++)
+						sinkLatency.record(ns);
+					if (config.latencyReportSeconds > 0 &&
+						sinkTime - lastLatencyReport >= chrono::seconds(config.latencyReportSeconds)) {
+						reportLatency(decodeLatency, sinkLatency, config.latencyTargetUs);
+						lastLatencyReport = sinkTime;
 					}
-					userInput = 'a';
-					cout << "\nSensor activated..." << endl;
-					cout << "\nDo you want to read from the Movement sensor? (Enter y/n) (Press SPACE to terminate after readout is done.)" << endl;
-					cin >> userInput;
-					if (userInput == 'y') {
-						j = 1;
-						i = 0;
-						while (i < 10) {
-							//port.WriteByte(GATT_IRTempRead_ON[i], 1);
-							port.WriteByte(GATT_MovementRead_ON[i], 1);
-							i++;
-						}
-						i = 0;
-						while (1) {
-							// Check if Spacebar is pressed (the user wants to end the program)
-							if (GetAsyncKeyState(VK_SPACE)) {
-								terminate += 1;
-								while (i < 10) {
-									//port.WriteByte(GATT_IRTempRead_OFF[i], 1);
-									port.WriteByte(GATT_MovementRead_OFF[i], 1);
-									i++;
-								}
-								i = 0;
-								while (i < 7) {
-									port.WriteByte(GAP_TerminateLinkRequest[i], 1);
-									i++;
-								}
-								cout << "\nSensor deactivated!" << endl;
-							}
-							if (terminate > 0) {
-								break;
-							}
-							// Read sensor output
-							if (!readData) {
-								//cout << "\nReading 1st 14 bytes...\n" << endl;
-								while (m < 14) {
-									port.ReadByte(dataReceived, 8);
-									//cout << "Datastream (1st 14 bytes) " << m << "= " << hex << dataReceived << endl;
-									m++;
-								}
-								cout << "" << endl;
-								readData = 1;
-							}
-							
-							port.ReadByte(dataReceived, 8);
-							if (dataReceived == 21929590532) {		/* this is probably the raw 00 39 14... output in hex format
-																	   after which the buffer contains data readouts from the sensors */
-								movementDataFound = 1;				// not sure why I am using this flag (will get back to it later)
-								for (int a = 0; a < 3; a++) {
-									port.ReadByte(dataReceived, 8);
-
-									if (a == 0) {
-										//cout << "\nDatastream (1) " << "= " << hex << dataReceived << endl;
-										buffer = convertBufferToString(dataReceived);
-										//cout << "raw string buffer1: " << buffer << endl;
-										reversed0 = convertEndianness(r0, buffer, 9, 0);
-									}
-									else if (a == 1) {
-										//cout << "\nDatastream (2) " << "= " << hex << dataReceived << endl;
-										buffer = convertBufferToString(dataReceived);
-										//cout << "raw string buffer2: " << buffer << endl;
-										reversed1 = convertEndianness(r1, buffer, 15, 0);								
-									}
-									else {
-										//cout << "\nDatastream (3) " << "= " << hex << dataReceived << "\n" << endl;
-										buffer = convertBufferToString(dataReceived);
-										//cout << "raw string buffer3: " << buffer << endl;
-										reversed2 = convertEndianness(r2, buffer, 15, 6);
-									}								
-								}
-
-								//cout << "Reversed0: ";
-								for (i = 0; i < 10; i++) {
-									allBuffer.append(reversed0[i]);
-									//cout << reversed0[i];
-								}
-								//cout << "\n";
-								//cout << "Reversed1: ";
-								for (i = 0; i < 16; i++) {
-									allBuffer.append(reversed1[i]);
-									//cout << reversed1[i];
-								}
-								//cout << "\n";
-								//cout << "Reversed2: ";
-								for (i = 0; i < 10; i++) {
-									allBuffer.append(reversed2[i]);
-									//cout << reversed2[i];
-								}
-								cout << "\n";
-
-								//cout << "\nAfter Endianness conversion: " << endl;
-								//cout << "Gyro + Acc + Mag: " << allBuffer << endl;
-
-								//cout << "\nGyroscope readout (RAW): ";
-								for (i = 0; i < 12; i++) {
-									Gyro_pre[i] = allBuffer[i];									
-									//cout << allBuffer[i];
-								}
-								organizeBuffer(Gyro, Gyro_pre, 0, 12);
-								cout << "\nGyroscope readout: ";
-								for (i = 0; i < 12; i++) {
-									cout << Gyro[i];
-									if (i < 4)
-										GyroX.append(Gyro[i]);
-									else if (i >= 4 && i < 8)
-										GyroY.append(Gyro[i]);
-									else
-										GyroZ.append(Gyro[i]);
-								}
-								// convert to decimal
-								Gx = sensorMpu9250GyroConvert(twosComplement(std::stoi(GyroX, 0, 16)));
-								Gy = sensorMpu9250GyroConvert(twosComplement(std::stoi(GyroY, 0, 16)));
-								Gz = sensorMpu9250GyroConvert(twosComplement(std::stoi(GyroZ, 0, 16)));
-								cout << "\nGx = " << Gx;
-								cout << "\nGy = " << Gy;
-								cout << "\nGz = " << Gz;
-
-								//cout << "\n\nAccelerometer readout (RAW): ";
-								for (i = 12; i < 24; i++) {
-									j = i - 12;
-									Acc_pre[j] = allBuffer[i];
-									//cout << allBuffer[i];									
-								}
-								organizeBuffer(Acc, Acc_pre, 12, 24);
-								cout << "\nAccelerometer readout: ";
-								for (i = 0; i < 12; i++) {
-									cout << Acc[i];
-									if (i < 4)
-										AccX.append(Acc[i]);
-									else if (i >= 4 && i < 8)
-										AccY.append(Acc[i]);
-									else
-										AccZ.append(Acc[i]);
-								}
-								// convert to decimal
-								Ax = sensorMpu9250AccConvert(twosComplement(std::stoi(AccX, 0, 16)));
-								Ay = sensorMpu9250AccConvert(twosComplement(std::stoi(AccY, 0, 16)));
-								Az = sensorMpu9250AccConvert(twosComplement(std::stoi(AccZ, 0, 16)));
-								cout << "\nAx = " << Ax;
-								cout << "\nAy = " << Ay;
-								cout << "\nAz = " << Az;
-
-								//cout << "\n\nMagnetometer readout (RAW): ";
-								for (i = 24; i < 36; i++) {
-									j = i - 24;
-									Mag_pre[j] = allBuffer[i];									
-									//cout << allBuffer[i];
-								}
-								organizeBuffer(Mag, Mag_pre, 24, 36);
-								cout << "\nMagnetometer readout: ";
-								for (i = 0; i < 12; i++) {
-									cout << Mag[i];
-									if (i < 4)
-										MagX.append(Mag[i]);
-									else if (i >= 4 && i < 8)
-										MagY.append(Mag[i]);
-									else
-										MagZ.append(Mag[i]);
-								}
-								// convert to decimal
-
-								cout << "\nMx = " << twosComplement(std::stoi(MagX, 0, 16));
-								cout << "\nMy = " << twosComplement(std::stoi(MagY, 0, 16));
-								cout << "\nMz = " << twosComplement(std::stoi(MagZ, 0, 16));
-
-								cout << "\n\n";
-								movementDataFound = 0;
-								allBuffer = "";
-								GyroX = "", GyroY = "", GyroZ = "";
-								AccX  = "", AccY  = "", AccZ  = "";
-								MagX  = "", MagY  = "", MagZ  = "";
-								for (i = 0; i < 10; i++) {
-									reversed0[i].clear();
-								}
-								for (i = 0; i < 16; i++) {
-									reversed1[i].clear();
-								}
-								for (i = 0; i < 10; i++) {
-									reversed2[i].clear();
-								}
-								
-							}
-
-							/* THIS PORTION TESTS THE IR TEMPERATURE SENSOR */
-							/*
-							if (dataReceived3 == 8454) {
-								//swapped = (dataReceived << 8 | dataReceived >> 8);
-								cout << "min temp = " << hex << dataReceived3 << endl;
-								for (int a = 0; a < 3; a++) {									
-									port.ReadByte3(dataReceived3, 2);
-									//cout << "bytes read = " << port.ReadByte2(dataReceived, 2) << endl;
-									//data[a] = dataReceived;
-									if (a == 0) {
-										value = convertToRealData(dataReceived3);
-										cout << "Object temperature: "  << hex << dataReceived3 << endl;
-										cout << "Object temperature: (real) " << value << endl;
-									}
-									else if (a == 1){
-										value = convertToRealData(dataReceived3);
-										cout << "Ambience temperature:  " << hex << dataReceived3 << endl;
-										cout << "Ambience temperature (real): " << value << endl;
-									}
-									else {										
-										cout << "max temp:  " << hex << dataReceived3 << endl;
-										value = convertToRealData(dataReceived3);
-										cout << "max temp (real):  " << value << endl;
-									}
-								}
-							}
-							*/
-							j++;
+					// a slow sample: keep the spans that explain it
+					if (config.trace && config.traceThresholdUs > 0 && ns > (uint64_t)config.traceThresholdUs * 1000) {
+						traceInstant("latency threshold exceeded");
+						if (sinkTime - lastTraceDump >= TRACE_DUMP_INTERVAL) {
+							dumpTrace(config, "latency threshold exceeded");
+							lastTraceDump = chrono::steady_clock::now();
 						}
 					}
-					else {
-						cout << "\nQuitting program..." << endl;
-						terminate += 1;
-						i = 0;
-						while (i < 10) {
-							port.WriteByte(GATT_MovementRead_OFF[i], 1);
-							i++;
-						}
-						i = 0;
-						while (i < 7) {
-							port.WriteByte(GAP_TerminateLinkRequest[i], 1);
-							i++;
-						}
-						port.ClosePort();
+				}
+				// an external trigger: every tag's pre-trigger ring is written out and the post-trigger window starts
+				if (config.eventCapture && (eventTriggerRequested || (!config.daemon && eventKeyPressed()))) {
+					eventTriggerRequested = 0;
+					for (size_t d = 0; d < tags.deviceCount(); d++) {
+						eventCapture.trigger((uint16_t)d);
+						if (config.sync)
+							frameCapture.trigger((uint16_t)d);
 					}
+					cout << "Event triggered on all devices, " << eventCapture.events() << " event(s) so far" << endl;
 				}
-				else {
-					cout << "\nQuitting program..." << endl;
-					terminate += 1;
-					i = 0;
-					while (i < 7) {
-						port.WriteByte(GAP_TerminateLinkRequest[i], 1);
-						i++;
+				if (config.trace && (traceDumpRequested || (!config.daemon && traceKeyPressed()))) {
+					traceDumpRequested = 0;
+					dumpTrace(config, "requested");
+				}
+
+				// The stream server is served between reads; in real-time mode only when the port was idle
+				if (streamServer.isOpen() && (!config.realTime || batch.bytesRead <= 0)) {
+					TraceScope span("stream poll");
+					streamServer.poll(0);
+				}
+				// buffered records go to disk between reads, when a flush threshold is reached
+				if (recording.isOpen() && batch.bytesRead <= 0)
+					recording.flushIfDue();
+				if (config.realTime && batch.bytesRead <= 0)
+					cpuRelax();
+
+				/* THIS PORTION TESTS THE IR TEMPERATURE SENSOR */
+				/*
+				if (dataReceived3 == 8454) {
+					//swapped = (dataReceived << 8 | dataReceived >> 8);
+					cout << "min temp = " << hex << dataReceived3 << endl;
+					for (int a = 0; a < 3; a++) {									
+						port.ReadByte3(dataReceived3, 2);
+						//cout << "bytes read = " << port.ReadByte2(dataReceived, 2) << endl;
+						//data[a] = dataReceived;
+						if (a == 0) {
+							value = convertToRealData(dataReceived3);
+							cout << "Object temperature: "  << hex << dataReceived3 << endl;
+							cout << "Object temperature: (real) " << value << endl;
+						}
+						else if (a == 1){
+							value = convertToRealData(dataReceived3);
+							cout << "Ambience temperature:  " << hex << dataReceived3 << endl;
+							cout << "Ambience temperature (real): " << value << endl;
+						}
+						else {										
+							cout << "max temp:  " << hex << dataReceived3 << endl;
+							value = convertToRealData(dataReceived3);
+							cout << "max temp (real):  " << value << endl;
+						}
 					}
-					port.ClosePort();
 				}
+				*/
 			}
+			port.setReadTimeout(100);
 		}
-		if (terminate > 0) {
-			port.ClosePort();
-			break;
-		}
-		j++;
 	}
-	if (restart == 1) {
-		port.ClosePort();
-		goto start;		// Kind of cornered myself into using a goto statement because the sensor doesn't always respond on the first try
+	else {
+		cout << "\nQuitting program..." << endl;
 	}
+
+	// Movement sensor OFF and links terminated, on all tags at once
+	tags.disconnect();
+	cout << "\nSensor deactivated!" << endl;
+	port.close();
+
+	if (sinkLatency.count() > 0)
+		reportLatency(decodeLatency, sinkLatency, config.latencyTargetUs);
+	if (config.trace)
+		dumpTrace(config, "exit");
+
+	shutdownSinks(streamServer, archive, recording, eventCapture, synchronizer, config);
+	return 0;
 }
@@ -0,0 +1,218 @@
+// DeviceManager.cpp : connects the SensorTags through the CC2540 dongle and decodes their samples
+//
+
+#include "DeviceManager.h"
+#include "AllocationCounter.h"
+#include "Trace.h"
+
+// Connection parameters set by initialize(): 100 ms interval (units of 1.25 ms), no slave latency,
+// 20 s supervision timeout (units of 10 ms)
+static const uint16_t CONNECTION_INTERVAL = 0x50;
+static const uint16_t SLAVE_LATENCY = 0x00;
+static const uint16_t SUPERVISION_TIMEOUT = 0x07D0;
+
+uint8_t movementConfig(uint8_t sensorMask, bool wakeOnMotion) {
+	uint8_t config = 0;
+	if (sensorMask & IMU_GYRO) config |= 0x07;
+	if (sensorMask & IMU_ACC)  config |= 0x38;
+	if (sensorMask & IMU_MAG)  config |= 0x40;
+	if (wakeOnMotion)          config |= 0x80;
+	return config;
+}
+
+// GAP_DeviceInit, then all four GAP_SetParam commands in flight at once
+static Task<HciResult> initializeDongle(HciAdapter &adapter) {
+	HciResult result = co_await adapter.init();
+	if (!result.ok())
+		co_return result;
+	HciCommand minInterval = adapter.setParam(TGAP_CONN_EST_INT_MIN, CONNECTION_INTERVAL);
+	HciCommand maxInterval = adapter.setParam(TGAP_CONN_EST_INT_MAX, CONNECTION_INTERVAL);
+	HciCommand latency = adapter.setParam(TGAP_CONN_EST_LATENCY, SLAVE_LATENCY);
+	HciCommand timeout = adapter.setParam(TGAP_CONN_EST_SUPERV_TIMEOUT, SUPERVISION_TIMEOUT);
+	minInterval.start();
+	maxInterval.start();
+	latency.start();
+	timeout.start();
+	HciResult results[4];
+	results[0] = co_await minInterval;
+	results[1] = co_await maxInterval;
+	results[2] = co_await latency;
+	results[3] = co_await timeout;
+	for (int i = 0; i < 4; i++)
+		if (!results[i].ok())
+			co_return results[i];
+	co_return result;
+}
+
+// Notifications on (client charac. config: 01:00), then the period; ATT allows one write at a time per tag
+static Task<HciResult> enableTag(GattDevice tag, uint8_t period) {
+	HciResult result = co_await tag.writeChar(MOVEMENT_CCC_HANDLE, 0x01, 0x00);
+	if (result.ok())
+		result = co_await tag.writeChar(MOVEMENT_PERIOD_HANDLE, period);
+	co_return result;
+}
+
+// Sensor configuration and 3: 16G accelerometer range; 0 sensors switches the movement sensor off
+static Task<HciResult> configureTag(GattDevice tag, uint8_t sensors) {
+	co_return co_await tag.writeChar(MOVEMENT_CONFIG_HANDLE, sensors, 0x03);
+}
+
+static Task<HciResult> disconnectTag(HciAdapter &adapter, GattDevice tag) {
+	co_await tag.writeChar(MOVEMENT_CONFIG_HANDLE, 0x00, 0x03);
+	co_return co_await adapter.disconnect(tag.connHandle());
+}
+
+DeviceManager::DeviceManager(HciTransport &transport)
+	: m_transport(transport), m_pool(DEVICE_SLAB_SIZE, DEVICE_SLAB_COUNT), m_framer(m_pool),
+	  m_loop(transport, m_framer), m_adapter(m_loop), m_callback(0), m_callbackContext(0),
+	  m_log(0), m_logContext(0), m_abort(0), m_samples(0) {
+}
+
+DeviceManager::~DeviceManager() {
+	m_frame.slab.reset();			// before the pool goes
+}
+
+void DeviceManager::setBatchCallback(BatchCallback callback, void *context) {
+	m_callback = callback;
+	m_callbackContext = context;
+}
+
+void DeviceManager::setLogCallback(LogCallback callback, void *context) {
+	m_log = callback;
+	m_logContext = context;
+}
+
+void DeviceManager::setAbortFlag(const volatile sig_atomic_t *flag) {
+	m_abort = flag;
+	m_loop.setAbortFlag(flag);
+}
+
+void DeviceManager::log(const std::string &message) {
+	if (m_log)
+		m_log(message.c_str(), m_logContext);
+}
+
+int DeviceManager::tagIndex(uint16_t connHandle) const {
+	for (size_t t = 0; t < m_tags.size(); t++)
+		if (m_tags[t].connHandle() == connHandle)
+			return (int)t;
+	return -1;
+}
+
+// Runs one task per tag concurrently: the first failure, or success
+HciResult DeviceManager::runOnAllTags(std::vector<Task<HciResult> > &tasks) {
+	m_loop.runAll(tasks);
+	for (size_t t = 0; t < tasks.size(); t++)
+		if (!tasks[t].result().ok())
+			return tasks[t].result();
+	return HciResult{ HCI_SUCCESS };
+}
+
+HciResult DeviceManager::initialize() {
+	Task<HciResult> task = initializeDongle(m_adapter);
+	return m_loop.run(task);
+}
+
+// One scan for all SensorTags, then a link to each (the dongle establishes one link at a time)
+Task<HciResult> DeviceManager::connectTags(std::vector<std::string> macs) {
+	ScanResult scan = co_await m_adapter.discover(macs);
+	if (!scan.ok())
+		co_return HciResult{ scan.status };
+	for (size_t t = 0; t < macs.size(); t++) {
+		if (!scan.found(macs[t])) {
+			log("SensorTag " + macs[t] + " not found");
+			co_return HciResult{ HCI_STATUS_TIMEOUT };
+		}
+	}
+	for (size_t t = 0; t < macs.size(); t++) {
+		log("SensorTag " + macs[t] + " found! Establishing connection...");
+		LinkResult link = co_await m_adapter.connect(macs[t]);
+		if (!link.ok())
+			co_return HciResult{ link.status };
+		m_tags.push_back(GattDevice(m_loop, link.connHandle));
+		m_macs.push_back(macs[t]);
+		log("Connection established...");
+	}
+	co_return HciResult{ HCI_SUCCESS };
+}
+
+HciResult DeviceManager::connect(const std::vector<std::string> &macs) {
+	Task<HciResult> task = connectTags(macs);
+	return m_loop.run(task);
+}
+
+HciResult DeviceManager::enableMovement(uint8_t period) {
+	std::vector<Task<HciResult> > tasks;
+	for (size_t t = 0; t < m_tags.size(); t++)
+		tasks.push_back(enableTag(m_tags[t], period));
+	return runOnAllTags(tasks);
+}
+
+HciResult DeviceManager::startMovement(uint8_t config) {
+	std::vector<Task<HciResult> > tasks;
+	for (size_t t = 0; t < m_tags.size(); t++)
+		tasks.push_back(configureTag(m_tags[t], config));
+	return runOnAllTags(tasks);
+}
+
+void DeviceManager::disconnect() {
+	m_loop.setAbortFlag(0);			// also when stopping on a signal
+	std::vector<Task<HciResult> > tasks;
+	for (size_t t = 0; t < m_tags.size(); t++)
+		tasks.push_back(disconnectTag(m_adapter, m_tags[t]));
+	runOnAllTags(tasks);
+	m_tags.clear();
+	m_macs.clear();
+	m_loop.setAbortFlag(m_abort);
+}
+
+int DeviceManager::poll(SampleBatch &batch) {
+	// The transport reads into a pool slab, the framer hands out one slice per
+	// HCI event and the decoder fills the samples in place (no heap use)
+	AllocationGuard allocationGuard;
+	traceNextPass();
+	batch.samples = m_batch;
+	batch.count = 0;
+	batch.bytesRead = 0;
+	size_t space = m_framer.writeSpace();
+	if (space > 0) {
+		TraceScope readSpan("read");
+		batch.bytesRead = m_transport.read(m_framer.writePtr(), space);
+		if (batch.bytesRead > 0)
+			m_framer.commit((size_t)batch.bytesRead);
+		else
+			readSpan.cancel();			// idle: only reads that brought data are traced
+	}
+	// only a read that returned bytes can complete a notification
+	if (batch.bytesRead > 0)
+		batch.readTime = std::chrono::steady_clock::now();
+
+	TraceScope frameSpan("frame");
+	while (m_framer.next(m_frame)) {
+		if (batch.count == DEVICE_MAX_BATCH)
+			continue;
+		TraceScope decodeSpan("decode");
+		ImuSample &s = m_batch[batch.count];
+		int device = tagIndex(attConnectionHandle(m_frame.data(), m_frame.size()));
+		if (device >= 0 && decodeMovementNotification(m_frame.data(), m_frame.size(), s)) {
+			s.deviceId = (uint16_t)device;
+			s.timestamp = imuTimestampNow();
+			batch.count++;
+			decodeSpan.setDevice(s.deviceId);
+		}
+		else {
+			decodeSpan.cancel();
+		}
+	}
+	if (batch.bytesRead > 0)
+		frameSpan.end();
+	else
+		frameSpan.cancel();
+	m_frame.slab.reset();				// give the slab back before the next read
+	allocationGuard.check("acquisition path");
+	m_samples += batch.count;
+
+	if (m_callback && batch.count > 0)
+		m_callback(batch, m_callbackContext);
+	return batch.bytesRead < 0 ? -1 : (int)batch.count;
+}
@@ -0,0 +1,124 @@
+// DeviceManager.h : connects the SensorTags through the CC2540 dongle and decodes their samples
+//
+
+#ifndef DEVICEMANAGER_H
+#define DEVICEMANAGER_H
+
+#include "FramePool.h"
+#include "HciAsync.h"
+#include "HciFramer.h"
+#include "ImuSample.h"
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+The acquisition library's entry point for C++ (cc2650.h wraps it for C and
+other languages). The manager owns the frame pool, the framer and the event
+loop of one dongle; the transport stays the caller's.
+
+	SerialTransport port;
+	port.open(SERIAL_DEFAULT_PORT, error);
+	DeviceManager tags(port);
+	tags.initialize();							// GAP_DeviceInit, connection parameters
+	tags.connect(macs);							// one scan, then a link per tag: deviceId = index in macs
+	tags.enableMovement(10);					// notifications on, period 100 ms
+	tags.startMovement(movementConfig(IMU_ALL, false));
+	SampleBatch batch;
+	while (running)
+		if (tags.poll(batch) > 0) ... batch.samples[0 .. batch.count) ...
+	tags.disconnect();
+
+Setup calls run the event loop until they are done and return the first
+failure (see HciAsync.h for the statuses). poll() reads once from the transport
+into a pool slab, frames the events and decodes the movement notifications in
+place, without allocating: the batch points into the manager and is valid
+until the next poll(). With a batch callback set, every non-empty batch is
+also handed to it, still inside poll().
+*/
+
+// Buffers of the acquisition path: one read of up to a slab holds at most DEVICE_MAX_BATCH notifications
+const size_t DEVICE_SLAB_SIZE = 512;
+const size_t DEVICE_SLAB_COUNT = 8;
+const size_t DEVICE_MAX_BATCH = DEVICE_SLAB_SIZE / 29 + 1;		// a movement notification is 29 bytes
+
+// Samples decoded from one read
+struct SampleBatch {
+	const ImuSample *samples;
+	size_t count;
+	int bytesRead;									// what the read returned: 0 idle, -1 transport error
+	std::chrono::steady_clock::time_point readTime;	// when that read returned (only set when bytesRead > 0)
+};
+
+// Movement sensor configuration (low byte): bits 0-2 gyro, 3-5 accelerometer, 6 magnetometer,
+// 7 wake-on-motion (the tag only sends while it is moved)
+uint8_t movementConfig(uint8_t sensorMask, bool wakeOnMotion);
+
+class DeviceManager {
+public:
+	typedef void (*BatchCallback)(const SampleBatch &batch, void *context);
+	// Setup progress ("SensorTag ... found! Establishing connection...")
+	typedef void (*LogCallback)(const char *message, void *context);
+
+	explicit DeviceManager(HciTransport &transport);
+	~DeviceManager();
+
+	void setBatchCallback(BatchCallback callback, void *context);
+	void setLogCallback(LogCallback callback, void *context);
+	// While *flag is set the setup calls fail with HCI_STATUS_ABORTED; disconnect() ignores it
+	void setAbortFlag(const volatile sig_atomic_t *flag);
+
+	// GAP_DeviceInit as central, then connection interval, slave latency and supervision timeout
+	HciResult initialize();
+	// Finds every address (12 hex digits) in one scan, then links to each; deviceIds follow the order of macs
+	HciResult connect(const std::vector<std::string> &macs);
+	// Notifications on and the period (units of 10 ms) on every tag
+	HciResult enableMovement(uint8_t period);
+	// Writes the configuration (see movementConfig()) to every tag: the samples start
+	HciResult startMovement(uint8_t config);
+	// Movement sensor off and links terminated, on all tags at once
+	void disconnect();
+
+	// Samples decoded by one read, see above; returns their count or -1 when the transport failed
+	int poll(SampleBatch &batch);
+
+	size_t deviceCount() const { return m_tags.size(); }
+	const std::string &mac(size_t deviceId) const { return m_macs[deviceId]; }
+	GattDevice &tag(size_t deviceId) { return m_tags[deviceId]; }
+	HciEventLoop &eventLoop() { return m_loop; }
+	HciAdapter &adapter() { return m_adapter; }
+	const FramePool &framePool() const { return m_pool; }
+
+	uint64_t samplesDecoded() const { return m_samples; }
+	uint64_t skippedBytes() const { return m_framer.skippedBytes(); }
+
+private:
+	DeviceManager(const DeviceManager &);
+	DeviceManager &operator=(const DeviceManager &);
+
+	void log(const std::string &message);
+	int tagIndex(uint16_t connHandle) const;
+	HciResult runOnAllTags(std::vector<Task<HciResult> > &tasks);
+	Task<HciResult> connectTags(std::vector<std::string> macs);
+
+	HciTransport &m_transport;
+	FramePool m_pool;
+	HciFramer m_framer;
+	HciEventLoop m_loop;
+	HciAdapter m_adapter;
+	std::vector<GattDevice> m_tags;			// connected SensorTags, the index is the deviceId of their samples
+	std::vector<std::string> m_macs;
+	ImuSample m_batch[DEVICE_MAX_BATCH];
+	FrameSlice m_frame;
+	BatchCallback m_callback;
+	void *m_callbackContext;
+	LogCallback m_log;
+	void *m_logContext;
+	const volatile sig_atomic_t *m_abort;
+	uint64_t m_samples;
+};
+
+#endif // DEVICEMANAGER_H
@@ -0,0 +1,97 @@
+// EventCapture.cpp : motion triggered capture with a pre-trigger ring buffer
+//
+
+#include "EventCapture.h"
+
+// Same scale factors as sensorMpu9250AccConvert() / sensorMpu9250GyroConvert()
+static const double ACC_COUNTS_PER_G = 2048.0;
+static const double GYRO_COUNTS_PER_DPS = 131.072;
+
+EventCapture::EventCapture(const EventCaptureConfig &config, SampleCallback callback, void *context)
+	: m_config(config), m_callback(callback), m_context(context), m_events(0), m_samplesIn(0), m_samplesOut(0) {
+}
+
+EventCapture::DeviceState &EventCapture::device(uint16_t deviceId) {
+	if (deviceId >= m_devices.size()) {
+		size_t first = m_devices.size();
+		m_devices.resize(deviceId + 1);
+		for (size_t i = first; i < m_devices.size(); i++) {
+			m_devices[i].ring.resize(m_config.preSamples);
+			m_devices[i].head = 0;
+			m_devices[i].count = 0;
+			m_devices[i].postRemaining = 0;
+		}
+	}
+	return m_devices[deviceId];
+}
+
+bool EventCapture::isMotion(const ImuSample &sample) const {
+	// compare squares, no sqrt per sample
+	if (m_config.sensorMask & IMU_ACC) {
+		double ax = sample.axis[AXIS_AX], ay = sample.axis[AXIS_AY], az = sample.axis[AXIS_AZ];
+		double acc = (ax * ax + ay * ay + az * az) / (ACC_COUNTS_PER_G * ACC_COUNTS_PER_G);
+		double low = 1.0 - m_config.accThreshold, high = 1.0 + m_config.accThreshold;
+		if (acc > high * high || (low > 0 && acc < low * low))
+			return true;
+	}
+	if (!(m_config.sensorMask & IMU_GYRO))
+		return false;
+
+	double gx = sample.axis[AXIS_GX], gy = sample.axis[AXIS_GY], gz = sample.axis[AXIS_GZ];
+	double gyro = (gx * gx + gy * gy + gz * gz) / (GYRO_COUNTS_PER_DPS * GYRO_COUNTS_PER_DPS);
+	return gyro > m_config.gyroThreshold * m_config.gyroThreshold;
+}
+
+void EventCapture::emit(const ImuSample &sample) {
+	m_samplesOut++;
+	m_callback(sample, m_context);
+}
+
+void EventCapture::flushRing(DeviceState &state) {
+	size_t capacity = state.ring.size();
+	size_t oldest = (state.head + capacity - state.count) % (capacity ? capacity : 1);
+	for (size_t i = 0; i < state.count; i++)
+		emit(state.ring[(oldest + i) % capacity]);
+	state.count = 0;
+	state.head = 0;
+}
+
+void EventCapture::trigger(uint16_t deviceId) {
+	DeviceState &state = device(deviceId);
+	if (state.postRemaining == 0) {
+		m_events++;
+		flushRing(state);
+	}
+	state.postRemaining = m_config.postSamples + 1;		// + 1: the next sample is the trigger
+}
+
+bool EventCapture::push(const ImuSample &sample) {
+	m_samplesIn++;
+	DeviceState &state = device(sample.deviceId);
+
+	if (isMotion(sample)) {
+		bool started = state.postRemaining == 0;
+		if (started) {
+			m_events++;
+			flushRing(state);
+		}
+		state.postRemaining = m_config.postSamples;
+		emit(sample);
+		return started;
+	}
+
+	if (state.postRemaining > 0) {
+		state.postRemaining--;
+		emit(sample);
+		return false;
+	}
+
+	// idle: only remember it for the lead-up of the next event
+	if (!state.ring.empty()) {
+		state.ring[state.head] = sample;
+		state.head = (state.head + 1) % state.ring.size();
+		if (state.count < state.ring.size())
+			state.count++;
+	}
+	return false;
+}
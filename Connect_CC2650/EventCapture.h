@@ -0,0 +1,79 @@
+// EventCapture.h : motion triggered capture with a pre-trigger ring buffer
+//
+
+#ifndef EVENTCAPTURE_H
+#define EVENTCAPTURE_H
+
+#include "ImuSample.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Keeps the last preSamples samples of every device in a fixed-size ring and
+passes nothing on while the device is idle. A sample is "motion" when the
+acceleration magnitude differs from 1 G by more than accThreshold or the
+rotation rate exceeds gyroThreshold. On motion the ring is flushed to the
+callback (the lead-up to the event), followed by the triggering sample and
+postSamples more; every motion sample inside the post-trigger window extends it.
+Only the sensor groups in sensorMask are tested: the axes of a disabled sensor
+are 0, which would read as free fall. With neither the accelerometer nor the
+gyroscope enabled, only trigger() starts an event.
+
+With wake-on-motion enabled on the tag (bit 7 of the movement configuration)
+the tag itself stops sending while it is still, which saves the radio traffic
+as well; the host threshold then decides what is kept of what does arrive.
+
+The rings are allocated when a device is first seen, push() does not allocate.
+*/
+
+struct EventCaptureConfig {
+	double accThreshold;		// G, deviation of |acc| from 1 G
+	double gyroThreshold;		// deg/s, |rotation rate|
+	size_t preSamples;
+	size_t postSamples;
+	uint8_t sensorMask;			// IMU_GYRO | IMU_ACC | IMU_MAG, the sensors the tags send
+
+	EventCaptureConfig()
+		: accThreshold(0.1), gyroThreshold(20.0), preSamples(50), postSamples(50), sensorMask(IMU_ALL) {}
+};
+
+class EventCapture {
+public:
+	typedef void (*SampleCallback)(const ImuSample &sample, void *context);
+
+	EventCapture(const EventCaptureConfig &config, SampleCallback callback, void *context);
+
+	// Returns true when the sample started a new event
+	bool push(const ImuSample &sample);
+
+	// Starts (or extends) an event without a motion sample, e.g. on an external trigger
+	void trigger(uint16_t deviceId);
+
+	bool isMotion(const ImuSample &sample) const;
+	uint64_t events() const { return m_events; }
+	uint64_t samplesIn() const { return m_samplesIn; }
+	uint64_t samplesOut() const { return m_samplesOut; }
+
+private:
+	struct DeviceState {
+		std::vector<ImuSample> ring;
+		size_t head;				// next slot to write
+		size_t count;
+		size_t postRemaining;		// > 0 while an event is being written
+	};
+
+	DeviceState &device(uint16_t deviceId);
+	void flushRing(DeviceState &state);
+	void emit(const ImuSample &sample);
+
+	EventCaptureConfig m_config;
+	SampleCallback m_callback;
+	void *m_context;
+	std::vector<DeviceState> m_devices;		// by deviceId
+	uint64_t m_events;
+	uint64_t m_samplesIn;
+	uint64_t m_samplesOut;
+};
+
+#endif // EVENTCAPTURE_H
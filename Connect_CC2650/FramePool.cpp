@@ -0,0 +1,86 @@
+// FramePool.cpp : preallocated, reference-counted buffers for the acquisition path
+//
+
+#include "FramePool.h"
+#include <cstring>
+
+static const uint32_t NO_SLAB = 0xFFFFFFFFu;
+
+FrameRef::FrameRef(const FrameRef &other) : m_pool(other.m_pool), m_index(other.m_index) {
+	if (m_pool)
+		m_pool->m_state[m_index].refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameRef &FrameRef::operator=(const FrameRef &other) {
+	if (this != &other) {
+		if (other.m_pool)
+			other.m_pool->m_state[other.m_index].refs.fetch_add(1, std::memory_order_relaxed);
+		reset();
+		m_pool = other.m_pool;
+		m_index = other.m_index;
+	}
+	return *this;
+}
+
+void FrameRef::reset() {
+	if (m_pool && m_pool->m_state[m_index].refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		m_pool->release(m_index);
+	m_pool = 0;
+}
+
+bool FrameRef::unique() const {
+	return m_pool && m_pool->m_state[m_index].refs.load(std::memory_order_acquire) == 1;
+}
+
+uint8_t *FrameRef::data() const {
+	return m_pool ? m_pool->m_memory + (size_t)m_index * m_pool->m_slabSize : 0;
+}
+
+size_t FrameRef::capacity() const {
+	return m_pool ? m_pool->m_slabSize : 0;
+}
+
+FramePool::FramePool(size_t slabSize, size_t slabCount)
+	: m_slabSize(slabSize), m_slabCount(slabCount), m_head(NO_SLAB), m_available(slabCount) {
+	m_memory = new uint8_t[slabSize * slabCount];
+	m_state = new SlabState[slabCount];
+	// touch everything now, so that no page fault happens during acquisition
+	memset(m_memory, 0, slabSize * slabCount);
+	for (size_t i = 0; i < slabCount; i++) {
+		m_state[i].refs.store(0, std::memory_order_relaxed);
+		m_state[i].next.store(i + 1 < slabCount ? (uint32_t)(i + 1) : NO_SLAB, std::memory_order_relaxed);
+	}
+	m_head.store(slabCount ? 0 : NO_SLAB, std::memory_order_release);
+}
+
+FramePool::~FramePool() {
+	delete[] m_state;
+	delete[] m_memory;
+}
+
+FrameRef FramePool::acquire() {
+	uint64_t head = m_head.load(std::memory_order_acquire);
+	for (;;) {
+		uint32_t index = (uint32_t)head;
+		if (index == NO_SLAB)
+			return FrameRef();
+		uint64_t next = ((head >> 32) + 1) << 32 | m_state[index].next.load(std::memory_order_relaxed);
+		if (m_head.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+			break;
+	}
+	uint32_t index = (uint32_t)head;
+	m_state[index].refs.store(1, std::memory_order_relaxed);
+	m_available.fetch_sub(1, std::memory_order_relaxed);
+	return FrameRef(this, index);
+}
+
+void FramePool::release(uint32_t index) {
+	uint64_t head = m_head.load(std::memory_order_relaxed);
+	for (;;) {
+		m_state[index].next.store((uint32_t)head, std::memory_order_relaxed);
+		uint64_t next = ((head >> 32) + 1) << 32 | index;
+		if (m_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed))
+			break;
+	}
+	m_available.fetch_add(1, std::memory_order_relaxed);
+}
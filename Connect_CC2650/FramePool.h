@@ -0,0 +1,90 @@
+// FramePool.h : preallocated, reference-counted buffers for the acquisition path
+//
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+All serial data goes through fixed-size slabs that are allocated once, when the
+pool is created. The transport reads into a slab, the framer hands out slices of
+it and the decoder reads the slices; a slab goes back to the pool when the last
+FrameRef/FrameSlice pointing at it is destroyed.
+
+Acquiring and releasing never allocate and never lock: the free list is a
+Treiber stack whose head carries a generation tag against ABA. Slices can
+therefore be released from any thread.
+*/
+
+class FramePool;
+
+// Shared handle on one slab
+class FrameRef {
+public:
+	FrameRef() : m_pool(0), m_index(0) {}
+	FrameRef(const FrameRef &other);
+	FrameRef &operator=(const FrameRef &other);
+	~FrameRef() { reset(); }
+
+	void reset();
+	bool valid() const { return m_pool != 0; }
+	bool unique() const;				// no other handle on this slab
+	uint8_t *data() const;
+	size_t capacity() const;
+
+private:
+	friend class FramePool;
+	FrameRef(FramePool *pool, uint32_t index) : m_pool(pool), m_index(index) {}
+
+	FramePool *m_pool;
+	uint32_t m_index;
+};
+
+// Part of a slab holding one frame
+struct FrameSlice {
+	FrameRef slab;
+	uint32_t offset;
+	uint32_t length;
+
+	FrameSlice() : offset(0), length(0) {}
+	const uint8_t *data() const { return slab.data() + offset; }
+	size_t size() const { return length; }
+};
+
+class FramePool {
+public:
+	FramePool(size_t slabSize, size_t slabCount);
+	~FramePool();
+
+	FrameRef acquire();					// invalid FrameRef when every slab is in use
+	size_t slabSize() const { return m_slabSize; }
+	size_t slabCount() const { return m_slabCount; }
+	size_t available() const { return m_available.load(std::memory_order_relaxed); }
+	const uint8_t *memory() const { return m_memory; }		// all slabs, e.g. for lockMemory()
+	size_t memorySize() const { return m_slabSize * m_slabCount; }
+
+private:
+	friend class FrameRef;
+
+	FramePool(const FramePool &);
+	FramePool &operator=(const FramePool &);
+
+	void release(uint32_t index);
+
+	struct SlabState {
+		std::atomic<uint32_t> refs;
+		std::atomic<uint32_t> next;		// free list link
+	};
+
+	size_t m_slabSize;
+	size_t m_slabCount;
+	uint8_t *m_memory;
+	SlabState *m_state;
+	std::atomic<uint64_t> m_head;		// generation << 32 | slab index
+	std::atomic<size_t> m_available;
+};
+
+#endif // FRAMEPOOL_H
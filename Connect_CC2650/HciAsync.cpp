@@ -0,0 +1,454 @@
+// HciAsync.cpp : asynchronous GAP/GATT operations on the CC2540 dongle (C++20 coroutines)
+//
+
+#include "HciAsync.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+static uint16_t u16At(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// "a0e6f8aed204" <-> address bytes, least significant first
+static void macToAddress(const std::string &mac, uint8_t address[6]) {
+	for (int i = 0; i < 6; i++)
+		address[5 - i] = (uint8_t)strtoul(mac.substr(i * 2, 2).c_str(), 0, 16);
+}
+
+bool normaliseMac(const std::string &value, std::string &mac) {
+	mac.clear();
+	for (size_t i = 0; i < value.size(); i++) {
+		char c = value[i];
+		if (c == ':' || c == '-')
+			continue;
+		if (!isxdigit((unsigned char)c))
+			return false;
+		mac += (char)tolower((unsigned char)c);
+	}
+	return mac.size() == 12;
+}
+
+static std::string addressToMac(const uint8_t *address) {
+	static const char digits[] = "0123456789abcdef";
+	std::string mac;
+	for (int i = 5; i >= 0; i--) {
+		mac += digits[address[i] >> 4];
+		mac += digits[address[i] & 0x0F];
+	}
+	return mac;
+}
+
+bool ScanResult::found(const std::string &mac) const {
+	for (size_t i = 0; i < devices.size(); i++)
+		if (devices[i].mac == mac)
+			return true;
+	return false;
+}
+
+// HciRequest
+
+HciRequest::HciRequest(HciEventLoop &loop, long slot, int timeoutMs)
+	: m_loop(loop), m_opcode(0), m_slot(slot), m_timeoutMs(timeoutMs > 0 ? timeoutMs : loop.timeout()),
+	  m_started(false), m_sent(false), m_statusSeen(false), m_done(false), m_status(HCI_SUCCESS) {
+}
+
+HciRequest::~HciRequest() {
+	if (m_started && !m_done)
+		m_loop.cancel(this);
+}
+
+void HciRequest::start() {
+	if (m_started)
+		return;
+	m_started = true;
+	m_loop.submit(this);
+}
+
+void HciRequest::setCommand(uint16_t opcode, const uint8_t *params, size_t length) {
+	m_opcode = opcode;
+	m_command.resize(4 + length);
+	m_command[0] = HCI_COMMAND_PACKET;
+	m_command[1] = (uint8_t)opcode;
+	m_command[2] = (uint8_t)(opcode >> 8);
+	m_command[3] = (uint8_t)length;
+	std::copy(params, params + length, m_command.begin() + 4);
+}
+
+HciCommand::HciCommand(HciEventLoop &loop, uint16_t opcode, const uint8_t *params, size_t length)
+	: HciRequest(loop, NO_SLOT, 0) {
+	setCommand(opcode, params, length);
+}
+
+HciEventRequest::HciEventRequest(HciEventLoop &loop, uint16_t opcode, const uint8_t *params, size_t length,
+								 uint16_t event, long slot, long connHandle)
+	: HciRequest(loop, slot, 0), m_event(event), m_connHandle(connHandle) {
+	setCommand(opcode, params, length);
+}
+
+HciRequest::Match HciEventRequest::onEvent(uint16_t event, const uint8_t *frame, size_t length) {
+	if (event != m_event)
+		return IGNORED;
+	if (m_connHandle >= 0 && (length < 8 || u16At(frame + 6) != m_connHandle))
+		return IGNORED;
+	m_status = frame[5];
+	return COMPLETED;
+}
+
+GattWrite::GattWrite(HciEventLoop &loop, uint16_t connHandle, uint16_t handle, const uint8_t *value, size_t length)
+	: HciRequest(loop, connHandle, 0), m_connHandle(connHandle), m_handle(handle) {
+	std::vector<uint8_t> params(4 + length);
+	params[0] = (uint8_t)connHandle;
+	params[1] = (uint8_t)(connHandle >> 8);
+	params[2] = (uint8_t)handle;
+	params[3] = (uint8_t)(handle >> 8);
+	std::copy(value, value + length, params.begin() + 4);
+	setCommand(GATT_WRITE_CHAR_VALUE, params.data(), params.size());
+}
+
+HciRequest::Match GattWrite::onEvent(uint16_t event, const uint8_t *frame, size_t length) {
+	if (length < 8 || u16At(frame + 6) != m_connHandle)
+		return IGNORED;
+	if (event == ATT_WRITE_RSP) {
+		m_status = frame[5] == HCI_PROCEDURE_COMPLETE ? HCI_SUCCESS : frame[5];
+		return COMPLETED;
+	}
+	// 1B: status connHandle(2) pduLen reqOpcode handle(2) errorCode
+	if (event == ATT_ERROR_RSP && length >= 13 && u16At(frame + 10) == m_handle) {
+		m_status = frame[12];
+		return COMPLETED;
+	}
+	return IGNORED;
+}
+
+GattRead::GattRead(HciEventLoop &loop, uint16_t connHandle, uint16_t handle)
+	: HciRequest(loop, connHandle, 0), m_connHandle(connHandle), m_handle(handle) {
+	uint8_t params[] = { (uint8_t)connHandle, (uint8_t)(connHandle >> 8), (uint8_t)handle, (uint8_t)(handle >> 8) };
+	setCommand(GATT_READ_CHAR_VALUE, params, sizeof(params));
+}
+
+HciRequest::Match GattRead::onEvent(uint16_t event, const uint8_t *frame, size_t length) {
+	if (length < 9 || u16At(frame + 6) != m_connHandle)
+		return IGNORED;
+	if (event == ATT_READ_RSP) {
+		size_t valueLength = std::min((size_t)frame[8], length - 9);
+		m_value.assign(frame + 9, frame + 9 + valueLength);
+		m_status = frame[5] == HCI_PROCEDURE_COMPLETE ? HCI_SUCCESS : frame[5];
+		return COMPLETED;
+	}
+	if (event == ATT_ERROR_RSP && length >= 13 && u16At(frame + 10) == m_handle) {
+		m_status = frame[12];
+		return COMPLETED;
+	}
+	return IGNORED;
+}
+
+GapDiscovery::GapDiscovery(HciEventLoop &loop, const std::vector<std::string> &macs, int timeoutMs)
+	: HciRequest(loop, GAP_SLOT, timeoutMs), m_macs(macs), m_cancelSent(false) {
+	const uint8_t params[] = { 0x02, 0x01, 0x00 };		// limited discovery, active scan, no white list
+	setCommand(GAP_DEVICE_DISCOVERY_REQUEST, params, sizeof(params));
+}
+
+void GapDiscovery::found(const uint8_t *address, int8_t rssi) {
+	std::string mac = addressToMac(address);
+	for (size_t i = 0; i < m_devices.size(); i++)
+		if (m_devices[i].mac == mac)
+			return;
+	if (!m_macs.empty() && std::find(m_macs.begin(), m_macs.end(), mac) == m_macs.end())
+		return;
+	DiscoveredDevice device = { mac, rssi };
+	m_devices.push_back(device);
+}
+
+HciRequest::Match GapDiscovery::onEvent(uint16_t event, const uint8_t *frame, size_t length) {
+	if (event == GAP_DEVICE_INFORMATION && length >= 15) {
+		// status eventType addrType addr(6) rssi dataLen data
+		found(frame + 8, (int8_t)frame[14]);
+		// everything we look for is there: no need to wait for the end of the scan
+		if (!m_macs.empty() && m_devices.size() == m_macs.size() && !m_cancelSent) {
+			m_loop.sendCommand(GAP_DEVICE_DISCOVERY_CANCEL, 0, 0);
+			m_cancelSent = true;
+		}
+		return CONSUMED;
+	}
+	if (event == GAP_DEVICE_DISCOVERY_DONE) {
+		// status numDevs, then eventType addrType addr(6) per device
+		if (length >= 7 && frame[5] == HCI_SUCCESS)
+			for (size_t i = 0, offset = 7; i < frame[6] && offset + 8 <= length; i++, offset += 8)
+				found(frame + offset + 2, 0);
+		m_status = frame[5] == HCI_DISCOVERY_CANCELED ? HCI_SUCCESS : frame[5];
+		return COMPLETED;
+	}
+	return IGNORED;
+}
+
+void GapDiscovery::onTimeout() {
+	m_loop.sendCommand(GAP_DEVICE_DISCOVERY_CANCEL, 0, 0);
+}
+
+GapLink::GapLink(HciEventLoop &loop, const std::string &mac, int timeoutMs)
+	: HciRequest(loop, GAP_SLOT, timeoutMs), m_connHandle(0xFFFF) {
+	macToAddress(mac, m_address);
+	uint8_t params[9] = { 0x00, 0x00, 0x00 };			// low duty cycle, no white list, public address
+	std::copy(m_address, m_address + 6, params + 3);
+	setCommand(GAP_ESTABLISH_LINK_REQUEST, params, sizeof(params));
+}
+
+HciRequest::Match GapLink::onEvent(uint16_t event, const uint8_t *frame, size_t length) {
+	// status addrType addr(6) connHandle(2) ...
+	if (event != GAP_LINK_ESTABLISHED || length < 15)
+		return IGNORED;
+	if (frame[5] == HCI_SUCCESS && !std::equal(m_address, m_address + 6, frame + 7))
+		return IGNORED;
+	m_status = frame[5];
+	m_connHandle = u16At(frame + 13);
+	return COMPLETED;
+}
+
+void GapLink::onTimeout() {
+	const uint8_t params[] = { (uint8_t)GAP_CONNHANDLE_INIT, (uint8_t)(GAP_CONNHANDLE_INIT >> 8), 0x13 };
+	m_loop.sendCommand(GAP_TERMINATE_LINK_REQUEST, params, sizeof(params));
+}
+
+// HciEventLoop
+
+HciEventLoop::HciEventLoop(HciTransport &transport, HciFramer &framer)
+	: m_transport(transport), m_framer(framer), m_notify(0), m_notifyContext(0), m_abort(0),
+	  m_maxOutstanding(4), m_timeoutMs(2000), m_commandsSent(0), m_gapCancelEvent(0) {
+}
+
+HciEventLoop::~HciEventLoop() {
+	// requests outliving the loop must not call back into it
+	for (size_t i = 0; i < m_inflight.size(); i++)
+		m_inflight[i]->m_done = true;
+	for (size_t i = 0; i < m_queue.size(); i++)
+		m_queue[i]->m_done = true;
+}
+
+void HciEventLoop::setNotificationHandler(NotificationHandler handler, void *context) {
+	m_notify = handler;
+	m_notifyContext = context;
+}
+
+void HciEventLoop::submit(HciRequest *request) {
+	m_queue.push_back(request);
+	sendQueued();
+}
+
+void HciEventLoop::cancel(HciRequest *request) {
+	std::deque<HciRequest *>::iterator q = std::find(m_queue.begin(), m_queue.end(), request);
+	if (q != m_queue.end())
+		m_queue.erase(q);
+	std::vector<HciRequest *>::iterator f = std::find(m_inflight.begin(), m_inflight.end(), request);
+	if (f != m_inflight.end())
+		m_inflight.erase(f);
+}
+
+bool HciEventLoop::slotBusy(long slot) const {
+	if (slot == HciRequest::NO_SLOT)
+		return false;
+	if (slot == HciRequest::GAP_SLOT && m_gapCancelEvent)
+		return true;
+	for (size_t i = 0; i < m_inflight.size(); i++)
+		if (m_inflight[i]->m_slot == slot)
+			return true;
+	return false;
+}
+
+void HciEventLoop::sendQueued() {
+	size_t awaitingStatus = 0;
+	for (size_t i = 0; i < m_inflight.size(); i++)
+		if (!m_inflight[i]->m_statusSeen)
+			awaitingStatus++;
+
+	for (size_t i = 0; i < m_queue.size() && awaitingStatus < m_maxOutstanding; ) {
+		HciRequest *request = m_queue[i];
+		if (slotBusy(request->m_slot)) {
+			i++;					// a later request for another connection may go first
+			continue;
+		}
+		m_queue.erase(m_queue.begin() + i);
+		request->m_sent = true;
+		request->m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(request->m_timeoutMs);
+		m_inflight.push_back(request);
+		if (!m_transport.write(request->m_command.data(), request->m_command.size())) {
+			complete(request, HCI_STATUS_SEND_FAILED);
+			continue;
+		}
+		m_commandsSent++;
+		awaitingStatus++;
+	}
+}
+
+bool HciEventLoop::sendCommand(uint16_t opcode, const uint8_t *params, size_t length) {
+	std::vector<uint8_t> command(4 + length);
+	command[0] = HCI_COMMAND_PACKET;
+	command[1] = (uint8_t)opcode;
+	command[2] = (uint8_t)(opcode >> 8);
+	command[3] = (uint8_t)length;
+	if (length)
+		std::copy(params, params + length, command.begin() + 4);
+	if (!m_transport.write(command.data(), command.size()))
+		return false;
+	m_commandsSent++;
+	return true;
+}
+
+void HciEventLoop::complete(HciRequest *request, uint8_t status) {
+	cancel(request);
+	request->m_status = status;
+	request->m_done = true;
+	if (request->m_waiter) {
+		m_ready.push_back(request->m_waiter);
+		request->m_waiter = std::coroutine_handle<>();
+	}
+}
+
+void HciEventLoop::dispatch(const uint8_t *frame, size_t length) {
+	uint16_t event = hciVendorEvent(frame, length);
+	if (event == 0 || length < 6)
+		return;
+
+	if (event == ATT_HANDLE_VALUE_NOTIFICATION) {
+		if (m_notify)
+			m_notify(frame, length, m_notifyContext);
+		return;
+	}
+
+	if (m_gapCancelEvent && event == m_gapCancelEvent) {
+		// the end of a cancelled GAP procedure: it belongs to no request, the slot is free again
+		m_gapCancelEvent = 0;
+		if (event == GAP_LINK_ESTABLISHED && length >= 15 && frame[5] == HCI_SUCCESS) {
+			// the link came up before the cancellation reached the dongle: nobody waits for it
+			const uint8_t params[] = { frame[13], frame[14], 0x13 };
+			sendCommand(GAP_TERMINATE_LINK_REQUEST, params, sizeof(params));
+		}
+		return;
+	}
+
+	if (event == GAP_HCI_COMMAND_STATUS) {
+		// status opcode(2) dataLength ...; the oldest request with that opcode
+		if (length < 8)
+			return;
+		uint16_t opcode = u16At(frame + 6);
+		for (size_t i = 0; i < m_inflight.size(); i++) {
+			HciRequest *request = m_inflight[i];
+			if (request->m_opcode != opcode || request->m_statusSeen)
+				continue;
+			request->m_statusSeen = true;
+			if (frame[5] != HCI_SUCCESS)
+				complete(request, frame[5]);
+			else if (request->completesOnStatus())
+				complete(request, HCI_SUCCESS);
+			break;
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < m_inflight.size(); i++) {
+		HciRequest *request = m_inflight[i];
+		HciRequest::Match match = request->onEvent(event, frame, length);
+		if (match == HciRequest::COMPLETED)
+			complete(request, request->m_status);
+		if (match != HciRequest::IGNORED)
+			break;
+	}
+}
+
+void HciEventLoop::expire() {
+	bool abort = m_abort && *m_abort;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (m_gapCancelEvent && now >= m_gapCancelDeadline)
+		m_gapCancelEvent = 0;			// the dongle never reported it, don't block GAP for good
+	for (size_t i = 0; i < m_inflight.size(); ) {
+		HciRequest *request = m_inflight[i];
+		if (abort || now >= request->m_deadline) {
+			request->onTimeout();
+			if (request->m_slot == HciRequest::GAP_SLOT && request->cancelledEvent()) {
+				m_gapCancelEvent = request->cancelledEvent();
+				m_gapCancelDeadline = now + std::chrono::milliseconds(m_timeoutMs);
+			}
+			complete(request, abort ? HCI_STATUS_ABORTED : HCI_STATUS_TIMEOUT);
+		}
+		else {
+			i++;
+		}
+	}
+	while (abort && !m_queue.empty())
+		complete(m_queue.front(), HCI_STATUS_ABORTED);
+}
+
+void HciEventLoop::resumeReady() {
+	while (!m_ready.empty()) {
+		std::vector<std::coroutine_handle<> > ready;
+		ready.swap(m_ready);
+		for (size_t i = 0; i < ready.size(); i++)
+			ready[i].resume();
+	}
+}
+
+void HciEventLoop::pump() {
+	sendQueued();
+
+	size_t space = m_framer.writeSpace();
+	if (space > 0) {
+		int bytesRead = m_transport.read(m_framer.writePtr(), space);
+		if (bytesRead > 0)
+			m_framer.commit(bytesRead);
+	}
+	FrameSlice frame;
+	while (m_framer.next(frame))
+		dispatch(frame.data(), frame.size());
+	frame.slab.reset();
+
+	expire();
+	resumeReady();
+	sendQueued();
+}
+
+// HciAdapter
+
+HciEventRequest HciAdapter::init() {
+	// central role, 5 scan responses, no IRK/CSRK, sign counter 1
+	uint8_t params[38] = { 0x08, 0x05 };
+	params[34] = 0x01;
+	return HciEventRequest(m_loop, GAP_DEVICE_INIT, params, sizeof(params), GAP_DEVICE_INIT_DONE, HciRequest::GAP_SLOT, -1);
+}
+
+HciCommand HciAdapter::setParam(uint8_t id, uint16_t value) {
+	const uint8_t params[] = { id, (uint8_t)value, (uint8_t)(value >> 8) };
+	return HciCommand(m_loop, GAP_SET_PARAM, params, sizeof(params));
+}
+
+GapDiscovery HciAdapter::discover(const std::vector<std::string> &macs, int timeoutMs) {
+	return GapDiscovery(m_loop, macs, timeoutMs);
+}
+
+GapLink HciAdapter::connect(const std::string &mac, int timeoutMs) {
+	return GapLink(m_loop, mac, timeoutMs);
+}
+
+HciEventRequest HciAdapter::disconnect(uint16_t connHandle) {
+	const uint8_t params[] = { (uint8_t)connHandle, (uint8_t)(connHandle >> 8), 0x13 };		// remote user terminated
+	return HciEventRequest(m_loop, GAP_TERMINATE_LINK_REQUEST, params, sizeof(params), GAP_LINK_TERMINATED,
+						   HciRequest::NO_SLOT, connHandle);
+}
+
+// GattDevice
+
+GattWrite GattDevice::writeChar(uint16_t handle, uint8_t value) {
+	return GattWrite(*m_loop, m_connHandle, handle, &value, 1);
+}
+
+GattWrite GattDevice::writeChar(uint16_t handle, uint8_t value0, uint8_t value1) {
+	const uint8_t value[] = { value0, value1 };
+	return GattWrite(*m_loop, m_connHandle, handle, value, sizeof(value));
+}
+
+GattWrite GattDevice::writeChar(uint16_t handle, const std::vector<uint8_t> &value) {
+	return GattWrite(*m_loop, m_connHandle, handle, value.data(), value.size());
+}
+
+GattRead GattDevice::readChar(uint16_t handle) {
+	return GattRead(*m_loop, m_connHandle, handle);
+}
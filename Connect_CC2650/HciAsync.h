@@ -0,0 +1,359 @@
+// HciAsync.h : asynchronous GAP/GATT operations on the CC2540 dongle (C++20 coroutines)
+//
+
+#ifndef HCIASYNC_H
+#define HCIASYNC_H
+
+#include "HciFramer.h"
+#include "Task.h"
+#include <chrono>
+#include <csignal>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+Commands are sent as HCI command packets (0x01, opcode, length, parameters).
+The dongle acknowledges every command with GAP_HCI_ExtentionCommandStatus,
+which carries the opcode; the operation then completes with its own event
+(ATT_WriteRsp, GAP_LinkEstablished, ...), which carries the connection handle
+and for some events the attribute handle. The event loop matches both against
+the requests in flight, in the order they were sent.
+
+Requests are awaitables: co_await sends the request and suspends until it
+completes, start() sends it right away so that several are in flight before the
+first is awaited. The loop keeps at most maxOutstanding commands waiting for
+their command status (the dongle's command buffer), one ATT request per
+connection (the ATT protocol allows no more) and one GAP procedure (device init,
+discovery or link establishment) at a time; requests for other connections
+overtake a blocked one. Configuring N tags therefore costs about as many round
+trips as configuring one.
+
+Everything runs in the thread that calls run()/pump(); failures are status codes
+(HCI_SUCCESS, a dongle/ATT status or HCI_STATUS_TIMEOUT...), there are no
+exceptions. Every request has a timeout, so run() always returns. A discovery or
+link establishment that times out is cancelled in the dongle; its awaiter
+completes right away, but the next GAP procedure waits until the dongle reports
+the end of the cancelled one (at most the loop timeout), so that neither gets
+bleIncorrectMode nor the other's late completion event.
+
+	HciEventLoop loop(transport, framer);
+	HciAdapter adapter(loop);
+	Task<HciResult> setup = initialize(adapter);	// a coroutine using co_await adapter.init() ...
+	HciResult r = loop.run(setup);
+*/
+
+const uint8_t HCI_COMMAND_PACKET = 0x01;
+
+// Statuses
+const uint8_t HCI_SUCCESS = 0x00;
+const uint8_t HCI_PROCEDURE_COMPLETE = 0x1A;		// bleProcedureComplete, final event of a GATT procedure
+const uint8_t HCI_DISCOVERY_CANCELED = 0x30;		// bleGAPUserCanceled
+const uint8_t HCI_STATUS_TIMEOUT = 0xF0;			// no response in time (set by the event loop)
+const uint8_t HCI_STATUS_SEND_FAILED = 0xF1;		// transport write failed
+const uint8_t HCI_STATUS_ABORTED = 0xF2;			// abort flag set, see HciEventLoop::setAbortFlag()
+
+// Command opcodes
+const uint16_t GAP_DEVICE_INIT = 0xFE00;
+const uint16_t GAP_DEVICE_DISCOVERY_REQUEST = 0xFE04;
+const uint16_t GAP_DEVICE_DISCOVERY_CANCEL = 0xFE05;
+const uint16_t GAP_ESTABLISH_LINK_REQUEST = 0xFE09;
+const uint16_t GAP_TERMINATE_LINK_REQUEST = 0xFE0A;
+const uint16_t GAP_SET_PARAM = 0xFE30;
+const uint16_t GATT_READ_CHAR_VALUE = 0xFD8A;
+const uint16_t GATT_WRITE_CHAR_VALUE = 0xFD92;
+
+// Vendor events
+const uint16_t GAP_DEVICE_INIT_DONE = 0x0600;
+const uint16_t GAP_DEVICE_DISCOVERY_DONE = 0x0601;
+const uint16_t GAP_LINK_ESTABLISHED = 0x0605;
+const uint16_t GAP_LINK_TERMINATED = 0x0606;
+const uint16_t GAP_DEVICE_INFORMATION = 0x060D;
+const uint16_t GAP_HCI_COMMAND_STATUS = 0x067F;
+const uint16_t ATT_ERROR_RSP = 0x0501;
+const uint16_t ATT_READ_RSP = 0x050B;
+const uint16_t ATT_WRITE_RSP = 0x0513;
+
+// GAP_SetParam ids
+const uint8_t TGAP_CONN_EST_INT_MIN = 0x15;
+const uint8_t TGAP_CONN_EST_INT_MAX = 0x16;
+const uint8_t TGAP_CONN_EST_SUPERV_TIMEOUT = 0x19;
+const uint8_t TGAP_CONN_EST_LATENCY = 0x1A;
+
+// Sent by GAP_TerminateLinkRequest to abandon a link establishment
+const uint16_t GAP_CONNHANDLE_INIT = 0xFFFE;
+
+class HciEventLoop;
+
+struct HciResult {
+	uint8_t status;
+	bool ok() const { return status == HCI_SUCCESS; }
+};
+
+struct GattReadResult {
+	uint8_t status;
+	std::vector<uint8_t> value;
+	bool ok() const { return status == HCI_SUCCESS; }
+};
+
+struct LinkResult {
+	uint8_t status;
+	uint16_t connHandle;
+	bool ok() const { return status == HCI_SUCCESS; }
+};
+
+struct DiscoveredDevice {
+	std::string mac;			// 12 lower case hex digits, as in AcquisitionConfig::macs
+	int8_t rssi;
+};
+
+/* "a0e6f8aed204", "A0:E6:F8:AE:D2:04" or "a0-e6-..." -> 12 lower case hex digits;
+   false if value is not an address. Config and the C API accept the same forms. */
+bool normaliseMac(const std::string &value, std::string &mac);
+
+struct ScanResult {
+	uint8_t status;
+	std::vector<DiscoveredDevice> devices;
+	bool ok() const { return status == HCI_SUCCESS; }
+	bool found(const std::string &mac) const;
+};
+
+// Byte stream to and from the dongle
+class HciTransport {
+public:
+	virtual ~HciTransport() {}
+	// Bytes read, 0 when nothing arrived within the transport's read timeout, -1 on error
+	virtual int read(uint8_t *buffer, size_t size) = 0;
+	virtual bool write(const uint8_t *data, size_t size) = 0;
+};
+
+/* One command and the event(s) completing it. Not copyable: the event loop
+   keeps a pointer to it from start() until it completes (or is destroyed). */
+class HciRequest {
+public:
+	static const long NO_SLOT = -1;
+	static const long GAP_SLOT = 0x10000;		// ATT requests use their connection handle
+
+	HciRequest(HciEventLoop &loop, long slot, int timeoutMs);
+	virtual ~HciRequest();
+
+	void start();
+	bool done() const { return m_done; }
+	uint8_t status() const { return m_status; }
+
+	bool await_ready() const { return m_done; }
+	void await_suspend(std::coroutine_handle<> waiter) { m_waiter = waiter; start(); }
+
+protected:
+	friend class HciEventLoop;
+	enum Match { IGNORED, CONSUMED, COMPLETED };
+
+	void setCommand(uint16_t opcode, const uint8_t *params, size_t length);
+	// Called after a successful command status: true if that completes the request
+	virtual bool completesOnStatus() const { return false; }
+	// A vendor event other than a command status; sets m_status when it returns COMPLETED
+	virtual Match onEvent(uint16_t event, const uint8_t *frame, size_t length) = 0;
+	// Cancels the dongle's procedure, if the command started one
+	virtual void onTimeout() {}
+	// The event that ends the procedure once onTimeout() cancelled it, 0 for none
+	virtual uint16_t cancelledEvent() const { return 0; }
+
+	HciEventLoop &m_loop;
+	std::vector<uint8_t> m_command;
+	uint16_t m_opcode;
+	long m_slot;					// requests with the same slot are sent one after the other
+	int m_timeoutMs;
+	bool m_started;
+	bool m_sent;
+	bool m_statusSeen;
+	bool m_done;
+	uint8_t m_status;
+	std::chrono::steady_clock::time_point m_deadline;
+	std::coroutine_handle<> m_waiter;
+
+private:
+	HciRequest(const HciRequest &);
+	HciRequest &operator=(const HciRequest &);
+};
+
+// A command that is complete with its command status (GAP_SetParam)
+class HciCommand : public HciRequest {
+public:
+	HciCommand(HciEventLoop &loop, uint16_t opcode, const uint8_t *params, size_t length);
+	HciResult await_resume() const { HciResult r = { m_status }; return r; }
+protected:
+	bool completesOnStatus() const { return true; }
+	Match onEvent(uint16_t, const uint8_t *, size_t) { return IGNORED; }
+};
+
+// A command completed by one event, optionally of a given connection (device init, terminate link)
+class HciEventRequest : public HciRequest {
+public:
+	HciEventRequest(HciEventLoop &loop, uint16_t opcode, const uint8_t *params, size_t length,
+					uint16_t event, long slot, long connHandle);
+	HciResult await_resume() const { HciResult r = { m_status }; return r; }
+protected:
+	Match onEvent(uint16_t event, const uint8_t *frame, size_t length);
+	uint16_t m_event;
+	long m_connHandle;				// -1: any
+};
+
+class GattWrite : public HciRequest {
+public:
+	GattWrite(HciEventLoop &loop, uint16_t connHandle, uint16_t handle, const uint8_t *value, size_t length);
+	HciResult await_resume() const { HciResult r = { m_status }; return r; }
+protected:
+	Match onEvent(uint16_t event, const uint8_t *frame, size_t length);
+	uint16_t m_connHandle;
+	uint16_t m_handle;
+};
+
+class GattRead : public HciRequest {
+public:
+	GattRead(HciEventLoop &loop, uint16_t connHandle, uint16_t handle);
+	GattReadResult await_resume() { GattReadResult r; r.status = m_status; r.value.swap(m_value); return r; }
+protected:
+	Match onEvent(uint16_t event, const uint8_t *frame, size_t length);
+	uint16_t m_connHandle;
+	uint16_t m_handle;
+	std::vector<uint8_t> m_value;
+};
+
+class GapDiscovery : public HciRequest {
+public:
+	// Ends early (discovery cancelled) once every address in macs was seen; empty: scan until done
+	GapDiscovery(HciEventLoop &loop, const std::vector<std::string> &macs, int timeoutMs);
+	ScanResult await_resume() { ScanResult r; r.status = m_status; r.devices.swap(m_devices); return r; }
+protected:
+	Match onEvent(uint16_t event, const uint8_t *frame, size_t length);
+	void onTimeout();
+	uint16_t cancelledEvent() const { return GAP_DEVICE_DISCOVERY_DONE; }
+	void found(const uint8_t *address, int8_t rssi);
+	std::vector<std::string> m_macs;
+	std::vector<DiscoveredDevice> m_devices;
+	bool m_cancelSent;
+};
+
+class GapLink : public HciRequest {
+public:
+	GapLink(HciEventLoop &loop, const std::string &mac, int timeoutMs);
+	LinkResult await_resume() const { LinkResult r = { m_status, m_connHandle }; return r; }
+protected:
+	Match onEvent(uint16_t event, const uint8_t *frame, size_t length);
+	void onTimeout();
+	uint16_t cancelledEvent() const { return GAP_LINK_ESTABLISHED; }
+	uint8_t m_address[6];			// least significant byte first, as in the events
+	uint16_t m_connHandle;
+};
+
+class HciEventLoop {
+public:
+	typedef void (*NotificationHandler)(const uint8_t *frame, size_t length, void *context);
+
+	HciEventLoop(HciTransport &transport, HciFramer &framer);
+	~HciEventLoop();
+
+	// Notifications (ATT_HandleValueNotification) arriving while the loop runs
+	void setNotificationHandler(NotificationHandler handler, void *context);
+	// While *flag is set every request fails at once with HCI_STATUS_ABORTED (e.g. a signal flag)
+	void setAbortFlag(const volatile sig_atomic_t *flag) { m_abort = flag; }
+	void setMaxOutstanding(size_t commands) { m_maxOutstanding = commands ? commands : 1; }
+	void setTimeout(int ms) { m_timeoutMs = ms; }
+	int timeout() const { return m_timeoutMs; }
+
+	// Runs the loop until the task completed
+	template <typename T>
+	T run(Task<T> &task) {
+		task.start();
+		while (!task.done())
+			pump();
+		return task.result();
+	}
+
+	// Runs the loop until all tasks completed, the tasks proceed concurrently
+	template <typename T>
+	void runAll(std::vector<Task<T> > &tasks) {
+		for (size_t i = 0; i < tasks.size(); i++)
+			tasks[i].start();
+		for (;;) {
+			size_t done = 0;
+			for (size_t i = 0; i < tasks.size(); i++)
+				done += tasks[i].done() ? 1 : 0;
+			if (done == tasks.size())
+				break;
+			pump();
+		}
+	}
+
+	// One read from the transport, then dispatch, timeouts, resumption and sending
+	void pump();
+	// Sends a command nobody waits for (its command status is ignored)
+	bool sendCommand(uint16_t opcode, const uint8_t *params, size_t length);
+
+	uint64_t commandsSent() const { return m_commandsSent; }
+
+private:
+	friend class HciRequest;
+
+	void submit(HciRequest *request);
+	void cancel(HciRequest *request);
+	bool slotBusy(long slot) const;
+	void sendQueued();
+	void dispatch(const uint8_t *frame, size_t length);
+	void complete(HciRequest *request, uint8_t status);
+	void expire();
+	void resumeReady();
+
+	HciTransport &m_transport;
+	HciFramer &m_framer;
+	NotificationHandler m_notify;
+	void *m_notifyContext;
+	const volatile sig_atomic_t *m_abort;
+	size_t m_maxOutstanding;
+	int m_timeoutMs;
+	std::deque<HciRequest *> m_queue;			// started, not sent yet
+	std::vector<HciRequest *> m_inflight;		// sent, in send order
+	std::vector<std::coroutine_handle<> > m_ready;
+	uint64_t m_commandsSent;
+	// A timed out discovery or link establishment still runs in the dongle until its
+	// cancelledEvent() arrives: the GAP slot stays busy until then (or the deadline)
+	uint16_t m_gapCancelEvent;
+	std::chrono::steady_clock::time_point m_gapCancelDeadline;
+};
+
+// GAP operations of the dongle
+class HciAdapter {
+public:
+	explicit HciAdapter(HciEventLoop &loop) : m_loop(loop) {}
+
+	HciEventRequest init();										// GAP_DeviceInit as central
+	HciCommand setParam(uint8_t id, uint16_t value);
+	GapDiscovery discover(const std::vector<std::string> &macs, int timeoutMs = 15000);
+	GapLink connect(const std::string &mac, int timeoutMs = 10000);
+	HciEventRequest disconnect(uint16_t connHandle);
+
+private:
+	HciEventLoop &m_loop;
+};
+
+// GATT operations on one connected tag
+class GattDevice {
+public:
+	GattDevice(HciEventLoop &loop, uint16_t connHandle) : m_loop(&loop), m_connHandle(connHandle) {}
+
+	// Characteristic values of one or two bytes (configuration, period, CCC descriptor) or any length
+	GattWrite writeChar(uint16_t handle, uint8_t value);
+	GattWrite writeChar(uint16_t handle, uint8_t value0, uint8_t value1);
+	GattWrite writeChar(uint16_t handle, const std::vector<uint8_t> &value);
+	GattRead readChar(uint16_t handle);
+	uint16_t connHandle() const { return m_connHandle; }
+
+private:
+	HciEventLoop *m_loop;
+	uint16_t m_connHandle;
+};
+
+#endif // HCIASYNC_H
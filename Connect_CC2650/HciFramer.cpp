@@ -0,0 +1,102 @@
+// HciFramer.cpp : splits the dongle's byte stream into HCI events and decodes them
+//
+
+#include "HciFramer.h"
+#include <cstring>
+
+HciFramer::HciFramer(FramePool &pool) : m_pool(pool), m_read(0), m_write(0), m_skipped(0) {
+}
+
+void HciFramer::reset() {
+	m_slab.reset();
+	m_read = 0;
+	m_write = 0;
+}
+
+bool HciFramer::ensureSpace() {
+	if (m_slab.valid()) {
+		// every byte has been framed and no slice is left: start over at the beginning
+		if (m_read == m_write && m_slab.unique()) {
+			m_read = 0;
+			m_write = 0;
+		}
+		if (m_write < m_slab.capacity())
+			return true;
+	}
+
+	// move the incomplete event to a fresh slab, slices keep the old one alive
+	FrameRef slab = m_pool.acquire();
+	if (!slab.valid())
+		return false;
+	size_t pending = m_write - m_read;
+	if (pending)
+		memcpy(slab.data(), m_slab.data() + m_read, pending);
+	m_slab = slab;
+	m_read = 0;
+	m_write = pending;
+	return true;
+}
+
+uint8_t *HciFramer::writePtr() {
+	return ensureSpace() ? m_slab.data() + m_write : 0;
+}
+
+size_t HciFramer::writeSpace() {
+	return ensureSpace() ? m_slab.capacity() - m_write : 0;
+}
+
+void HciFramer::commit(size_t bytes) {
+	m_write += bytes;
+}
+
+bool HciFramer::next(FrameSlice &frame) {
+	const uint8_t *buf = m_slab.data();
+	while (m_read < m_write) {
+		if (buf[m_read] != HCI_EVENT_PACKET) {
+			m_read++;				// lost sync (e.g. the tail of a timed out read), look for the next event
+			m_skipped++;
+			continue;
+		}
+		if (m_write - m_read < 3)
+			return false;
+		size_t length = 3 + buf[m_read + 2];
+		if (m_write - m_read < length)
+			return false;
+
+		frame.slab = m_slab;
+		frame.offset = (uint32_t)m_read;
+		frame.length = (uint32_t)length;
+		m_read += length;
+		return true;
+	}
+	return false;
+}
+
+uint16_t hciVendorEvent(const uint8_t *frame, size_t length) {
+	if (length < 5 || frame[0] != HCI_EVENT_PACKET || frame[1] != HCI_VENDOR_EVENT)
+		return 0;
+	return (uint16_t)(frame[3] | (frame[4] << 8));
+}
+
+uint16_t attConnectionHandle(const uint8_t *frame, size_t length) {
+	// ATT events are 0x05xx: status, then the connection handle
+	uint16_t event = hciVendorEvent(frame, length);
+	if ((event >> 8) != 0x05 || length < 8)
+		return 0xFFFF;
+	return (uint16_t)(frame[6] | (frame[7] << 8));
+}
+
+bool decodeMovementNotification(const uint8_t *frame, size_t length, ImuSample &sample) {
+	// 3 byte HCI header, event id, status, connection handle, pduLen, attribute handle
+	const size_t valueOffset = 3 + 2 + 1 + 2 + 1 + 2;
+	if (length < valueOffset + 2 * IMU_AXES || hciVendorEvent(frame, length) != ATT_HANDLE_VALUE_NOTIFICATION)
+		return false;
+	uint16_t handle = (uint16_t)(frame[9] | (frame[10] << 8));
+	if (frame[5] != 0 || handle != MOVEMENT_DATA_HANDLE)
+		return false;
+
+	const uint8_t *value = frame + valueOffset;
+	for (int a = 0; a < IMU_AXES; a++)
+		sample.axis[a] = (int16_t)(value[2 * a] | (value[2 * a + 1] << 8));
+	return true;
+}
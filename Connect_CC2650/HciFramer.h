@@ -0,0 +1,75 @@
+// HciFramer.h : splits the dongle's byte stream into HCI events and decodes them
+//
+
+#ifndef HCIFRAMER_H
+#define HCIFRAMER_H
+
+#include "FramePool.h"
+#include "ImuSample.h"
+#include <cstddef>
+#include <cstdint>
+
+/*
+The CC2540 dongle sends HCI events:
+
+	0x04  event code  length  parameters[length]
+
+TI's vendor specific events (code 0xFF) start with a 16-bit event id. The IMU
+readings arrive as ATT_HandleValueNotification (0x051B):
+
+	1B 05  status  connHandle(2)  pduLen  attrHandle(2)  value[18]
+
+The value holds Gx Gy Gz Ax Ay Az Mx My Mz as little endian int16.
+
+Usage (no heap allocation once the pool exists):
+	uint8_t *dst = framer.writePtr();
+	int n = port.read(dst, framer.writeSpace());
+	if (n > 0) framer.commit(n);
+	while (framer.next(frame)) decodeMovementNotification(frame, ...);
+*/
+
+const uint8_t HCI_EVENT_PACKET = 0x04;
+const uint8_t HCI_VENDOR_EVENT = 0xFF;
+const uint16_t ATT_HANDLE_VALUE_NOTIFICATION = 0x051B;
+const uint16_t MOVEMENT_DATA_HANDLE = 0x0039;
+const uint16_t MOVEMENT_CCC_HANDLE = 0x003A;		// client characteristic configuration: 01 00 enables notifications
+const uint16_t MOVEMENT_CONFIG_HANDLE = 0x003C;		// sensor bits, accelerometer range
+const uint16_t MOVEMENT_PERIOD_HANDLE = 0x003E;		// period in units of 10 ms
+const size_t HCI_MAX_EVENT_SIZE = 3 + 255;
+
+// The pool's slabs must hold at least HCI_MAX_EVENT_SIZE bytes
+class HciFramer {
+public:
+	explicit HciFramer(FramePool &pool);
+
+	// Where the transport should put the next bytes; 0 space when the pool is exhausted
+	uint8_t *writePtr();
+	size_t writeSpace();
+	void commit(size_t bytes);
+
+	// Next complete event, as a slice sharing the slab it was read into
+	bool next(FrameSlice &frame);
+
+	void reset();
+	uint64_t skippedBytes() const { return m_skipped; }
+
+private:
+	bool ensureSpace();
+
+	FramePool &m_pool;
+	FrameRef m_slab;
+	size_t m_read;
+	size_t m_write;
+	uint64_t m_skipped;			// bytes dropped while looking for an event start
+};
+
+// Vendor event id of an HCI event frame, 0 if it is not a vendor event
+uint16_t hciVendorEvent(const uint8_t *frame, size_t length);
+
+// Connection handle of an ATT event (notification, response), 0xFFFF for other frames
+uint16_t attConnectionHandle(const uint8_t *frame, size_t length);
+
+// Fills sample.axis from a movement notification; false for any other frame
+bool decodeMovementNotification(const uint8_t *frame, size_t length, ImuSample &sample);
+
+#endif // HCIFRAMER_H
@@ -0,0 +1,42 @@
+// ImuSample.h : one decoded reading of the SensorTag movement sensor
+//
+
+#ifndef IMUSAMPLE_H
+#define IMUSAMPLE_H
+
+#include <chrono>
+#include <cstdint>
+
+// Sensor groups of the MPU9250. Used as bit flags wherever a subset of the
+// nine axes is selected (stream subscriptions, archive queries...).
+enum ImuSensor {
+	IMU_GYRO = 0x01,
+	IMU_ACC  = 0x02,
+	IMU_MAG  = 0x04,
+	IMU_ALL  = 0x07
+};
+
+// Axis order is the order in which the SensorTag sends them
+enum ImuAxis {
+	AXIS_GX = 0, AXIS_GY, AXIS_GZ,
+	AXIS_AX, AXIS_AY, AXIS_AZ,
+	AXIS_MX, AXIS_MY, AXIS_MZ,
+	IMU_AXES
+};
+
+/* Raw signed 16-bit counts are kept instead of physical units so that the sample
+   can be stored and sent without loss. Use the sensorMpu9250...Convert() helpers
+   to get deg/s and G; the magnetometer is already in uT. */
+struct ImuSample {
+	uint16_t deviceId;			// index of the SensorTag in the configured device list
+	uint64_t timestamp;			// microseconds since the Unix epoch, taken on the host at decode
+	int16_t axis[IMU_AXES];
+};
+
+// Host timestamp in the unit used by ImuSample::timestamp
+inline uint64_t imuTimestampNow() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+#endif // IMUSAMPLE_H
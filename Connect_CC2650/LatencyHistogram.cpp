@@ -0,0 +1,90 @@
+// LatencyHistogram.cpp : fixed-size latency histogram with percentile reports
+//
+
+#include "LatencyHistogram.h"
+#include <cstring>
+#include <iomanip>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the highest set bit, v != 0
+static int highestBit(uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, v);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(v);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+void LatencyHistogram::reset() {
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_sum = 0;
+	m_min = UINT64_MAX;
+	m_max = 0;
+}
+
+int LatencyHistogram::bucketOf(uint64_t ns) {
+	if (ns < (uint64_t)SUB_BUCKETS)
+		return (int)ns;
+	int bit = highestBit(ns);
+	int sub = (int)(ns >> (bit - SUB_BITS)) & (SUB_BUCKETS - 1);
+	return (bit - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int bucket) {
+	if (bucket < SUB_BUCKETS)
+		return (uint64_t)bucket;
+	int shift = bucket / SUB_BUCKETS - 1;
+	uint64_t sub = (uint64_t)(bucket % SUB_BUCKETS);
+	return ((SUB_BUCKETS + sub) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+	m_buckets[bucketOf(ns)]++;
+	m_count++;
+	m_sum += ns;
+	if (ns < m_min) m_min = ns;
+	if (ns > m_max) m_max = ns;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+	if (m_count == 0)
+		return 0;
+	uint64_t rank = (uint64_t)(p / 100.0 * m_count + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > m_count) rank = m_count;
+	uint64_t seen = 0;
+	for (int b = 0; b < BUCKETS; b++) {
+		seen += m_buckets[b];
+		if (seen >= rank) {
+			uint64_t bound = bucketUpperBound(b);
+			return bound < m_max ? bound : m_max;
+		}
+	}
+	return m_max;
+}
+
+void LatencyHistogram::report(std::ostream &out, const char *name, uint64_t targetNs) const {
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(1) << std::left << std::setw(10) << name << std::right
+		<< " n=" << m_count
+		<< "  p50 " << percentile(50) / 1000.0
+		<< "  p99 " << percentile(99) / 1000.0
+		<< "  p99.9 " << percentile(99.9) / 1000.0
+		<< "  max " << m_max / 1000.0 << " us";
+	if (targetNs)
+		out << "  (target " << targetNs / 1000.0 << " us: " << (percentile(99.9) <= targetNs ? "met" : "MISSED") << ")";
+	out << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,56 @@
+// LatencyHistogram.h : fixed-size latency histogram with percentile reports
+//
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <cstdint>
+#include <ostream>
+
+/*
+Log-linear buckets in nanoseconds: values below 16 ns get a bucket each, above
+that every power of two is split into 16 buckets, so a percentile is at most
+1/16 (6 %) above the true value. The 976 buckets cover the whole uint64_t range.
+record() is a few instructions and never allocates, it can be called from the
+acquisition loop.
+
+	LatencyHistogram decode;
+	decode.record(ns);
+	...
+	decode.report(cout, "decode", 1000000);		// p50/p99/p99.9/max against a 1 ms target
+*/
+
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void record(uint64_t ns);
+	void reset();
+
+	uint64_t count() const { return m_count; }
+	uint64_t min() const { return m_count ? m_min : 0; }
+	uint64_t max() const { return m_max; }
+	double mean() const { return m_count ? (double)m_sum / m_count : 0; }
+
+	// Upper bound of the bucket holding the p-th percentile (0 < p <= 100), in ns
+	uint64_t percentile(double p) const;
+
+	// One line: count, p50, p99, p99.9, max in us, and whether p99.9 <= targetNs (0: no target)
+	void report(std::ostream &out, const char *name, uint64_t targetNs) const;
+
+	static const int SUB_BITS = 4;
+	static const int SUB_BUCKETS = 1 << SUB_BITS;
+	static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+	static int bucketOf(uint64_t ns);
+	static uint64_t bucketUpperBound(int bucket);	// largest value in the bucket
+
+private:
+	uint64_t m_buckets[BUCKETS];
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_min;
+	uint64_t m_max;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,131 @@
+// RealTime.cpp : thread pinning, real-time priority and locked memory for low-latency acquisition
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE			// pthread_setaffinity_np
+#endif
+
+#include "RealTime.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+
+static bool fail(const char *what, std::string &error) {
+	error = std::string(what) + " failed with error " + std::to_string(GetLastError());
+	return false;
+}
+
+bool pinCurrentThread(const std::vector<int> &cpus, std::string &error) {
+	DWORD_PTR mask = 0;
+	for (size_t i = 0; i < cpus.size(); i++) {
+		if (cpus[i] < 0 || cpus[i] >= (int)(sizeof(DWORD_PTR) * 8)) {
+			error = "no such CPU: " + std::to_string(cpus[i]);
+			return false;
+		}
+		mask |= (DWORD_PTR)1 << cpus[i];
+	}
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+		return fail("SetThreadAffinityMask", error);
+	return true;
+}
+
+bool setRealTimePriority(int priority, std::string &error) {
+	(void)priority;
+	if (!SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS) &&
+		!SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS))
+		return fail("SetPriorityClass", error);
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+		return fail("SetThreadPriority", error);
+	return true;
+}
+
+bool lockAllMemory(std::string &error) {
+	// VirtualLock is limited to the minimum working set
+	const SIZE_T minimum = 64 * 1024 * 1024, maximum = 256 * 1024 * 1024;
+	if (!SetProcessWorkingSetSize(GetCurrentProcess(), minimum, maximum))
+		return fail("SetProcessWorkingSetSize", error);
+	return true;
+}
+
+bool lockMemory(const void *address, size_t size, std::string &error) {
+	if (!VirtualLock((LPVOID)address, size))
+		return fail("VirtualLock", error);
+	return true;
+}
+
+#else
+
+static bool fail(const char *what, int code, std::string &error) {
+	error = std::string(what) + ": " + strerror(code);
+	return false;
+}
+
+bool pinCurrentThread(const std::vector<int> &cpus, std::string &error) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus.size(); i++) {
+		if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+			error = "no such CPU: " + std::to_string(cpus[i]);
+			return false;
+		}
+		CPU_SET(cpus[i], &set);
+	}
+	int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (result != 0)
+		return fail("pthread_setaffinity_np", result, error);
+	return true;
+}
+
+bool setRealTimePriority(int priority, std::string &error) {
+	sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (result != 0)
+		return fail("SCHED_FIFO", result, error);
+	return true;
+}
+
+bool lockAllMemory(std::string &error) {
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+		return fail("mlockall", errno, error);
+	return true;
+}
+
+bool lockMemory(const void *address, size_t size, std::string &error) {
+	if (mlock(address, size) != 0)
+		return fail("mlock", errno, error);
+	return true;
+}
+
+#endif
+
+void prefaultStack() {
+	volatile char stack[PREFAULT_STACK_SIZE];
+	// from the top down, the order in which the stack grows
+	for (size_t i = PREFAULT_STACK_SIZE; i > 0; i -= 4096)
+		stack[i - 1] = 0;
+	(void)stack;
+}
+
+void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	_mm_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
@@ -0,0 +1,44 @@
+// RealTime.h : thread pinning, real-time priority and locked memory for low-latency acquisition
+//
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+Thin wrappers over the platform calls, all acting on the calling thread or
+process. Each returns false and sets error when the system refuses (e.g. no
+CAP_SYS_NICE / RLIMIT_RTPRIO for SCHED_FIFO, RLIMIT_MEMLOCK for mlock, or no
+administrator rights for REALTIME_PRIORITY_CLASS on Windows); the caller
+decides whether to go on without.
+
+Note that a busy-polling thread at real-time priority owns its core: pin it to
+one that nothing else needs.
+*/
+
+// Restricts the calling thread to the given cores (0-based)
+bool pinCurrentThread(const std::vector<int> &cpus, std::string &error);
+
+/* priority 1..99: SCHED_FIFO with that priority on Linux; on Windows any value
+   selects REALTIME_PRIORITY_CLASS (HIGH_PRIORITY_CLASS if that is refused) and
+   THREAD_PRIORITY_TIME_CRITICAL. */
+bool setRealTimePriority(int priority, std::string &error);
+
+// Keeps every current and future page of the process in RAM (mlockall); on
+// Windows grows the working set so that lockMemory() can succeed
+bool lockAllMemory(std::string &error);
+
+// Keeps [address, address + size) in RAM (mlock / VirtualLock)
+bool lockMemory(const void *address, size_t size, std::string &error);
+
+// Touches the next PREFAULT_STACK_SIZE bytes of the calling thread's stack so that they are mapped
+const size_t PREFAULT_STACK_SIZE = 256 * 1024;
+void prefaultStack();
+
+// Pause hint for spin loops
+void cpuRelax();
+
+#endif // REALTIME_H
@@ -0,0 +1,313 @@
+// Recording.cpp : capture files with a sparse time index for random access
+//
+
+#include "Recording.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Records are mapped straight from the file, so their layout is fixed
+static_assert(sizeof(RecordedSample) == 32, "RecordedSample must be 32 bytes");
+static_assert(sizeof(RecordingIndexEntry) == 24, "RecordingIndexEntry must be 24 bytes");
+
+static const char RECORDING_MAGIC[4] = { 'C', 'C', 'R', '1' };
+static const char RECORDING_INDEX_MAGIC[4] = { 'C', 'C', 'I', '1' };
+static const uint16_t RECORDING_VERSION = 1;
+
+// Written through at once, so that a full disk already fails open()
+static bool writeHeader(FILE *f, const char magic[4], uint16_t entrySize, uint32_t interval) {
+	uint8_t header[RECORDING_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, magic, 4);
+	memcpy(header + 4, &RECORDING_VERSION, 2);
+	memcpy(header + 6, &entrySize, 2);
+	memcpy(header + 8, &interval, 4);
+	return fwrite(header, 1, sizeof(header), f) == sizeof(header) && fflush(f) == 0;
+}
+
+static bool checkHeader(const uint8_t *header, const char magic[4], uint16_t entrySize) {
+	uint16_t version, size;
+	memcpy(&version, header + 4, 2);
+	memcpy(&size, header + 6, 2);
+	return memcmp(header, magic, 4) == 0 && version == RECORDING_VERSION && size == entrySize;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// RecordingWriter
+
+RecordingWriter::RecordingWriter()
+	: m_data(0), m_index(0), m_interval(RECORDING_DEFAULT_INTERVAL), m_records(0), m_unflushed(0), m_writeFailed(false) {
+}
+
+RecordingWriter::~RecordingWriter() {
+	close();
+}
+
+bool RecordingWriter::open(const std::string &path, uint32_t indexInterval) {
+	close();
+	m_data = fopen(path.c_str(), "wb");
+	m_index = fopen((path + ".idx").c_str(), "wb");
+	if (!m_data || !m_index) {
+		m_lastError = "cannot create " + path + " or its index";
+		close();
+		return false;
+	}
+	m_interval = indexInterval > 0 ? indexInterval : 1;
+	m_records = 0;
+	m_unflushed = 0;
+	m_lastFlush = std::chrono::steady_clock::now();
+	m_writeFailed = false;
+	m_devices.clear();
+	if (!writeHeader(m_data, RECORDING_MAGIC, sizeof(RecordedSample), m_interval) ||
+		!writeHeader(m_index, RECORDING_INDEX_MAGIC, sizeof(RecordingIndexEntry), m_interval)) {
+		m_lastError = "cannot write to " + path + " or its index";
+		close();
+		return false;
+	}
+	return true;
+}
+
+void RecordingWriter::append(const ImuSample &sample) {
+	if (!m_data)
+		return;
+
+	RecordedSample record;
+	memset(&record, 0, sizeof(record));
+	record.timestamp = sample.timestamp;
+	record.deviceId = sample.deviceId;
+	memcpy(record.axis, sample.axis, sizeof(record.axis));
+	if (fwrite(&record, sizeof(record), 1, m_data) != 1)
+		m_writeFailed = true;
+	m_unflushed += sizeof(record);
+
+	if (sample.deviceId >= m_devices.size()) {
+		DeviceState empty = { 0, 0 };
+		m_devices.resize(sample.deviceId + 1, empty);
+	}
+	DeviceState &device = m_devices[sample.deviceId];
+	if (sample.timestamp > device.lastTimestamp)
+		device.lastTimestamp = sample.timestamp;
+
+	if (device.samples % m_interval == 0) {
+		RecordingIndexEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.timestamp = device.lastTimestamp;
+		entry.record = m_records;
+		entry.deviceId = sample.deviceId;
+		if (fwrite(&entry, sizeof(entry), 1, m_index) != 1)
+			m_writeFailed = true;
+		// the clock is only read here, once per index interval
+		flushIfDue();
+	}
+	else if (m_unflushed >= RECORDING_FLUSH_BYTES) {
+		flush();
+	}
+	device.samples++;
+	m_records++;
+}
+
+bool RecordingWriter::flush() {
+	if (!m_data)
+		return false;
+	// data first: an index entry flushed here never points past the data on disk
+	if (fflush(m_data) != 0 || fflush(m_index) != 0)
+		m_writeFailed = true;
+	m_unflushed = 0;
+	m_lastFlush = std::chrono::steady_clock::now();
+	if (m_writeFailed)
+		m_lastError = "recording write failed";
+	return !m_writeFailed;
+}
+
+bool RecordingWriter::flushIfDue() {
+	if (!m_data || m_unflushed == 0)
+		return !m_writeFailed;
+	if (m_unflushed < RECORDING_FLUSH_BYTES &&
+		std::chrono::steady_clock::now() - m_lastFlush < std::chrono::milliseconds(RECORDING_FLUSH_INTERVAL_MS))
+		return !m_writeFailed;
+	return flush();
+}
+
+bool RecordingWriter::close() {
+	bool ok = !(m_data && m_writeFailed);
+	if (m_data && fclose(m_data) != 0)
+		ok = false;
+	if (m_index && fclose(m_index) != 0)
+		ok = false;
+	m_data = 0;
+	m_index = 0;
+	return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// RecordingReader
+
+struct RecordingReader::MappedFile {
+	const uint8_t *data;
+	uint64_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+
+	MappedFile() : data(0), size(0) {
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = 0;
+#else
+		fd = -1;
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap((void *)data, size);
+		if (fd >= 0)
+			::close(fd);
+#endif
+	}
+
+	bool open(const std::string &path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
+		LARGE_INTEGER fileSize;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			return false;
+		size = (uint64_t)fileSize.QuadPart;
+		mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+		if (!mapping)
+			return false;
+		data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		return data != 0;
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+			return false;
+		size = (uint64_t)st.st_size;
+		void *p = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			return false;
+		data = (const uint8_t *)p;
+		return true;
+#endif
+	}
+};
+
+RecordingReader::RecordingReader() : m_dataMap(0), m_indexMap(0), m_records(0), m_recordCount(0) {
+}
+
+RecordingReader::~RecordingReader() {
+	close();
+}
+
+void RecordingReader::close() {
+	delete m_dataMap;
+	delete m_indexMap;
+	m_dataMap = 0;
+	m_indexMap = 0;
+	m_records = 0;
+	m_recordCount = 0;
+	m_deviceIndex.clear();
+}
+
+bool RecordingReader::fail(const std::string &what) {
+	m_lastError = what;
+	close();
+	return false;
+}
+
+bool RecordingReader::open(const std::string &path) {
+	close();
+	m_dataMap = new MappedFile;
+	m_indexMap = new MappedFile;
+	if (!m_dataMap->open(path) || !m_indexMap->open(path + ".idx"))
+		return fail("cannot map " + path + " or its index");
+	if (m_dataMap->size < RECORDING_HEADER_SIZE || !checkHeader(m_dataMap->data, RECORDING_MAGIC, sizeof(RecordedSample)))
+		return fail(path + " is not a recording");
+	if (m_indexMap->size < RECORDING_HEADER_SIZE || !checkHeader(m_indexMap->data, RECORDING_INDEX_MAGIC, sizeof(RecordingIndexEntry)))
+		return fail(path + ".idx is not a recording index");
+
+	// a partially written last record is ignored
+	m_records = (const RecordedSample *)(m_dataMap->data + RECORDING_HEADER_SIZE);
+	m_recordCount = (m_dataMap->size - RECORDING_HEADER_SIZE) / sizeof(RecordedSample);
+
+	const RecordingIndexEntry *entries = (const RecordingIndexEntry *)(m_indexMap->data + RECORDING_HEADER_SIZE);
+	uint64_t entryCount = (m_indexMap->size - RECORDING_HEADER_SIZE) / sizeof(RecordingIndexEntry);
+	for (uint64_t i = 0; i < entryCount; i++) {
+		if (entries[i].record >= m_recordCount)
+			break;				// data of this entry never made it to disk
+		if (entries[i].deviceId >= m_deviceIndex.size())
+			m_deviceIndex.resize(entries[i].deviceId + 1);
+		m_deviceIndex[entries[i].deviceId].push_back(&entries[i]);
+	}
+	return true;
+}
+
+static bool entryBefore(uint64_t t, const RecordingIndexEntry *e) {
+	return t < e->timestamp;
+}
+
+static bool entryAfter(const RecordingIndexEntry *e, uint64_t t) {
+	return e->timestamp < t;
+}
+
+RecordingRange RecordingReader::find(uint16_t deviceId, uint64_t t0, uint64_t t1) const {
+	RecordingRange range = { m_records, m_records, deviceId };
+	if (deviceId >= m_deviceIndex.size() || m_deviceIndex[deviceId].empty() || t0 >= t1)
+		return range;
+	const std::vector<const RecordingIndexEntry *> &index = m_deviceIndex[deviceId];
+
+	// scan from the last index point at or before t0 up to the first one at or after t1
+	std::vector<const RecordingIndexEntry *>::const_iterator first = std::upper_bound(index.begin(), index.end(), t0, entryBefore);
+	uint64_t start = first == index.begin() ? index.front()->record : (*(first - 1))->record;
+	std::vector<const RecordingIndexEntry *>::const_iterator last = std::lower_bound(first, index.end(), t1, entryAfter);
+	uint64_t stop = last == index.end() ? m_recordCount : (*last)->record;
+
+	const RecordedSample *begin = m_records + start;
+	const RecordedSample *end = m_records + stop;
+	while (begin < end && (begin->deviceId != deviceId || begin->timestamp < t0))
+		begin++;
+	while (end > begin && ((end - 1)->deviceId != deviceId || (end - 1)->timestamp >= t1))
+		end--;
+	range.begin = begin;
+	range.end = end;
+	return range;
+}
+
+size_t RecordingRange::count() const {
+	size_t n = 0;
+	for (const RecordedSample *p = begin; p < end; p++)
+		n += p->deviceId == deviceId;
+	return n;
+}
+
+void RecordingRange::copyTo(std::vector<ImuSample> &out) const {
+	for (const RecordedSample *p = begin; p < end; p++) {
+		if (p->deviceId != deviceId)
+			continue;
+		ImuSample s;
+		s.deviceId = p->deviceId;
+		s.timestamp = p->timestamp;
+		memcpy(s.axis, p->axis, sizeof(s.axis));
+		out.push_back(s);
+	}
+}
@@ -0,0 +1,127 @@
+// Recording.h : capture files with a sparse time index for random access
+//
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include "ImuSample.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+A recording is a pair of files written during capture:
+
+	<path>			32-byte header ("CCR1"...), then one RecordedSample per
+					decoded sample in arrival order (all devices interleaved)
+	<path>.idx		32-byte header ("CCI1"...), then one RecordingIndexEntry for
+					the first sample of each device and every indexInterval-th
+					sample after it
+
+Both files are only appended to. They are flushed together, data first, once
+RECORDING_FLUSH_BYTES of records or RECORDING_FLUSH_INTERVAL_MS have gone by
+since the last flush, and by flush()/flushIfDue() from outside the acquisition
+path. A capture that is cut short stays readable up to the last flush; index
+entries pointing past the data on disk are ignored by the reader.
+
+RecordingReader memory-maps both files. find() binary searches the index of one
+device and returns the span of records holding its samples in [t0, t1); only
+that span (plus at most one index interval) is touched.
+
+Timestamps are expected not to go backwards per device; the writer keeps the
+index monotonic if the host clock is stepped back.
+*/
+
+struct RecordedSample {
+	uint64_t timestamp;
+	uint16_t deviceId;
+	int16_t axis[IMU_AXES];
+	uint8_t reserved[4];
+};
+
+struct RecordingIndexEntry {
+	uint64_t timestamp;
+	uint64_t record;			// record number in the data file
+	uint16_t deviceId;
+	uint8_t reserved[6];
+};
+
+const size_t RECORDING_HEADER_SIZE = 32;
+const uint32_t RECORDING_DEFAULT_INTERVAL = 64;
+const uint64_t RECORDING_FLUSH_BYTES = 64 * 1024;
+const int RECORDING_FLUSH_INTERVAL_MS = 1000;
+
+class RecordingWriter {
+public:
+	RecordingWriter();
+	~RecordingWriter();
+
+	bool open(const std::string &path, uint32_t indexInterval = RECORDING_DEFAULT_INTERVAL);
+	void append(const ImuSample &sample);
+	// Writes the buffered records out, data before index; false if a write failed (disk full...)
+	bool flush();
+	// flush() once a threshold is reached, e.g. between reads
+	bool flushIfDue();
+	bool close();
+	bool isOpen() const { return m_data != 0; }
+
+	const std::string &lastError() const { return m_lastError; }
+
+private:
+	struct DeviceState {
+		uint64_t samples;
+		uint64_t lastTimestamp;
+	};
+
+	FILE *m_data;
+	FILE *m_index;
+	uint32_t m_interval;
+	uint64_t m_records;
+	uint64_t m_unflushed;					// bytes appended since the last flush
+	std::chrono::steady_clock::time_point m_lastFlush;
+	bool m_writeFailed;
+	std::vector<DeviceState> m_devices;		// indexed by deviceId
+	std::string m_lastError;
+};
+
+// Samples of one device in [t0, t1): the records in [begin, end) whose deviceId matches
+struct RecordingRange {
+	const RecordedSample *begin;
+	const RecordedSample *end;
+	uint16_t deviceId;
+
+	size_t count() const;
+	void copyTo(std::vector<ImuSample> &out) const;
+};
+
+class RecordingReader {
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	bool open(const std::string &path);
+	void close();
+
+	uint64_t recordCount() const { return m_recordCount; }
+	const RecordedSample *records() const { return m_records; }
+
+	RecordingRange find(uint16_t deviceId, uint64_t t0, uint64_t t1) const;
+
+	const std::string &lastError() const { return m_lastError; }
+
+private:
+	struct MappedFile;
+
+	bool fail(const std::string &what);
+
+	MappedFile *m_dataMap;
+	MappedFile *m_indexMap;
+	const RecordedSample *m_records;
+	uint64_t m_recordCount;
+	std::vector<std::vector<const RecordingIndexEntry *> > m_deviceIndex;	// by deviceId
+	std::string m_lastError;
+};
+
+#endif // RECORDING_H
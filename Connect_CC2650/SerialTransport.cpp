@@ -0,0 +1,206 @@
+// SerialTransport.cpp : the dongle's serial port (Win32 or POSIX termios) as an HciTransport
+//
+
+#include "SerialTransport.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+static bool fail(const char *what, std::string &error) {
+	error = std::string(what) + " failed with error " + std::to_string(GetLastError());
+	return false;
+}
+
+SerialTransport::SerialTransport() : m_handle(INVALID_HANDLE_VALUE), m_readTimeoutMs(100) {
+}
+
+bool SerialTransport::open(const std::string &port, std::string &error) {
+	close();
+	// COM10 and above only open with the device namespace prefix
+	std::string path = port.compare(0, 4, "\\\\.\\") == 0 ? port : "\\\\.\\" + port;
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
+	if (handle == INVALID_HANDLE_VALUE)
+		return fail(("Opening " + port).c_str(), error);
+
+	DCB dcb;
+	memset(&dcb, 0, sizeof(dcb));
+	dcb.DCBlength = sizeof(dcb);
+	if (!GetCommState(handle, &dcb)) {
+		CloseHandle(handle);
+		return fail("GetCommState", error);
+	}
+	dcb.BaudRate = 115200;
+	dcb.ByteSize = 8;
+	dcb.Parity = NOPARITY;
+	dcb.StopBits = ONESTOPBIT;
+	dcb.fBinary = TRUE;
+	dcb.fParity = FALSE;
+	dcb.fOutxCtsFlow = FALSE;
+	dcb.fOutxDsrFlow = FALSE;
+	dcb.fDtrControl = DTR_CONTROL_DISABLE;
+	dcb.fDsrSensitivity = FALSE;
+	dcb.fOutX = FALSE;
+	dcb.fInX = FALSE;
+	dcb.fNull = FALSE;
+	dcb.fRtsControl = RTS_CONTROL_DISABLE;
+	dcb.fAbortOnError = TRUE;
+	if (!SetCommState(handle, &dcb)) {
+		CloseHandle(handle);
+		return fail("SetCommState", error);
+	}
+	m_handle = handle;
+	if (!setReadTimeout(m_readTimeoutMs)) {
+		close();
+		return fail("SetCommTimeouts", error);
+	}
+	return true;
+}
+
+void SerialTransport::close() {
+	if (m_handle != INVALID_HANDLE_VALUE)
+		CloseHandle((HANDLE)m_handle);
+	m_handle = INVALID_HANDLE_VALUE;
+}
+
+bool SerialTransport::isOpen() const {
+	return m_handle != INVALID_HANDLE_VALUE;
+}
+
+bool SerialTransport::setReadTimeout(int ms) {
+	m_readTimeoutMs = ms > 0 ? ms : 0;
+	if (!isOpen())
+		return true;
+	// MAXDWORD/MAXDWORD/n: return as soon as a byte arrives, or after n ms; MAXDWORD/0/0: at once
+	COMMTIMEOUTS timeouts;
+	memset(&timeouts, 0, sizeof(timeouts));
+	timeouts.ReadIntervalTimeout = MAXDWORD;
+	timeouts.ReadTotalTimeoutMultiplier = m_readTimeoutMs ? MAXDWORD : 0;
+	timeouts.ReadTotalTimeoutConstant = (DWORD)m_readTimeoutMs;
+	return SetCommTimeouts((HANDLE)m_handle, &timeouts) != 0;
+}
+
+int SerialTransport::read(uint8_t *buffer, size_t size) {
+	DWORD bytesRead = 0;
+	if (!ReadFile((HANDLE)m_handle, buffer, (DWORD)size, &bytesRead, 0))
+		return -1;
+	return (int)bytesRead;
+}
+
+bool SerialTransport::write(const uint8_t *data, size_t size) {
+	DWORD written = 0;
+	if (!WriteFile((HANDLE)m_handle, data, (DWORD)size, &written, 0))
+		return false;
+	return written == size;
+}
+
+#else
+
+SerialTransport::SerialTransport() : m_fd(-1), m_readTimeoutMs(100) {
+}
+
+bool SerialTransport::open(const std::string &port, std::string &error) {
+	close();
+	int fd = ::open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		error = "cannot open " + port + ": " + strerror(errno);
+		return false;
+	}
+
+	termios tty;
+	if (tcgetattr(fd, &tty) != 0) {
+		error = port + " is not a serial port: " + strerror(errno);
+		::close(fd);
+		return false;
+	}
+	cfmakeraw(&tty);
+	cfsetispeed(&tty, B115200);
+	cfsetospeed(&tty, B115200);
+	tty.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS | CSIZE);
+	tty.c_cflag |= CS8 | CLOCAL | CREAD;
+	tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+	tty.c_cc[VMIN] = 0;				// reads never block, the timeout is done with poll()
+	tty.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+		error = "cannot configure " + port + ": " + strerror(errno);
+		::close(fd);
+		return false;
+	}
+	tcflush(fd, TCIOFLUSH);
+	m_fd = fd;
+	return true;
+}
+
+void SerialTransport::close() {
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+}
+
+bool SerialTransport::isOpen() const {
+	return m_fd >= 0;
+}
+
+bool SerialTransport::setReadTimeout(int ms) {
+	m_readTimeoutMs = ms > 0 ? ms : 0;
+	return true;
+}
+
+int SerialTransport::read(uint8_t *buffer, size_t size) {
+	// poll() also without a timeout: a read of a hung up tty returns 0 just like an idle one
+	pollfd p;
+	p.fd = m_fd;
+	p.events = POLLIN;
+	p.revents = 0;
+	int ready = ::poll(&p, 1, m_readTimeoutMs);
+	if (ready == 0 || (ready < 0 && errno == EINTR))
+		return 0;					// timeout, or a signal: let the caller look at its flags
+	if (ready < 0 || (p.revents & (POLLERR | POLLNVAL)))
+		return -1;
+	if ((p.revents & POLLHUP) && !(p.revents & POLLIN))
+		return -1;					// hung up with nothing left to read
+	ssize_t n = ::read(m_fd, buffer, size);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+	if (n == 0)
+		return -1;					// ready but nothing to read: end of file, the dongle is gone
+	return (int)n;
+}
+
+bool SerialTransport::write(const uint8_t *data, size_t size) {
+	// the fd is non-blocking: wait for room instead of failing on a full output buffer
+	while (size > 0) {
+		ssize_t n = ::write(m_fd, data, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			pollfd p;
+			p.fd = m_fd;
+			p.events = POLLOUT;
+			p.revents = 0;
+			if (::poll(&p, 1, 1000) <= 0)
+				return false;
+			continue;
+		}
+		data += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+#endif
+
+SerialTransport::~SerialTransport() {
+	close();
+}
@@ -0,0 +1,57 @@
+// SerialTransport.h : the dongle's serial port (Win32 or POSIX termios) as an HciTransport
+//
+
+#ifndef SERIALTRANSPORT_H
+#define SERIALTRANSPORT_H
+
+#include "HciAsync.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+The CC2540 dongle is a USB CDC device: COM<n> on Windows, /dev/ttyACM<n> on
+Linux. The port is opened at 115200 8N1 without flow control. A read returns as
+soon as any byte is there, or with 0 after the read timeout (100 ms by default,
+0 makes every read return at once for busy polling).
+
+	SerialTransport port;
+	if (!port.open("/dev/ttyACM0", error)) ...
+	DeviceManager tags(port);
+*/
+
+#ifdef _WIN32
+const char *const SERIAL_DEFAULT_PORT = "COM8";
+#else
+const char *const SERIAL_DEFAULT_PORT = "/dev/ttyACM0";
+#endif
+
+class SerialTransport : public HciTransport {
+public:
+	SerialTransport();
+	~SerialTransport();
+
+	bool open(const std::string &port, std::string &error);
+	void close();
+	bool isOpen() const;
+
+	// Longest a read waits for the first byte, in ms
+	bool setReadTimeout(int ms);
+	int readTimeout() const { return m_readTimeoutMs; }
+
+	int read(uint8_t *buffer, size_t size);
+	bool write(const uint8_t *data, size_t size);
+
+private:
+	SerialTransport(const SerialTransport &);
+	SerialTransport &operator=(const SerialTransport &);
+
+#ifdef _WIN32
+	void *m_handle;					// HANDLE
+#else
+	int m_fd;
+#endif
+	int m_readTimeoutMs;
+};
+
+#endif // SERIALTRANSPORT_H
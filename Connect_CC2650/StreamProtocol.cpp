@@ -0,0 +1,127 @@
+// StreamProtocol.cpp : encoding and decoding of the StreamServer wire format
+//
+
+#include "StreamProtocol.h"
+#include <algorithm>
+
+bool StreamSubscription::wants(uint16_t deviceId) const {
+	if (sensorMask == 0)
+		return false;
+	if (devices.empty())
+		return true;
+	return std::find(devices.begin(), devices.end(), deviceId) != devices.end();
+}
+
+static int sensorCount(uint8_t sensorMask) {
+	return ((sensorMask & IMU_GYRO) != 0) + ((sensorMask & IMU_ACC) != 0) + ((sensorMask & IMU_MAG) != 0);
+}
+
+size_t streamRecordSize(uint8_t sensorMask) {
+	return STREAM_RECORD_HEADER_SIZE + sensorCount(sensorMask) * 3 * sizeof(int16_t);
+}
+
+void encodeFrameHeader(uint8_t *dst, uint8_t type, uint32_t length) {
+	putU32(dst, length);
+	dst[4] = type;
+}
+
+size_t encodeSampleRecord(uint8_t *dst, const ImuSample &sample, uint8_t sensorMask) {
+	uint8_t *p = dst;
+	putU16(p, sample.deviceId);
+	p[2] = sensorMask;
+	putU64(p + 3, sample.timestamp);
+	p += STREAM_RECORD_HEADER_SIZE;
+
+	// the three sensor groups are stored in axis order, three axes each
+	for (int sensor = 0; sensor < 3; sensor++) {
+		if (!(sensorMask & (1 << sensor)))
+			continue;
+		for (int a = 0; a < 3; a++) {
+			putU16(p, (uint16_t)sample.axis[sensor * 3 + a]);
+			p += 2;
+		}
+	}
+	return p - dst;
+}
+
+std::vector<uint8_t> encodeSubscribe(const StreamSubscription &subscription) {
+	size_t count = std::min(subscription.devices.size(), STREAM_MAX_SUBSCRIBE_DEVICES);
+	std::vector<uint8_t> frame(STREAM_HEADER_SIZE + 3 + count * 2);
+
+	encodeFrameHeader(&frame[0], STREAM_MSG_SUBSCRIBE, (uint32_t)(frame.size() - STREAM_HEADER_SIZE));
+	frame[STREAM_HEADER_SIZE] = subscription.sensorMask;
+	putU16(&frame[STREAM_HEADER_SIZE + 1], (uint16_t)count);
+	for (size_t i = 0; i < count; i++)
+		putU16(&frame[STREAM_HEADER_SIZE + 3 + i * 2], subscription.devices[i]);
+	return frame;
+}
+
+long parseFrame(const uint8_t *buf, size_t len, uint8_t &type, const uint8_t *&payload, uint32_t &payloadLength) {
+	if (len < STREAM_HEADER_SIZE)
+		return 0;
+	uint32_t length = getU32(buf);
+	if (length > STREAM_MAX_FRAME)
+		return -1;
+	if (len < STREAM_HEADER_SIZE + length)
+		return 0;
+
+	type = buf[4];
+	payload = buf + STREAM_HEADER_SIZE;
+	payloadLength = length;
+	return (long)(STREAM_HEADER_SIZE + length);
+}
+
+bool decodeSubscribe(const uint8_t *payload, uint32_t length, StreamSubscription &subscription) {
+	if (length < 3)
+		return false;
+	uint16_t count = getU16(payload + 1);
+	if (count > STREAM_MAX_SUBSCRIBE_DEVICES || length != 3u + count * 2u)
+		return false;
+
+	subscription.sensorMask = payload[0] & IMU_ALL;
+	subscription.devices.resize(count);
+	for (uint16_t i = 0; i < count; i++)
+		subscription.devices[i] = getU16(payload + 3 + i * 2);
+	return true;
+}
+
+long decodeSampleBatch(const uint8_t *payload, uint32_t length, ImuSample *out, uint8_t *masks, size_t maxSamples) {
+	if (length < STREAM_BATCH_HEADER_SIZE)
+		return -1;
+	uint16_t count = getU16(payload);
+	const uint8_t *p = payload + STREAM_BATCH_HEADER_SIZE;
+	const uint8_t *end = payload + length;
+	size_t n = 0;
+
+	for (uint16_t r = 0; r < count; r++) {
+		if (end - p < (long)STREAM_RECORD_HEADER_SIZE)
+			return -1;
+		uint8_t mask = p[2] & IMU_ALL;
+		size_t size = streamRecordSize(mask);
+		if ((size_t)(end - p) < size)
+			return -1;
+
+		if (n < maxSamples) {
+			ImuSample &s = out[n];
+			s.deviceId = getU16(p);
+			s.timestamp = getU64(p + 3);
+			const uint8_t *a = p + STREAM_RECORD_HEADER_SIZE;
+			for (int sensor = 0; sensor < 3; sensor++) {
+				for (int i = 0; i < 3; i++) {
+					if (mask & (1 << sensor)) {
+						s.axis[sensor * 3 + i] = (int16_t)getU16(a);
+						a += 2;
+					}
+					else {
+						s.axis[sensor * 3 + i] = 0;
+					}
+				}
+			}
+			if (masks)
+				masks[n] = mask;
+			n++;
+		}
+		p += size;
+	}
+	return (long)n;
+}
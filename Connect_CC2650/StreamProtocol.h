@@ -0,0 +1,87 @@
+// StreamProtocol.h : binary wire format used by StreamServer
+//
+
+#ifndef STREAMPROTOCOL_H
+#define STREAMPROTOCOL_H
+
+#include "ImuSample.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Every message, over TCP, UDP or the Unix socket, is one frame:
+
+	uint32 length		number of bytes following the 5-byte header
+	uint8  type			STREAM_MSG_...
+	       payload[length]
+
+All integers are little endian.
+
+STREAM_MSG_SAMPLES (server -> client), a batch of samples:
+	uint16 count
+	count records of
+		uint16 deviceId
+		uint8  sensorMask		IMU_GYRO | IMU_ACC | IMU_MAG
+		uint64 timestamp		microseconds since the Unix epoch
+		int16  axes[3 per bit set in sensorMask]	(Gyro, then Acc, then Mag)
+
+STREAM_MSG_SUBSCRIBE (client -> server), replaces the client's subscription:
+	uint8  sensorMask			0 unsubscribes (UDP clients are forgotten)
+	uint16 deviceCount			0 means every device
+	uint16 deviceIds[deviceCount]
+
+A new TCP/Unix client is subscribed to everything until it sends STREAM_MSG_SUBSCRIBE.
+A UDP client has to send one to be known by the server at all.
+*/
+
+const uint8_t STREAM_MSG_SAMPLES   = 0x01;
+const uint8_t STREAM_MSG_SUBSCRIBE = 0x02;
+
+const size_t STREAM_HEADER_SIZE       = 5;
+const size_t STREAM_BATCH_HEADER_SIZE = 2;
+const size_t STREAM_RECORD_HEADER_SIZE = 11;
+const size_t STREAM_MAX_SUBSCRIBE_DEVICES = 256;
+const size_t STREAM_MAX_FRAME = 65536;	// larger frames are treated as a protocol error
+
+struct StreamSubscription {
+	uint8_t sensorMask;
+	std::vector<uint16_t> devices;		// empty: all devices
+
+	StreamSubscription() : sensorMask(IMU_ALL) {}
+	bool wants(uint16_t deviceId) const;
+};
+
+// Size of one sample record carrying the sensors in sensorMask
+size_t streamRecordSize(uint8_t sensorMask);
+
+// Little endian helpers shared by the encoders
+inline void putU16(uint8_t *dst, uint16_t v) { dst[0] = (uint8_t)v; dst[1] = (uint8_t)(v >> 8); }
+inline void putU32(uint8_t *dst, uint32_t v) { putU16(dst, (uint16_t)v); putU16(dst + 2, (uint16_t)(v >> 16)); }
+inline void putU64(uint8_t *dst, uint64_t v) { putU32(dst, (uint32_t)v); putU32(dst + 4, (uint32_t)(v >> 32)); }
+inline uint16_t getU16(const uint8_t *src) { return (uint16_t)(src[0] | (src[1] << 8)); }
+inline uint32_t getU32(const uint8_t *src) { return getU16(src) | ((uint32_t)getU16(src + 2) << 16); }
+inline uint64_t getU64(const uint8_t *src) { return getU32(src) | ((uint64_t)getU32(src + 4) << 32); }
+
+// Writes the frame header; length is the payload size
+void encodeFrameHeader(uint8_t *dst, uint8_t type, uint32_t length);
+
+// Appends one sample record to dst (which must hold streamRecordSize(sensorMask) bytes)
+size_t encodeSampleRecord(uint8_t *dst, const ImuSample &sample, uint8_t sensorMask);
+
+// Builds a complete SUBSCRIBE frame
+std::vector<uint8_t> encodeSubscribe(const StreamSubscription &subscription);
+
+/* Splits a byte stream into frames. Returns the number of bytes of the frame
+   at the start of buf, 0 if the frame is not complete yet, or -1 if the data
+   is not a valid frame. */
+long parseFrame(const uint8_t *buf, size_t len, uint8_t &type, const uint8_t *&payload, uint32_t &payloadLength);
+
+bool decodeSubscribe(const uint8_t *payload, uint32_t length, StreamSubscription &subscription);
+
+/* Decodes a SAMPLES payload. Axes of sensors that are not in a record's mask
+   are set to 0; masks[] (optional) receives each record's sensorMask.
+   Returns the number of samples written to out, or -1 on a malformed payload. */
+long decodeSampleBatch(const uint8_t *payload, uint32_t length, ImuSample *out, uint8_t *masks, size_t maxSamples);
+
+#endif // STREAMPROTOCOL_H
@@ -0,0 +1,533 @@
+// StreamServer.cpp : non-blocking TCP/UDP/Unix socket server for decoded samples
+//
+
+#include "StreamServer.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define INVALID_STREAM_SOCKET INVALID_SOCKET
+#define SEND_FLAGS 0
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define INVALID_STREAM_SOCKET (-1)
+#define SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+enum EndpointKind {
+	KIND_TCP_LISTENER,
+	KIND_UNIX_LISTENER,
+	KIND_UDP_SOCKET,
+	KIND_STREAM_CLIENT,		// accepted TCP or Unix connection
+	KIND_DATAGRAM_CLIENT	// UDP peer, sends through the shared UDP socket
+};
+
+struct StreamServer::Endpoint {
+	stream_socket_t fd;
+	EndpointKind kind;
+	sockaddr_storage addr;			// UDP peer address
+	socklen_t addrLen;
+	StreamSubscription subscription;
+
+	std::vector<uint8_t> batch;		// packet being filled by publish()
+	uint16_t batchCount;
+	std::vector<uint8_t> queue;		// frames waiting to be sent, starting at queueHead
+	size_t queueHead;
+	std::vector<uint8_t> rx;		// partial incoming frame
+	bool writeInterest;
+	bool dead;
+
+	Endpoint(stream_socket_t s, EndpointKind k)
+		: fd(s), kind(k), addrLen(0), batchCount(0), queueHead(0), writeInterest(false), dead(false) {
+		memset(&addr, 0, sizeof(addr));
+	}
+};
+
+static void closeSocket(stream_socket_t s) {
+#ifdef _WIN32
+	closesocket(s);
+#else
+	::close(s);
+#endif
+}
+
+static bool setNonBlocking(stream_socket_t s) {
+#ifdef _WIN32
+	u_long on = 1;
+	return ioctlsocket(s, FIONBIO, &on) == 0;
+#else
+	int flags = fcntl(s, F_GETFL, 0);
+	return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static bool wouldBlock() {
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static void removeSocketFile(const std::string &path) {
+#ifdef _WIN32
+	DeleteFileA(path.c_str());
+#else
+	unlink(path.c_str());
+#endif
+}
+
+StreamServer::StreamServer()
+	: m_open(false), m_tcpPort(-1), m_udpPort(-1), m_pollFd(-1), m_udp(0) {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+StreamServer::~StreamServer() {
+	close();
+}
+
+bool StreamServer::fail(const char *what) {
+#ifdef _WIN32
+	int err = WSAGetLastError();
+#else
+	int err = errno;
+#endif
+	m_lastError = std::string(what) + " failed with error " + std::to_string(err);
+	close();
+	return false;
+}
+
+bool StreamServer::open(const StreamServerConfig &config) {
+	close();
+	m_config = config;
+	if (m_config.batchSize == 0)
+		m_config.batchSize = 1;
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return fail("WSAStartup");
+#else
+	m_pollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_pollFd < 0)
+		return fail("epoll_create1");
+#endif
+	m_open = true;
+
+	sockaddr_in inAddr;
+	memset(&inAddr, 0, sizeof(inAddr));
+	inAddr.sin_family = AF_INET;
+	if (inet_pton(AF_INET, m_config.bindAddress.c_str(), &inAddr.sin_addr) != 1) {
+		m_lastError = "invalid bind address " + m_config.bindAddress;
+		close();
+		return false;
+	}
+
+	if (m_config.tcpPort >= 0) {
+		stream_socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+		if (s == INVALID_STREAM_SOCKET)
+			return fail("TCP socket");
+		int on = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+		inAddr.sin_port = htons((unsigned short)m_config.tcpPort);
+		if (bind(s, (sockaddr *)&inAddr, sizeof(inAddr)) != 0 || listen(s, 16) != 0 || !setNonBlocking(s)) {
+			closeSocket(s);
+			return fail("TCP bind/listen");
+		}
+		socklen_t len = sizeof(inAddr);
+		getsockname(s, (sockaddr *)&inAddr, &len);
+		m_tcpPort = ntohs(inAddr.sin_port);
+		if (!addEndpoint(new Endpoint(s, KIND_TCP_LISTENER)))
+			return fail("epoll_ctl");
+	}
+
+	if (m_config.udpPort >= 0) {
+		stream_socket_t s = socket(AF_INET, SOCK_DGRAM, 0);
+		if (s == INVALID_STREAM_SOCKET)
+			return fail("UDP socket");
+		inAddr.sin_port = htons((unsigned short)m_config.udpPort);
+		if (bind(s, (sockaddr *)&inAddr, sizeof(inAddr)) != 0 || !setNonBlocking(s)) {
+			closeSocket(s);
+			return fail("UDP bind");
+		}
+		socklen_t len = sizeof(inAddr);
+		getsockname(s, (sockaddr *)&inAddr, &len);
+		m_udpPort = ntohs(inAddr.sin_port);
+		m_udp = new Endpoint(s, KIND_UDP_SOCKET);
+		if (!addEndpoint(m_udp))
+			return fail("epoll_ctl");
+	}
+
+	if (!m_config.unixPath.empty()) {
+		sockaddr_un unAddr;
+		memset(&unAddr, 0, sizeof(unAddr));
+		unAddr.sun_family = AF_UNIX;
+		if (m_config.unixPath.size() >= sizeof(unAddr.sun_path)) {
+			m_lastError = "Unix socket path too long: " + m_config.unixPath;
+			close();
+			return false;
+		}
+		strcpy(unAddr.sun_path, m_config.unixPath.c_str());
+
+		stream_socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s == INVALID_STREAM_SOCKET)
+			return fail("Unix socket");
+		removeSocketFile(m_config.unixPath);		// left over from a previous run
+		if (bind(s, (sockaddr *)&unAddr, sizeof(unAddr)) != 0 || listen(s, 16) != 0 || !setNonBlocking(s)) {
+			closeSocket(s);
+			return fail("Unix socket bind/listen");
+		}
+		if (!addEndpoint(new Endpoint(s, KIND_UNIX_LISTENER)))
+			return fail("epoll_ctl");
+	}
+	return true;
+}
+
+void StreamServer::close() {
+	for (size_t i = 0; i < m_clients.size(); i++)
+		destroy(m_clients[i]);
+	m_clients.clear();
+
+	for (size_t i = 0; i < m_listeners.size(); i++) {
+		if (m_listeners[i]->kind == KIND_UNIX_LISTENER)
+			removeSocketFile(m_config.unixPath);
+		destroy(m_listeners[i]);
+	}
+	m_listeners.clear();
+	m_udp = 0;
+
+#ifdef _WIN32
+	if (m_open)
+		WSACleanup();
+#else
+	if (m_pollFd >= 0)
+		::close(m_pollFd);
+	m_pollFd = -1;
+#endif
+	m_open = false;
+	m_tcpPort = -1;
+	m_udpPort = -1;
+}
+
+void StreamServer::destroy(Endpoint *e) {
+	// datagram clients only borrow the UDP socket
+	if (e->kind != KIND_DATAGRAM_CLIENT)
+		closeSocket(e->fd);
+	delete e;
+}
+
+bool StreamServer::addEndpoint(Endpoint *e) {
+	bool listener = e->kind != KIND_STREAM_CLIENT;
+	if (listener)
+		m_listeners.push_back(e);
+	else
+		m_clients.push_back(e);
+#ifndef _WIN32
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = e;
+	if (epoll_ctl(m_pollFd, EPOLL_CTL_ADD, e->fd, &ev) != 0)
+		return false;
+#endif
+	return true;
+}
+
+void StreamServer::setWriteInterest(Endpoint *e, bool enable) {
+	if (e->writeInterest == enable)
+		return;
+	e->writeInterest = enable;
+#ifndef _WIN32
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (enable ? (uint32_t)EPOLLOUT : 0u);
+	ev.data.ptr = e;
+	epoll_ctl(m_pollFd, EPOLL_CTL_MOD, e->fd, &ev);
+#endif
+}
+
+void StreamServer::publish(const ImuSample &sample) {
+	m_stats.samplesPublished++;
+	for (size_t i = 0; i < m_clients.size(); i++) {
+		Endpoint *c = m_clients[i];
+		if (!c->dead && c->subscription.wants(sample.deviceId))
+			appendSample(c, sample);
+	}
+	reapClients();
+}
+
+void StreamServer::appendSample(Endpoint *c, const ImuSample &sample) {
+	uint8_t mask = c->subscription.sensorMask;
+	if (c->batchCount == 0)
+		c->batch.resize(STREAM_HEADER_SIZE + STREAM_BATCH_HEADER_SIZE);
+
+	size_t offset = c->batch.size();
+	c->batch.resize(offset + streamRecordSize(mask));
+	encodeSampleRecord(&c->batch[offset], sample, mask);
+	c->batchCount++;
+
+	if (c->batchCount >= m_config.batchSize)
+		finishBatch(c);
+}
+
+void StreamServer::finishBatch(Endpoint *c) {
+	if (c->batchCount == 0)
+		return;
+	encodeFrameHeader(&c->batch[0], STREAM_MSG_SAMPLES, (uint32_t)(c->batch.size() - STREAM_HEADER_SIZE));
+	putU16(&c->batch[STREAM_HEADER_SIZE], c->batchCount);
+
+	if (c->kind == KIND_DATAGRAM_CLIENT) {
+		// UDP is fire and forget: a full socket buffer just loses this packet
+		int sent = sendto(m_udp->fd, (const char *)&c->batch[0], (int)c->batch.size(), 0, (sockaddr *)&c->addr, c->addrLen);
+		if (sent == (int)c->batch.size())
+			m_stats.packetsSent++;
+		else
+			m_stats.packetsDropped++;
+	}
+	else if (c->queue.size() - c->queueHead + c->batch.size() > m_config.maxQueueBytes) {
+		m_stats.packetsDropped++;		// slow client, never hold back acquisition for it
+	}
+	else {
+		if (c->queueHead == c->queue.size()) {
+			c->queue.clear();
+			c->queueHead = 0;
+		}
+		c->queue.insert(c->queue.end(), c->batch.begin(), c->batch.end());
+		m_stats.packetsSent++;
+		sendQueued(c);
+	}
+	c->batch.clear();
+	c->batchCount = 0;
+}
+
+void StreamServer::sendQueued(Endpoint *c) {
+	while (c->queueHead < c->queue.size()) {
+		int n = send(c->fd, (const char *)&c->queue[c->queueHead], (int)(c->queue.size() - c->queueHead), SEND_FLAGS);
+		if (n > 0) {
+			c->queueHead += n;
+			continue;
+		}
+		if (n < 0 && wouldBlock()) {
+			setWriteInterest(c, true);
+			// drop the sent part once it is at least half of the buffer
+			if (c->queueHead > c->queue.size() / 2) {
+				c->queue.erase(c->queue.begin(), c->queue.begin() + c->queueHead);
+				c->queueHead = 0;
+			}
+			return;
+		}
+		c->dead = true;
+		return;
+	}
+	c->queue.clear();
+	c->queueHead = 0;
+	setWriteInterest(c, false);
+}
+
+void StreamServer::flush() {
+	for (size_t i = 0; i < m_clients.size(); i++) {
+		if (!m_clients[i]->dead)
+			finishBatch(m_clients[i]);
+	}
+	reapClients();
+}
+
+void StreamServer::reapClients() {
+	size_t kept = 0;
+	for (size_t i = 0; i < m_clients.size(); i++) {
+		Endpoint *c = m_clients[i];
+		if (c->dead) {
+#ifndef _WIN32
+			if (c->kind == KIND_STREAM_CLIENT)
+				epoll_ctl(m_pollFd, EPOLL_CTL_DEL, c->fd, 0);
+#endif
+			destroy(c);
+			m_stats.clientsClosed++;
+		}
+		else {
+			m_clients[kept++] = c;
+		}
+	}
+	m_clients.resize(kept);
+}
+
+void StreamServer::acceptClients(Endpoint *listener) {
+	for (;;) {
+		stream_socket_t s = accept(listener->fd, 0, 0);
+		if (s == INVALID_STREAM_SOCKET)
+			return;
+		if (m_clients.size() >= m_config.maxClients || !setNonBlocking(s)) {
+			closeSocket(s);
+			continue;
+		}
+		if (listener->kind == KIND_TCP_LISTENER) {
+			int on = 1;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+		}
+		Endpoint *c = new Endpoint(s, KIND_STREAM_CLIENT);
+		if (!addEndpoint(c))
+			c->dead = true;
+		else
+			m_stats.clientsAccepted++;
+	}
+}
+
+void StreamServer::receiveDatagrams(Endpoint *udp) {
+	uint8_t buf[STREAM_HEADER_SIZE + 3 + STREAM_MAX_SUBSCRIBE_DEVICES * 2];
+	for (;;) {
+		sockaddr_storage from;
+		socklen_t fromLen = sizeof(from);
+		int n = recvfrom(udp->fd, (char *)buf, sizeof(buf), 0, (sockaddr *)&from, &fromLen);
+		if (n < 0)
+			return;
+
+		uint8_t type;
+		const uint8_t *payload;
+		uint32_t length;
+		StreamSubscription subscription;
+		if (parseFrame(buf, n, type, payload, length) != n || type != STREAM_MSG_SUBSCRIBE ||
+			!decodeSubscribe(payload, length, subscription))
+			continue;
+
+		Endpoint *peer = 0;
+		for (size_t i = 0; i < m_clients.size(); i++) {
+			Endpoint *c = m_clients[i];
+			if (c->kind == KIND_DATAGRAM_CLIENT && c->addrLen == fromLen && memcmp(&c->addr, &from, fromLen) == 0)
+				peer = c;
+		}
+		if (subscription.sensorMask == 0) {
+			if (peer)
+				peer->dead = true;		// unsubscribe
+			continue;
+		}
+		if (!peer) {
+			if (m_clients.size() >= m_config.maxClients)
+				continue;
+			peer = new Endpoint(udp->fd, KIND_DATAGRAM_CLIENT);
+			memcpy(&peer->addr, &from, fromLen);
+			peer->addrLen = fromLen;
+			m_clients.push_back(peer);
+			m_stats.clientsAccepted++;
+		}
+		finishBatch(peer);				// records of the old mask must not mix with the new one
+		peer->subscription = subscription;
+	}
+}
+
+void StreamServer::receiveStream(Endpoint *c) {
+	uint8_t buf[512];
+	for (;;) {
+		int n = recv(c->fd, (char *)buf, sizeof(buf), 0);
+		if (n == 0 || (n < 0 && !wouldBlock())) {
+			c->dead = true;
+			return;
+		}
+		if (n < 0)
+			break;
+		c->rx.insert(c->rx.end(), buf, buf + n);
+	}
+
+	size_t used = 0;
+	for (;;) {
+		uint8_t type;
+		const uint8_t *payload;
+		uint32_t length;
+		long frame = parseFrame(c->rx.data() + used, c->rx.size() - used, type, payload, length);
+		if (frame < 0) {
+			c->dead = true;
+			return;
+		}
+		if (frame == 0)
+			break;
+		StreamSubscription subscription;
+		if (type == STREAM_MSG_SUBSCRIBE && decodeSubscribe(payload, length, subscription)) {
+			finishBatch(c);
+			c->subscription = subscription;
+		}
+		used += frame;
+	}
+	c->rx.erase(c->rx.begin(), c->rx.begin() + used);
+}
+
+int StreamServer::poll(int timeoutMs) {
+	if (!m_open)
+		return -1;
+
+	// collect ready endpoints first, handlers may add and remove clients
+	std::vector<Endpoint *> &readable = m_readable, &writable = m_writable;
+	readable.clear();
+	writable.clear();
+#ifdef _WIN32
+	std::vector<WSAPOLLFD> fds;
+	std::vector<Endpoint *> owners;
+	for (size_t i = 0; i < m_listeners.size(); i++) {
+		WSAPOLLFD p = { (SOCKET)m_listeners[i]->fd, POLLRDNORM, 0 };
+		fds.push_back(p);
+		owners.push_back(m_listeners[i]);
+	}
+	for (size_t i = 0; i < m_clients.size(); i++) {
+		if (m_clients[i]->kind != KIND_STREAM_CLIENT)
+			continue;
+		WSAPOLLFD p = { (SOCKET)m_clients[i]->fd, (SHORT)(POLLRDNORM | (m_clients[i]->writeInterest ? POLLWRNORM : 0)), 0 };
+		fds.push_back(p);
+		owners.push_back(m_clients[i]);
+	}
+	int n = WSAPoll(fds.data(), (ULONG)fds.size(), timeoutMs);
+	if (n < 0)
+		return -1;
+	for (size_t i = 0; i < fds.size(); i++) {
+		if (fds[i].revents & (POLLRDNORM | POLLHUP | POLLERR))
+			readable.push_back(owners[i]);
+		if (fds[i].revents & POLLWRNORM)
+			writable.push_back(owners[i]);
+	}
+#else
+	epoll_event events[64];
+	int n = epoll_wait(m_pollFd, events, 64, timeoutMs);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+	for (int i = 0; i < n; i++) {
+		Endpoint *e = (Endpoint *)events[i].data.ptr;
+		if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			readable.push_back(e);
+		if (events[i].events & EPOLLOUT)
+			writable.push_back(e);
+	}
+#endif
+
+	for (size_t i = 0; i < writable.size(); i++) {
+		if (!writable[i]->dead)
+			sendQueued(writable[i]);
+	}
+	for (size_t i = 0; i < readable.size(); i++) {
+		Endpoint *e = readable[i];
+		if (e->dead)
+			continue;
+		switch (e->kind) {
+		case KIND_TCP_LISTENER:
+		case KIND_UNIX_LISTENER:
+			acceptClients(e);
+			break;
+		case KIND_UDP_SOCKET:
+			receiveDatagrams(e);
+			break;
+		default:
+			receiveStream(e);
+			break;
+		}
+	}
+	reapClients();
+	return n;
+}
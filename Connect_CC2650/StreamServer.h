@@ -0,0 +1,108 @@
+// StreamServer.h : serves decoded samples to network clients
+//
+
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+#include "ImuSample.h"
+#include "StreamProtocol.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Publishes ImuSamples over TCP, UDP and a Unix domain socket using the format
+described in StreamProtocol.h.
+
+Everything runs in the caller's thread: publish() only appends to per-client
+batches and does non-blocking sends, poll() runs one pass of the event loop
+(epoll on Linux, WSAPoll on Windows). Every client has a bounded send queue;
+when a client does not keep up its packets are dropped, the acquisition loop
+never waits for it.
+
+Usage:
+	StreamServerConfig config;
+	StreamServer server;
+	if (!server.open(config)) cout << server.lastError();
+	...
+	server.publish(sample);		// for every decoded sample
+	server.poll(0);				// once per loop iteration
+*/
+
+#ifdef _WIN32
+typedef uintptr_t stream_socket_t;		// SOCKET
+#else
+typedef int stream_socket_t;
+#endif
+
+struct StreamServerConfig {
+	std::string bindAddress;	// IPv4 address for TCP and UDP ("127.0.0.1" for loopback only)
+	int tcpPort;				// -1 disables, 0 picks a free port (see StreamServer::tcpPort())
+	int udpPort;				// same as tcpPort
+	std::string unixPath;		// path of the Unix domain socket, empty disables
+	size_t batchSize;			// samples per packet
+	size_t maxQueueBytes;		// send queue limit per TCP/Unix client
+	size_t maxClients;
+
+	StreamServerConfig()
+		: bindAddress("0.0.0.0"), tcpPort(5760), udpPort(5761),
+		  batchSize(10), maxQueueBytes(64 * 1024), maxClients(32) {}
+};
+
+struct StreamServerStats {
+	uint64_t samplesPublished;
+	uint64_t packetsSent;
+	uint64_t packetsDropped;		// send queue full (or UDP send failed)
+	uint64_t clientsAccepted;
+	uint64_t clientsClosed;
+};
+
+class StreamServer {
+public:
+	StreamServer();
+	~StreamServer();
+
+	bool open(const StreamServerConfig &config);
+	void close();
+	bool isOpen() const { return m_open; }
+
+	void publish(const ImuSample &sample);
+	void flush();					// sends the batches that are not full yet
+	int poll(int timeoutMs);		// returns the number of handled events, -1 on error
+
+	int tcpPort() const { return m_tcpPort; }	// actually bound ports, -1 if disabled
+	int udpPort() const { return m_udpPort; }
+	size_t clientCount() const { return m_clients.size(); }
+	const StreamServerStats &stats() const { return m_stats; }
+	const std::string &lastError() const { return m_lastError; }
+
+private:
+	struct Endpoint;
+
+	bool fail(const char *what);
+	bool addEndpoint(Endpoint *e);
+	void setWriteInterest(Endpoint *e, bool enable);
+	void acceptClients(Endpoint *listener);
+	void receiveDatagrams(Endpoint *udp);
+	void receiveStream(Endpoint *client);
+	void appendSample(Endpoint *client, const ImuSample &sample);
+	void finishBatch(Endpoint *client);
+	void sendQueued(Endpoint *client);
+	void reapClients();
+	void destroy(Endpoint *e);
+
+	StreamServerConfig m_config;
+	bool m_open;
+	int m_tcpPort;
+	int m_udpPort;
+	int m_pollFd;					// epoll instance (Linux only)
+	std::vector<Endpoint *> m_listeners;	// TCP and Unix listeners, UDP socket
+	std::vector<Endpoint *> m_clients;
+	Endpoint *m_udp;
+	std::vector<Endpoint *> m_readable;		// ready lists of poll(), kept to avoid reallocation
+	std::vector<Endpoint *> m_writable;
+	StreamServerStats m_stats;
+	std::string m_lastError;
+};
+
+#endif // STREAMSERVER_H
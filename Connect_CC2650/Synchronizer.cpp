@@ -0,0 +1,263 @@
+// Synchronizer.cpp : aligns the samples of several tags on a common timeline
+//
+
+#include "Synchronizer.h"
+#include <cmath>
+
+// The clock fit uses the nominal period (and detects no gaps) for the first samples
+static const uint64_t MIN_FIT_SAMPLES = 32;
+// Fitted periods further than this from the nominal one are clamped
+static const double MAX_PERIOD_ERROR = 0.1;
+// Fraction of the jitter the envelope rises per sample, so it follows slow changes
+static const double ENVELOPE_RISE = 0.001;
+// Decay per sample of the jitter peak
+static const double PEAK_DECAY = 1.0 / 65536;
+// A change of the wall - monotonic offset beyond this is a step of the wall clock, not decode latency
+static const int64_t WALL_STEP_US = 100000;
+
+Synchronizer::Synchronizer(const SyncConfig &config, FrameCallback callback, void *context)
+	: m_config(config), m_callback(callback), m_context(context), m_started(false), m_wallOffset(0), m_nextTick(0), m_newest(0),
+	  m_seen(0), m_ready(0), m_frames(0), m_staleRows(0), m_gaps(0) {
+	if (m_config.tickUs == 0)
+		m_config.tickUs = 1;
+	if (m_config.nominalPeriodUs == 0)
+		m_config.nominalPeriodUs = m_config.tickUs;
+	if (m_config.ringSize < 2)
+		m_config.ringSize = 2;
+}
+
+void Synchronizer::reserveDevices(size_t count) {
+	if (count > 0)
+		device((uint16_t)(count - 1));
+}
+
+Synchronizer::Device &Synchronizer::device(uint16_t deviceId) {
+	if (deviceId >= m_devices.size()) {
+		size_t first = m_devices.size();
+		m_devices.resize(deviceId + 1);
+		m_rows.resize(deviceId + 1);
+		for (size_t i = first; i < m_devices.size(); i++) {
+			Device &d = m_devices[i];
+			d.seen = false;
+			d.firstArrival = 0;
+			d.index = 0;
+			d.weight = d.meanX = d.meanY = d.covXX = d.covXY = 0;
+			d.slope = (double)m_config.nominalPeriodUs;
+			d.intercept = 0;
+			d.envelope = 0;
+			d.excess = 0;
+			d.peak = 0;
+			d.ring.resize(m_config.ringSize);
+			d.head = 0;
+			d.count = 0;
+			d.latest = 0;
+		}
+	}
+	return m_devices[deviceId];
+}
+
+double Synchronizer::fit(Device &d, uint64_t arrival) {
+	bool restart = !d.seen;
+	if (!d.seen) {
+		d.seen = true;
+		d.firstArrival = arrival;
+		d.index = 0;
+	} else {
+		// A late arrival is either transport delay or lost samples. Delay stays
+		// within the jitter seen so far, so only arrivals later than that count as gaps.
+		double y = (double)(int64_t)(arrival - d.firstArrival);
+		double late = y - (d.intercept + d.slope * (d.index + 1) + d.envelope);
+		uint64_t skipped = 0;
+		if (d.index >= MIN_FIT_SAMPLES && late > d.peak + d.slope)
+			skipped = (uint64_t)floor((late - d.excess) / d.slope + 0.5);
+		d.index += 1 + skipped;
+		m_gaps += skipped;
+
+		// The skip count can be off by one, so the offset is refitted from here on;
+		// the covariances are kept: old and new segments share the slope.
+		if (skipped) {
+			d.weight = 0;
+			restart = true;
+		}
+	}
+
+	// exponentially weighted regression of arrival on index, centred for precision
+	double x = (double)d.index, y = (double)(int64_t)(arrival - d.firstArrival);
+	d.weight = m_config.forgetting * d.weight + 1;
+	if (restart) {
+		d.meanX = x;
+		d.meanY = y;
+	}
+	double dx = x - d.meanX;
+	d.meanX += dx / d.weight;
+	d.meanY += (y - d.meanY) / d.weight;
+	d.covXX = m_config.forgetting * d.covXX + dx * (x - d.meanX);
+	d.covXY = m_config.forgetting * d.covXY + dx * (y - d.meanY);
+
+	double nominal = (double)m_config.nominalPeriodUs;
+	double slope = nominal;
+	if (d.index >= MIN_FIT_SAMPLES && d.covXX > 0)
+		slope = d.covXY / d.covXX;
+	if (slope < nominal * (1 - MAX_PERIOD_ERROR))
+		slope = nominal * (1 - MAX_PERIOD_ERROR);
+	if (slope > nominal * (1 + MAX_PERIOD_ERROR))
+		slope = nominal * (1 + MAX_PERIOD_ERROR);
+	d.slope = slope;
+	d.intercept = d.meanY - slope * d.meanX;
+
+	// arrivals are never early: the fastest ones are closest to the sample time
+	double residual = y - (d.intercept + slope * x);
+	if (restart || residual < d.envelope) {
+		d.envelope = residual;
+	} else {
+		double above = residual - d.envelope;
+		d.excess += (above - d.excess) / 16;
+		d.peak = above > d.peak ? above : d.peak * (1 - PEAK_DECAY);
+		d.envelope += d.excess * ENVELOPE_RISE;
+	}
+
+	return (double)d.firstArrival + d.intercept + slope * x + d.envelope;
+}
+
+uint64_t Synchronizer::tickAfter(uint64_t time) const {
+	// whole ticks of wall time
+	uint64_t wall = time + m_wallOffset;
+	return (wall / m_config.tickUs + 1) * m_config.tickUs - m_wallOffset;
+}
+
+void Synchronizer::push(const ImuSample &sample, uint64_t arrivalUs) {
+	Device &d = device(sample.deviceId);
+	bool first = !d.seen;
+	double previous = d.latest;
+	double time = fit(d, arrivalUs);
+	if (d.count > 0 && time <= d.latest)
+		time = d.latest + 1;		// the fit moved back: keep the ring ordered
+
+	uint64_t wallOffset = sample.timestamp - arrivalUs;
+	if (!m_started) {
+		m_started = true;
+		m_wallOffset = wallOffset;
+		m_nextTick = tickAfter((uint64_t)time);
+	}
+	else if ((int64_t)(wallOffset - m_wallOffset) > WALL_STEP_US || (int64_t)(m_wallOffset - wallOffset) > WALL_STEP_US) {
+		// the wall clock was stepped: the frames follow it, on its whole ticks again
+		m_wallOffset = wallOffset;
+		m_nextTick = tickAfter(m_nextTick - 1);
+		m_ready = 0;
+		for (size_t i = 0; i < m_devices.size(); i++)
+			if (m_devices[i].count > 0 && m_devices[i].latest >= (double)m_nextTick)
+				m_ready++;
+	}
+
+	size_t capacity = d.ring.size();
+	if (d.count == capacity) {
+		d.head = (d.head + 1) % capacity;		// a lagging device holds the ticks back: drop the oldest
+		d.count--;
+	}
+	Entry &entry = d.ring[(d.head + d.count) % capacity];
+	entry.time = time;
+	for (int a = 0; a < IMU_AXES; a++)
+		entry.axis[a] = sample.axis[a];
+	d.count++;
+	d.latest = time;
+
+	if (time > m_newest)
+		m_newest = time;
+	if (first) {
+		m_seen++;
+		if (time >= (double)m_nextTick)
+			m_ready++;
+	} else if (previous < (double)m_nextTick && time >= (double)m_nextTick) {
+		m_ready++;
+	}
+
+	poll(arrivalUs);
+}
+
+void Synchronizer::poll(uint64_t nowUs) {
+	if (!m_started)
+		return;
+	for (;;) {
+		if (m_ready < m_seen) {
+			if (nowUs < m_nextTick + m_config.maxWaitUs)
+				return;
+			if (m_newest < (double)m_nextTick) {
+				// no device has anything for this tick: skip to where waiting starts again
+				m_nextTick = tickAfter(nowUs - m_config.maxWaitUs);
+				m_ready = 0;
+				return;
+			}
+		}
+		emit(m_nextTick);
+		m_nextTick += m_config.tickUs;
+	}
+}
+
+void Synchronizer::flush() {
+	while (m_started && (double)m_nextTick <= m_newest) {
+		emit(m_nextTick);
+		m_nextTick += m_config.tickUs;
+	}
+}
+
+void Synchronizer::emit(uint64_t tick) {
+	double t = (double)tick, next = (double)(tick + m_config.tickUs);
+	m_ready = 0;
+	for (size_t i = 0; i < m_devices.size(); i++) {
+		Device &d = m_devices[i];
+		SyncRow &row = m_rows[i];
+		if (d.count > 0 && d.latest >= next)
+			m_ready++;
+		if (d.count == 0) {
+			for (int a = 0; a < IMU_AXES; a++)
+				row.axis[a] = 0;
+			row.flags = 0;
+			continue;
+		}
+
+		// keep the last entry at or before the tick, ticks only move forward
+		size_t capacity = d.ring.size();
+		while (d.count >= 2 && d.ring[(d.head + 1) % capacity].time <= t) {
+			d.head = (d.head + 1) % capacity;
+			d.count--;
+		}
+
+		const Entry &e0 = d.ring[d.head];
+		row.flags = SYNC_VALID;
+		if (d.count >= 2 && e0.time <= t && m_config.interpolate) {
+			const Entry &e1 = d.ring[(d.head + 1) % capacity];
+			double f = (t - e0.time) / (e1.time - e0.time);
+			for (int a = 0; a < IMU_AXES; a++)
+				row.axis[a] = (int16_t)floor(e0.axis[a] + f * (e1.axis[a] - e0.axis[a]) + 0.5);
+			row.flags |= SYNC_INTERPOLATED;
+		} else {
+			// before the next sample, or the device's first sample is after the tick
+			for (int a = 0; a < IMU_AXES; a++)
+				row.axis[a] = e0.axis[a];
+			if (d.latest < t) {
+				row.flags |= SYNC_STALE;
+				m_staleRows++;
+			}
+		}
+	}
+
+	SyncFrame frame;
+	frame.timestamp = tick + m_wallOffset;
+	frame.deviceCount = m_rows.size();
+	frame.rows = m_rows.data();
+	m_frames++;
+	m_callback(frame, m_context);
+}
+
+double Synchronizer::clockOffsetUs(uint16_t deviceId) const {
+	if (deviceId >= m_devices.size() || !m_devices[deviceId].seen)
+		return 0;
+	const Device &d = m_devices[deviceId];
+	return (double)(d.firstArrival + m_wallOffset) + d.intercept + d.envelope;
+}
+
+double Synchronizer::clockDriftPpm(uint16_t deviceId) const {
+	if (deviceId >= m_devices.size() || !m_devices[deviceId].seen)
+		return 0;
+	return (m_devices[deviceId].slope / (double)m_config.nominalPeriodUs - 1) * 1e6;
+}
@@ -0,0 +1,143 @@
+// Synchronizer.h : aligns the samples of several tags on a common timeline
+//
+
+#ifndef SYNCHRONIZER_H
+#define SYNCHRONIZER_H
+
+#include "ImuSample.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+A tag samples at a fixed period on its own clock, but its notifications arrive
+in bursts at BLE connection events, so arrival times are the sample times plus
+a varying (never negative) delay. For every device the synchronizer fits
+
+	arrival(n) ~ offset + period * n		(n = sample index, gaps detected)
+
+with exponentially weighted least squares, and shifts the line down to the
+lower envelope of the arrivals, so that the model gives the sample time in host
+microseconds without the transport jitter. period / nominal period - 1 is the
+drift of the tag's clock against the host.
+
+Arrivals are on a monotonic clock (syncMonotonicUs(), the read time of the
+batch): the wall clock can be stepped by NTP, which would break the fit or look
+like lost samples. The samples' wall timestamps only give the offset between
+the two clocks, applied to the frames as they are emitted; after a step of the
+wall clock the tick grid is moved so that frames stay on whole ticks of it.
+
+The corrected samples are kept in a small ring per device. Ticks are spaced
+tickUs apart. A tick T is emitted as soon as every device has a sample at or
+after T; each device's row is then linearly interpolated between its samples
+around T (or the one before T, with interpolate off). If a device lags, the tick
+is emitted anyway once the host clock is maxWaitUs past T, and that device's
+row holds its latest values, flagged SYNC_STALE. Emitting a tick is O(devices).
+
+	Synchronizer sync(config, onFrame, context);
+	sync.push(sample, syncMonotonicUs(batch.readTime));	// every decoded sample, emits the ready ticks
+	sync.poll(syncMonotonicUs());		// once per loop pass, emits the ticks past the max wait
+*/
+
+// Monotonic microseconds for push() and poll(): the steady clock, which NTP does not step
+inline uint64_t syncMonotonicUs(std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now()) {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+struct SyncConfig {
+	uint64_t tickUs;				// spacing of the merged frames
+	uint64_t nominalPeriodUs;		// the tags' configured period
+	uint64_t maxWaitUs;				// longest a tick waits for a lagging device
+	bool interpolate;				// else sample-and-hold
+	size_t ringSize;				// samples kept per device
+	double forgetting;				// weight decay per sample of the clock fit
+
+	SyncConfig()
+		: tickUs(100000), nominalPeriodUs(100000), maxWaitUs(250000), interpolate(true), ringSize(32), forgetting(0.9999) {}
+};
+
+enum SyncFlags {
+	SYNC_VALID = 1,					// the row holds data
+	SYNC_INTERPOLATED = 2,			// between two samples around the tick
+	SYNC_STALE = 4					// no sample at or after the tick (device lagging or gone)
+};
+
+struct SyncRow {
+	int16_t axis[IMU_AXES];
+	uint8_t flags;
+};
+
+struct SyncFrame {
+	uint64_t timestamp;				// tick time, host microseconds
+	size_t deviceCount;
+	const SyncRow *rows;			// by deviceId
+};
+
+class Synchronizer {
+public:
+	typedef void (*FrameCallback)(const SyncFrame &frame, void *context);
+
+	Synchronizer(const SyncConfig &config, FrameCallback callback, void *context);
+
+	// Devices are added when first seen; reserve them to keep push() allocation free
+	void reserveDevices(size_t count);
+
+	// arrivalUs and nowUs are monotonic; sample.timestamp is the wall time of the same arrival
+	void push(const ImuSample &sample, uint64_t arrivalUs);
+	void poll(uint64_t nowUs);
+	void flush();						// emits the ticks up to the newest sample, at shutdown
+
+	size_t deviceCount() const { return m_devices.size(); }
+	double clockOffsetUs(uint16_t deviceId) const;		// host time of the device's sample 0
+	double clockDriftPpm(uint16_t deviceId) const;		// against the host clock
+	uint64_t framesEmitted() const { return m_frames; }
+	uint64_t staleRows() const { return m_staleRows; }
+	uint64_t gaps() const { return m_gaps; }			// lost samples detected
+
+private:
+	struct Entry {
+		double time;					// corrected, monotonic microseconds
+		int16_t axis[IMU_AXES];
+	};
+
+	struct Device {
+		// clock fit, relative to the first arrival
+		bool seen;
+		uint64_t firstArrival;
+		uint64_t index;					// of the last sample
+		double weight, meanX, meanY;	// exponentially weighted, x = index, y = arrival - firstArrival
+		double covXX, covXY;
+		double slope, intercept;
+		double envelope;				// lower envelope of the residuals
+		double excess;					// mean residual above the envelope (jitter)
+		double peak;					// slowly decaying maximum of it
+		// corrected samples
+		std::vector<Entry> ring;
+		size_t head;					// oldest entry
+		size_t count;
+		double latest;					// time of the newest entry
+	};
+
+	Device &device(uint16_t deviceId);
+	double fit(Device &d, uint64_t arrival);
+	void emit(uint64_t tick);
+	uint64_t tickAfter(uint64_t time) const;	// first tick after a monotonic time
+
+	SyncConfig m_config;
+	FrameCallback m_callback;
+	void *m_context;
+	std::vector<Device> m_devices;
+	std::vector<SyncRow> m_rows;
+	bool m_started;
+	uint64_t m_wallOffset;				// wall - monotonic time, modulo 2^64
+	uint64_t m_nextTick;				// monotonic
+	double m_newest;					// newest corrected time of any device
+	size_t m_seen;						// devices with samples
+	size_t m_ready;						// of those, with a sample at or after m_nextTick
+	uint64_t m_frames;
+	uint64_t m_staleRows;
+	uint64_t m_gaps;
+};
+
+#endif // SYNCHRONIZER_H
@@ -0,0 +1,88 @@
+// Task.h : minimal C++20 coroutine task for the single-threaded HCI event loop
+//
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+/*
+A Task<T> is a lazily started coroutine returning T. Awaiting it starts it and
+resumes the awaiting coroutine when it finishes; the top-level task is started
+by HciEventLoop::run(). Errors are returned in T (a status code), exceptions
+terminate.
+
+	Task<HciResult> configure(GattDevice &dev) {
+		HciResult r = co_await dev.writeChar(0x3A, 0x01, 0x00);
+		if (!r.ok()) co_return r;
+		co_return co_await dev.writeChar(0x3C, 0x7F, 0x03);
+	}
+*/
+
+template <typename T>
+class Task {
+public:
+	struct promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+		std::coroutine_handle<> await_suspend(Handle h) noexcept {
+			std::coroutine_handle<> next = h.promise().continuation;
+			return next ? next : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	struct promise_type {
+		T value;
+		std::coroutine_handle<> continuation;
+
+		Task get_return_object() { return Task(Handle::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+		FinalAwaiter final_suspend() noexcept { return FinalAwaiter(); }
+		void return_value(T v) { value = std::move(v); }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	Task() {}
+	Task(Task &&other) noexcept : m_handle(other.m_handle) { other.m_handle = Handle(); }
+	Task &operator=(Task &&other) noexcept {
+		if (this != &other) {
+			destroy();
+			m_handle = other.m_handle;
+			other.m_handle = Handle();
+		}
+		return *this;
+	}
+	~Task() { destroy(); }
+
+	// Runs the task until its first suspension; used for top-level tasks
+	void start() { if (m_handle && !m_handle.done()) m_handle.resume(); }
+	bool done() const { return !m_handle || m_handle.done(); }
+	T &result() { return m_handle.promise().value; }
+
+	bool await_ready() const { return done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+		m_handle.promise().continuation = awaiting;
+		return m_handle;
+	}
+	T await_resume() { return std::move(m_handle.promise().value); }
+
+private:
+	explicit Task(Handle handle) : m_handle(handle) {}
+	Task(const Task &);
+	Task &operator=(const Task &);
+
+	void destroy() {
+		if (m_handle)
+			m_handle.destroy();
+		m_handle = Handle();
+	}
+
+	Handle m_handle;
+};
+
+#endif // TASK_H
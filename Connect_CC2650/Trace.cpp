@@ -0,0 +1,178 @@
+// Trace.cpp : per-sample span tracing, dumped as a Chrome / Perfetto JSON trace
+//
+
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+static std::atomic<bool> traceOn(false);
+static std::chrono::steady_clock::time_point traceEpoch;
+static size_t traceCapacity = 0;
+
+// Rings of all threads that ever registered; they are never freed, so a dump
+// still finds the events of threads that have ended
+static std::mutex registryMutex;
+static std::vector<TraceBuffer *> registry;
+static thread_local TraceBuffer *threadBuffer = 0;
+
+TraceBuffer::TraceBuffer(const char *threadName, uint32_t threadId, size_t capacity)
+	: m_threadName(threadName), m_threadId(threadId), m_pass(0), m_head(0) {
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	m_events.resize(size);
+	m_mask = size - 1;
+}
+
+void TraceBuffer::snapshot(std::vector<TraceEvent> &out) const {
+	uint64_t size = m_events.size();
+	uint64_t head = m_head.load(std::memory_order_acquire);
+	uint64_t first = head > size ? head - size : 0;
+	size_t start = out.size();
+	for (uint64_t i = first; i < head; i++)
+		out.push_back(m_events[i & m_mask]);
+
+	// the owner kept recording: slots it reached again during the copy are torn, drop them
+	// (+ 1: it may be writing the next slot without having published it). As in a seqlock,
+	// the fence keeps the copies above from moving after the second load.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t after = m_head.load(std::memory_order_relaxed) + 1;
+	uint64_t valid = after > size ? after - size : 0;
+	if (valid > first) {
+		size_t torn = (size_t)(valid - first < head - first ? valid - first : head - first);
+		out.erase(out.begin() + start, out.begin() + start + torn);
+	}
+}
+
+void traceStart(size_t eventsPerThread) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	if (registry.empty())
+		traceEpoch = std::chrono::steady_clock::now();
+	traceCapacity = eventsPerThread ? eventsPerThread : 1;
+	traceOn.store(true, std::memory_order_relaxed);
+}
+
+void traceStop() {
+	traceOn.store(false, std::memory_order_relaxed);
+}
+
+bool traceEnabled() {
+	return traceOn.load(std::memory_order_relaxed);
+}
+
+void traceRegisterThread(const char *name) {
+	if (threadBuffer || !traceEnabled())
+		return;
+	std::lock_guard<std::mutex> lock(registryMutex);
+	threadBuffer = new TraceBuffer(name, (uint32_t)registry.size() + 1, traceCapacity);
+	registry.push_back(threadBuffer);
+}
+
+uint64_t traceClock() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+TraceBuffer *traceThreadBuffer() {
+	return threadBuffer;
+}
+
+uint32_t traceNextPass() {
+	return threadBuffer ? threadBuffer->nextPass() : 0;
+}
+
+void traceSpan(const char *name, uint64_t start, uint64_t end, uint16_t device) {
+	TraceBuffer *buffer = threadBuffer;
+	if (!buffer || !traceEnabled())
+		return;
+	TraceEvent event;
+	event.start = start;
+	event.duration = end > start ? end - start : 0;
+	event.name = name;
+	event.pass = buffer->pass();
+	event.device = device;
+	buffer->record(event);
+}
+
+void traceInstant(const char *name, uint16_t device) {
+	TraceBuffer *buffer = threadBuffer;
+	if (!buffer || !traceEnabled())
+		return;
+	TraceEvent event;
+	event.start = traceClock();
+	event.duration = TRACE_INSTANT;
+	event.name = name;
+	event.pass = buffer->pass();
+	event.device = device;
+	buffer->record(event);
+}
+
+// Chrome traces count in microseconds: ns with three decimals
+static void writeMicros(FILE *file, uint64_t ns) {
+	fprintf(file, "%llu.%03u", (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+}
+
+static void writeString(FILE *file, const char *s) {
+	fputc('"', file);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*s >= 0x20)
+			fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+bool traceDump(const std::string &path, std::string &error) {
+	std::vector<TraceBuffer *> buffers;
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		buffers = registry;
+	}
+
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file) {
+		error = "cannot create " + path;
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Connect_CC2650\"}}");
+
+	std::vector<TraceEvent> events;
+	for (size_t b = 0; b < buffers.size(); b++) {
+		const TraceBuffer &buffer = *buffers[b];
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", buffer.threadId());
+		writeString(file, buffer.threadName().c_str());
+		fprintf(file, "}}");
+
+		events.clear();
+		buffer.snapshot(events);
+		for (size_t i = 0; i < events.size(); i++) {
+			const TraceEvent &e = events[i];
+			fprintf(file, ",\n{\"name\":");
+			writeString(file, e.name);
+			if (e.duration == TRACE_INSTANT) {
+				fprintf(file, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":");
+				writeMicros(file, e.start);
+			}
+			else {
+				fprintf(file, ",\"ph\":\"X\",\"ts\":");
+				writeMicros(file, e.start);
+				fprintf(file, ",\"dur\":");
+				writeMicros(file, e.duration);
+			}
+			fprintf(file, ",\"pid\":1,\"tid\":%u,\"args\":{\"pass\":%u", buffer.threadId(), e.pass);
+			if (e.device != TRACE_NO_DEVICE)
+				fprintf(file, ",\"device\":%u", e.device);
+			fprintf(file, "}}");
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool ok = !ferror(file);
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok)
+		error = "cannot write " + path;
+	return ok;
+}
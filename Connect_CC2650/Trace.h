@@ -0,0 +1,131 @@
+// Trace.h : per-sample span tracing, dumped as a Chrome / Perfetto JSON trace
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Every thread that traces owns a fixed ring of events, allocated by
+traceRegisterThread() before its loop starts; recording is then two clock
+reads and a store, with no lock and no allocation. Events of unregistered
+threads are dropped. A pass number groups the spans of one acquisition loop
+pass (one serial read and what was decoded from it), spans that belong to a
+tag also carry its device id.
+
+	traceStart(65536);
+	traceRegisterThread("acquisition");
+	...
+	traceNextPass();
+	{ TraceScope span("read"); port.read(...); }
+	{ TraceScope span("decode", sample.deviceId); ... }
+	...
+	traceDump("trace-1.json", error);		// any thread, while the others keep tracing
+
+The dump is the Chrome trace event JSON format; chrome://tracing and the
+Perfetto UI (ui.perfetto.dev) open it directly. Spans on one thread nest by
+time, so "decode" shows inside the "frame" span it ran in.
+*/
+
+const uint16_t TRACE_NO_DEVICE = 0xFFFF;
+const uint64_t TRACE_INSTANT = ~(uint64_t)0;		// duration of an instant event
+
+struct TraceEvent {
+	uint64_t start;					// ns since traceStart()
+	uint64_t duration;				// ns, or TRACE_INSTANT
+	const char *name;				// must outlive the trace: use string literals
+	uint32_t pass;
+	uint16_t device;
+};
+
+// Single-producer ring; snapshot() may run on another thread while the owner records
+class TraceBuffer {
+public:
+	TraceBuffer(const char *threadName, uint32_t threadId, size_t capacity);
+
+	void record(const TraceEvent &event) {
+		uint64_t head = m_head.load(std::memory_order_relaxed);
+		// the previous publish is visible before this slot is overwritten (snapshot() relies on it);
+		// free on x86, a barrier on weakly ordered CPUs
+		std::atomic_thread_fence(std::memory_order_release);
+		m_events[head & m_mask] = event;
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	// Appends the events still in the ring, oldest first
+	void snapshot(std::vector<TraceEvent> &out) const;
+
+	const std::string &threadName() const { return m_threadName; }
+	uint32_t threadId() const { return m_threadId; }
+	uint64_t recorded() const { return m_head.load(std::memory_order_acquire); }
+
+	// Pass of the owning thread, stamped on its events
+	uint32_t pass() const { return m_pass; }
+	uint32_t nextPass() { return ++m_pass; }
+
+private:
+	std::string m_threadName;
+	uint32_t m_threadId;
+	uint32_t m_pass;
+	std::vector<TraceEvent> m_events;
+	uint64_t m_mask;
+	std::atomic<uint64_t> m_head;	// events recorded so far
+};
+
+// Enables tracing; eventsPerThread is rounded up to a power of two
+void traceStart(size_t eventsPerThread);
+void traceStop();
+
+bool traceEnabled();
+
+// Gives the calling thread its ring (allocates: call it outside the hot path)
+void traceRegisterThread(const char *name);
+
+// ns since traceStart(), steady clock
+uint64_t traceClock();
+
+// The calling thread's ring, 0 when it is not registered
+TraceBuffer *traceThreadBuffer();
+
+// Starts the next pass of the calling thread, returns its number
+uint32_t traceNextPass();
+
+void traceSpan(const char *name, uint64_t start, uint64_t end, uint16_t device = TRACE_NO_DEVICE);
+void traceInstant(const char *name, uint16_t device = TRACE_NO_DEVICE);
+
+// Writes what all rings hold; false with error set if the file cannot be written
+bool traceDump(const std::string &path, std::string &error);
+
+// Records a span from construction to destruction, nothing when tracing is off
+class TraceScope {
+public:
+	explicit TraceScope(const char *name, uint16_t device = TRACE_NO_DEVICE)
+		: m_name(name), m_device(device), m_start(traceEnabled() ? traceClock() : 0), m_active(traceEnabled()) {}
+	~TraceScope() { end(); }
+
+	// Ends the span before the scope does
+	void end() {
+		if (m_active)
+			traceSpan(m_name, m_start, traceClock(), m_device);
+		m_active = false;
+	}
+	// Drops the span, e.g. a read that returned nothing
+	void cancel() { m_active = false; }
+	void setDevice(uint16_t device) { m_device = device; }
+
+private:
+	TraceScope(const TraceScope &);
+	TraceScope &operator=(const TraceScope &);
+
+	const char *m_name;
+	uint16_t m_device;
+	uint64_t m_start;
+	bool m_active;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,164 @@
+// cc2650.cpp : C interface of the SensorTag acquisition library
+//
+
+#include "cc2650.h"
+#include "DeviceManager.h"
+#include "SerialTransport.h"
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+// Samples are handed out without copying: both layouts must stay the same
+static_assert(sizeof(cc2650_sample) == sizeof(ImuSample), "cc2650_sample must match ImuSample");
+static_assert(offsetof(cc2650_sample, device_id) == offsetof(ImuSample, deviceId), "cc2650_sample must match ImuSample");
+static_assert(offsetof(cc2650_sample, timestamp) == offsetof(ImuSample, timestamp), "cc2650_sample must match ImuSample");
+static_assert(offsetof(cc2650_sample, axis) == offsetof(ImuSample, axis), "cc2650_sample must match ImuSample");
+static_assert(IMU_AXES == 9, "cc2650_sample must match ImuSample");
+
+struct cc2650_device {
+	SerialTransport port;
+	DeviceManager manager;
+	cc2650_batch_callback callback;
+	void *context;
+
+	cc2650_device() : manager(port), callback(0), context(0) {}
+};
+
+static void forwardBatch(const SampleBatch &batch, void *context) {
+	cc2650_device *device = (cc2650_device *)context;
+	device->callback((const cc2650_sample *)batch.samples, batch.count, device->context);
+}
+
+int cc2650_api_version(void) {
+	return CC2650_API_VERSION;
+}
+
+const char *cc2650_status_string(int status) {
+	switch (status) {
+	case CC2650_OK: return "success";
+	case CC2650_ERROR_ARGUMENT: return "invalid argument";
+	case CC2650_ERROR_OPEN: return "cannot open the serial port";
+	case CC2650_ERROR_TRANSPORT: return "serial port read failed";
+	case CC2650_ERROR_STATE: return "not allowed in this state";
+	case CC2650_ERROR_MEMORY: return "out of memory";
+	case HCI_STATUS_TIMEOUT: return "no response in time";
+	case HCI_STATUS_SEND_FAILED: return "serial port write failed";
+	case HCI_STATUS_ABORTED: return "aborted";
+	default: return status > 0 && status <= 0xFF ? "failure reported by the dongle or a tag" : "unknown status";
+	}
+}
+
+int cc2650_open(const char *port, cc2650_device **device) {
+	if (!device)
+		return CC2650_ERROR_ARGUMENT;
+	*device = 0;
+	if (!port)
+		return CC2650_ERROR_ARGUMENT;
+	cc2650_device *d = 0;
+	try {
+		d = new cc2650_device;			// the frame pool and the event loop allocate here
+		std::string error;
+		if (!d->port.open(port, error)) {
+			delete d;
+			return CC2650_ERROR_OPEN;
+		}
+	}
+	catch (const std::bad_alloc &) {
+		delete d;
+		return CC2650_ERROR_MEMORY;
+	}
+	*device = d;
+	return CC2650_OK;
+}
+
+int cc2650_connect(cc2650_device *device, const char *const *macs, size_t count) {
+	if (!device || !macs || count == 0)
+		return CC2650_ERROR_ARGUMENT;
+	if (device->manager.deviceCount() > 0)
+		return CC2650_ERROR_STATE;
+	try {
+		std::vector<std::string> list(count);
+		for (size_t i = 0; i < count; i++)
+			if (!macs[i] || !normaliseMac(macs[i], list[i]))
+				return CC2650_ERROR_ARGUMENT;
+		HciResult result = device->manager.initialize();
+		if (result.ok())
+			result = device->manager.connect(list);
+		if (!result.ok())
+			device->manager.disconnect();			// the links established so far
+		return result.status;
+	}
+	catch (const std::bad_alloc &) {
+		return CC2650_ERROR_MEMORY;
+	}
+}
+
+int cc2650_start(cc2650_device *device, unsigned period_ms, unsigned sensor_mask, int wake_on_motion) {
+	if (!device || period_ms < 100 || period_ms > 2550 || period_ms % 10 != 0 || (sensor_mask & ~CC2650_SENSOR_ALL))
+		return CC2650_ERROR_ARGUMENT;
+	if (device->manager.deviceCount() == 0)
+		return CC2650_ERROR_STATE;
+	try {
+		HciResult result = device->manager.enableMovement((uint8_t)(period_ms / 10));
+		if (result.ok())
+			result = device->manager.startMovement(movementConfig((uint8_t)sensor_mask, wake_on_motion != 0));
+		return result.status;
+	}
+	catch (const std::bad_alloc &) {
+		return CC2650_ERROR_MEMORY;
+	}
+}
+
+int cc2650_set_read_timeout(cc2650_device *device, int ms) {
+	if (!device || ms < 0)
+		return CC2650_ERROR_ARGUMENT;
+	return device->port.setReadTimeout(ms) ? CC2650_OK : CC2650_ERROR_TRANSPORT;
+}
+
+int cc2650_poll(cc2650_device *device, const cc2650_sample **samples, size_t *count) {
+	if (!device)
+		return CC2650_ERROR_ARGUMENT;
+	SampleBatch batch;
+	int n = device->manager.poll(batch);
+	if (samples)
+		*samples = (const cc2650_sample *)batch.samples;
+	if (count)
+		*count = n > 0 ? (size_t)n : 0;
+	return n < 0 ? CC2650_ERROR_TRANSPORT : CC2650_OK;
+}
+
+int cc2650_set_callback(cc2650_device *device, cc2650_batch_callback callback, void *context) {
+	if (!device)
+		return CC2650_ERROR_ARGUMENT;
+	device->callback = callback;
+	device->context = context;
+	device->manager.setBatchCallback(callback ? forwardBatch : 0, device);
+	return CC2650_OK;
+}
+
+size_t cc2650_device_count(const cc2650_device *device) {
+	return device ? device->manager.deviceCount() : 0;
+}
+
+int cc2650_stop(cc2650_device *device) {
+	if (!device)
+		return CC2650_ERROR_ARGUMENT;
+	if (device->manager.deviceCount() == 0)
+		return CC2650_ERROR_STATE;
+	try {
+		device->manager.disconnect();
+		return CC2650_OK;
+	}
+	catch (const std::bad_alloc &) {
+		return CC2650_ERROR_MEMORY;
+	}
+}
+
+void cc2650_close(cc2650_device *device) {
+	if (!device)
+		return;
+	if (device->manager.deviceCount() > 0)
+		cc2650_stop(device);
+	delete device;
+}
@@ -0,0 +1,112 @@
+/* cc2650.h : C interface of the SensorTag acquisition library (for C and FFI: ctypes, cffi, P/Invoke...)
+ */
+
+#ifndef CC2650_H
+#define CC2650_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+One handle per CC2540 dongle. Every call returns a status: CC2650_OK, a
+negative CC2650_ERROR_..., or a positive HCI status reported by the dongle or
+a tag (0xF0 timeout, ...: see HciAsync.h). cc2650_status_string() names them.
+No call throws and no call is thread safe: use a handle from one thread.
+
+	cc2650_device *dev;
+	const char *macs[] = { "a0e6f8aed204" };
+	if (cc2650_open("/dev/ttyACM0", &dev) != CC2650_OK) ...
+	cc2650_connect(dev, macs, 1);						// deviceId of a sample = index in macs
+	cc2650_start(dev, 100, CC2650_SENSOR_ALL, 0);
+	for (;;) {
+		const cc2650_sample *samples;
+		size_t count;
+		if (cc2650_poll(dev, &samples, &count) != CC2650_OK) break;
+		... samples[0 .. count), valid until the next poll ...
+	}
+	cc2650_close(dev);									// stops the tags if still connected
+
+cc2650_poll() reads once (waiting up to the read timeout, 100 ms by default)
+and decodes in place, without allocating. Instead of looking at the out
+parameters, a callback set with cc2650_set_callback() gets every non-empty
+batch during cc2650_poll().
+
+The layout of cc2650_sample, and every signature here, only changes with
+CC2650_API_VERSION.
+*/
+
+/* Only the functions below are exported from the shared library, everything else is hidden.
+   Link the static library (cc2650::static) for the C++ API; define CC2650_STATIC then on Windows. */
+#if defined(_WIN32)
+#if defined(CC2650_BUILDING)
+#define CC2650_API __declspec(dllexport)
+#elif defined(CC2650_STATIC)
+#define CC2650_API
+#else
+#define CC2650_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define CC2650_API __attribute__((visibility("default")))
+#else
+#define CC2650_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CC2650_API_VERSION 1
+
+/* Statuses below 0; the HCI statuses are 1..255 */
+#define CC2650_OK 0
+#define CC2650_ERROR_ARGUMENT -1		/* null handle or pointer, period or MAC address out of range */
+#define CC2650_ERROR_OPEN -2			/* the serial port cannot be opened or configured */
+#define CC2650_ERROR_TRANSPORT -3		/* a read from the serial port failed (dongle unplugged?) */
+#define CC2650_ERROR_STATE -4			/* not connected, or already connected */
+#define CC2650_ERROR_MEMORY -5
+
+/* cc2650_start() sensor mask, the same bits as ImuSensor */
+#define CC2650_SENSOR_GYRO 0x01
+#define CC2650_SENSOR_ACC 0x02
+#define CC2650_SENSOR_MAG 0x04
+#define CC2650_SENSOR_ALL 0x07
+
+/* Raw counts as the tag sends them: gx gy gz (deg/s * 131.072), ax ay az (G * 2048), mx my mz (uT) */
+typedef struct cc2650_sample {
+	uint16_t device_id;			/* index of the tag in the cc2650_connect() list */
+	uint64_t timestamp;			/* microseconds since the Unix epoch, taken on the host at decode */
+	int16_t axis[9];
+} cc2650_sample;
+
+typedef struct cc2650_device cc2650_device;
+
+typedef void (*cc2650_batch_callback)(const cc2650_sample *samples, size_t count, void *context);
+
+/* CC2650_API_VERSION the library was built with */
+CC2650_API int cc2650_api_version(void);
+CC2650_API const char *cc2650_status_string(int status);
+
+/* Opens the dongle's port (COM8, /dev/ttyACM0...); *device is 0 on failure */
+CC2650_API int cc2650_open(const char *port, cc2650_device **device);
+/* Initializes the dongle, finds the tags in one scan and links to each; addresses as in the
+   config file: a0e6f8aed204, A0:E6:F8:AE:D2:04 or A0-E6-F8-AE-D2-04 */
+CC2650_API int cc2650_connect(cc2650_device *device, const char *const *macs, size_t count);
+/* Notifications on, period (100..2550 ms, multiple of 10) and sensors; the samples start */
+CC2650_API int cc2650_start(cc2650_device *device, unsigned period_ms, unsigned sensor_mask, int wake_on_motion);
+/* Longest a poll waits for data in ms, 0: return at once (busy polling) */
+CC2650_API int cc2650_set_read_timeout(cc2650_device *device, int ms);
+/* The samples decoded by one read; *samples stays valid until the next poll or close */
+CC2650_API int cc2650_poll(cc2650_device *device, const cc2650_sample **samples, size_t *count);
+/* Batches also go to callback (0 removes it), called from within cc2650_poll() */
+CC2650_API int cc2650_set_callback(cc2650_device *device, cc2650_batch_callback callback, void *context);
+CC2650_API size_t cc2650_device_count(const cc2650_device *device);
+/* Movement sensor off and links terminated; cc2650_connect() may follow */
+CC2650_API int cc2650_stop(cc2650_device *device);
+/* Stops if still connected, closes the port and frees the handle */
+CC2650_API void cc2650_close(cc2650_device *device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CC2650_H */
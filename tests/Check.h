@@ -0,0 +1,34 @@
+// Check.h : minimal assertions for the tests (no framework: each test is one executable run by ctest)
+//
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+static int checkFailures = 0;
+
+// Reports a failed condition and goes on, so one run shows every failure
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			checkFailures++; \
+		} \
+	} while (0)
+
+// A file in the temporary directory, one name per test so that ctest -j can run them together
+inline std::string tempPath(const std::string &name) {
+	return (std::filesystem::temp_directory_path() / ("cc2650-test-" + name)).string();
+}
+
+// The test's exit code
+inline int checkResult() {
+	if (checkFailures)
+		fprintf(stderr, "%d check(s) failed\n", checkFailures);
+	return checkFailures ? 1 : 0;
+}
+
+#endif // CHECK_H
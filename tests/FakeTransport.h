@@ -0,0 +1,95 @@
+// FakeTransport.h : a scripted CC2540 dongle for the tests: records commands, replays canned events
+//
+
+#ifndef FAKETRANSPORT_H
+#define FAKETRANSPORT_H
+
+#include "HciAsync.h"
+#include "HciFramer.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+/*
+Events are queued as raw bytes and handed out by read(), at most chunk bytes at
+a time, so a test can split frames across reads. Every command written is kept;
+with autoStatus each one is acknowledged with a successful command status, and
+respond() may queue the events that complete it. Once the queue is reserved,
+read() and queueing do not allocate.
+*/
+
+class FakeTransport : public HciTransport {
+public:
+	FakeTransport() : autoStatus(true), chunk(4096), m_readPos(0) {}
+
+	int read(uint8_t *buffer, size_t size) {
+		size_t n = std::min(std::min(size, chunk), m_bytes.size() - m_readPos);
+		if (n > 0)
+			memcpy(buffer, m_bytes.data() + m_readPos, n);
+		m_readPos += n;
+		if (m_readPos == m_bytes.size()) {
+			m_bytes.clear();				// keeps the capacity
+			m_readPos = 0;
+		}
+		return (int)n;
+	}
+
+	bool write(const uint8_t *data, size_t size) {
+		commands.push_back(std::vector<uint8_t>(data, data + size));
+		uint16_t opcode = (uint16_t)(data[1] | (data[2] << 8));
+		if (autoStatus)
+			commandStatus(opcode, HCI_SUCCESS);
+		if (respond)
+			respond(*this, opcode, data + 4, size - 4);
+		return true;
+	}
+
+	void reserve(size_t bytes) { m_bytes.reserve(bytes); }
+	size_t pending() const { return m_bytes.size() - m_readPos; }
+
+	void raw(const uint8_t *data, size_t size) { m_bytes.insert(m_bytes.end(), data, data + size); }
+
+	// 04 FF length eventLo eventHi params...
+	void event(uint16_t id, const uint8_t *params, size_t length) {
+		const uint8_t header[] = { HCI_EVENT_PACKET, HCI_VENDOR_EVENT, (uint8_t)(length + 2), (uint8_t)id, (uint8_t)(id >> 8) };
+		raw(header, sizeof(header));
+		raw(params, length);
+	}
+	void event(uint16_t id, std::initializer_list<uint8_t> params) { event(id, params.begin(), params.size()); }
+
+	void commandStatus(uint16_t opcode, uint8_t status) {
+		event(GAP_HCI_COMMAND_STATUS, { status, (uint8_t)opcode, (uint8_t)(opcode >> 8), 0x00 });
+	}
+
+	// ATT_HandleValueNotification of the movement characteristic
+	void notification(uint16_t connHandle, const int16_t axis[IMU_AXES]) {
+		uint8_t params[6 + 2 * IMU_AXES] = { HCI_SUCCESS, (uint8_t)connHandle, (uint8_t)(connHandle >> 8), 2 + 2 * IMU_AXES,
+											 (uint8_t)MOVEMENT_DATA_HANDLE, (uint8_t)(MOVEMENT_DATA_HANDLE >> 8) };
+		for (int a = 0; a < IMU_AXES; a++) {
+			params[6 + 2 * a] = (uint8_t)axis[a];
+			params[7 + 2 * a] = (uint8_t)((uint16_t)axis[a] >> 8);
+		}
+		event(ATT_HANDLE_VALUE_NOTIFICATION, params, sizeof(params));
+	}
+
+	// Commands with this opcode written so far
+	size_t count(uint16_t opcode) const {
+		size_t n = 0;
+		for (size_t i = 0; i < commands.size(); i++)
+			if ((commands[i][1] | (commands[i][2] << 8)) == opcode)
+				n++;
+		return n;
+	}
+
+	bool autoStatus;
+	size_t chunk;
+	std::vector<std::vector<uint8_t> > commands;
+	std::function<void(FakeTransport &, uint16_t opcode, const uint8_t *params, size_t length)> respond;
+
+private:
+	std::vector<uint8_t> m_bytes;
+	size_t m_readPos;
+};
+
+#endif // FAKETRANSPORT_H
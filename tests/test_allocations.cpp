@@ -0,0 +1,146 @@
+// test_allocations.cpp : the acquisition path (framing, decoding, DeviceManager::poll) never allocates
+//
+// Built with CC2650_COUNT_ALLOCATIONS: the counting operator new of AllocationCounter.cpp
+// sees every allocation of this thread.
+
+#include "AllocationCounter.h"
+#include "Check.h"
+#include "DeviceManager.h"
+#include "FakeTransport.h"
+#include "FramePool.h"
+#include "HciFramer.h"
+#include <cstring>
+
+static const uint16_t CONN_HANDLE = 0x0001;
+
+// One tag at a0e6f8aed204: answers the setup of DeviceManager as the dongle would
+static void dongleResponses(FakeTransport &d, uint16_t opcode, const uint8_t *params, size_t length) {
+	switch (opcode) {
+	case GAP_DEVICE_INIT:
+		d.event(GAP_DEVICE_INIT_DONE, { HCI_SUCCESS });
+		break;
+	case GAP_DEVICE_DISCOVERY_REQUEST:
+		// status numDevs, eventType addrType addr(6)
+		d.event(GAP_DEVICE_DISCOVERY_DONE, { HCI_SUCCESS, 0x01, 0x00, 0x00, 0x04, 0xD2, 0xAE, 0xF8, 0xE6, 0xA0 });
+		break;
+	case GAP_ESTABLISH_LINK_REQUEST:
+		d.event(GAP_LINK_ESTABLISHED, { HCI_SUCCESS, 0x00, 0x04, 0xD2, 0xAE, 0xF8, 0xE6, 0xA0,
+										(uint8_t)CONN_HANDLE, (uint8_t)(CONN_HANDLE >> 8) });
+		break;
+	case GATT_WRITE_CHAR_VALUE:
+		if (length >= 2)
+			d.event(ATT_WRITE_RSP, { HCI_PROCEDURE_COMPLETE, params[0], params[1], 0x00 });
+		break;
+	}
+}
+
+// Notifications with known axes, command statuses between them
+static void queueRound(FakeTransport &dongle, int round) {
+	for (int n = 0; n < 6; n++) {
+		int16_t axis[IMU_AXES];
+		for (int a = 0; a < IMU_AXES; a++)
+			axis[a] = (int16_t)(round * 100 + n * 10 - a * 1000);
+		dongle.notification(CONN_HANDLE, axis);
+		if (n % 2 == 0)
+			dongle.commandStatus(GATT_WRITE_CHAR_VALUE, HCI_SUCCESS);
+	}
+}
+
+static bool sampleMatches(const ImuSample &s, int round, int n) {
+	for (int a = 0; a < IMU_AXES; a++)
+		if (s.axis[a] != (int16_t)(round * 100 + n * 10 - a * 1000))
+			return false;
+	return true;
+}
+
+// HciFramer::next and decodeMovementNotification on bytes committed in odd-sized pieces
+static void framerPath() {
+	FakeTransport dongle;
+	dongle.reserve(4096);
+	dongle.chunk = 11;					// every notification spans two or three reads
+	FramePool pool(DEVICE_SLAB_SIZE, DEVICE_SLAB_COUNT);
+	HciFramer framer(pool);
+	FrameSlice frame;
+	ImuSample sample;
+
+	uint64_t start = 0;
+	int decoded = 0, wrong = 0;
+	for (int round = 0; round < 50; round++) {
+		if (round == 5)
+			start = allocationCount();	// warm-up done
+		queueRound(dongle, round);
+		int n = 0;
+		while (dongle.pending() > 0) {
+			int bytes = dongle.read(framer.writePtr(), framer.writeSpace());
+			if (bytes > 0)
+				framer.commit((size_t)bytes);
+			while (framer.next(frame)) {
+				if (!decodeMovementNotification(frame.data(), frame.size(), sample))
+					continue;
+				if (!sampleMatches(sample, round, n++))
+					wrong++;
+				decoded++;
+			}
+			frame.slab.reset();
+		}
+	}
+	uint64_t allocations = allocationCount() - start;
+	CHECK(decoded == 50 * 6);
+	CHECK(wrong == 0);
+	CHECK(framer.skippedBytes() == 0);
+	CHECK(allocations == 0);
+	if (allocations)
+		fprintf(stderr, "framer path: %llu allocation(s)\n", (unsigned long long)allocations);
+}
+
+// DeviceManager::poll with a connected tag, the notifications split across reads
+static void pollPath() {
+	FakeTransport dongle;
+	dongle.reserve(4096);
+	dongle.respond = dongleResponses;
+	DeviceManager tags(dongle);
+	CHECK(tags.initialize().ok());
+	CHECK(tags.connect(std::vector<std::string>(1, "a0e6f8aed204")).ok());
+	CHECK(tags.enableMovement(10).ok());
+	CHECK(tags.startMovement(movementConfig(IMU_ALL, false)).ok());
+	CHECK(tags.deviceCount() == 1);
+	dongle.chunk = 17;
+
+	uint64_t start = 0;
+	int decoded = 0, wrong = 0;
+	for (int round = 0; round < 50; round++) {
+		if (round == 5)
+			start = allocationCount();
+		queueRound(dongle, round);
+		int n = 0;
+		SampleBatch batch;
+		while (dongle.pending() > 0) {
+			if (tags.poll(batch) < 0)
+				break;
+			for (size_t i = 0; i < batch.count; i++, n++) {
+				if (batch.samples[i].deviceId != 0 || !sampleMatches(batch.samples[i], round, n))
+					wrong++;
+				decoded++;
+			}
+		}
+		tags.poll(batch);				// idle read
+	}
+	uint64_t allocations = allocationCount() - start;
+	CHECK(decoded == 50 * 6);
+	CHECK(wrong == 0);
+	CHECK(allocations == 0);
+	if (allocations)
+		fprintf(stderr, "poll path: %llu allocation(s)\n", (unsigned long long)allocations);
+}
+
+int main() {
+	// the counter must be live, or a zero proves nothing
+	uint64_t before = allocationCount();
+	int *volatile probe = new int(0);
+	delete probe;
+	CHECK(allocationCount() == before + 1);
+
+	framerPath();
+	pollPath();
+	return checkResult();
+}
@@ -0,0 +1,57 @@
+/* test_c_api.c : cc2650.h used from plain C against the shared library
+ */
+
+#include "cc2650.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+static void onBatch(const cc2650_sample *samples, size_t count, void *context) {
+	(void)samples;
+	*(size_t *)context += count;
+}
+
+int main(void) {
+	cc2650_device *device = (cc2650_device *)1;
+	const cc2650_sample *samples = 0;
+	size_t count = 1, received = 0;
+	const char *macs[] = { "a0e6f8aed204" };
+
+	CHECK(cc2650_api_version() == CC2650_API_VERSION);
+	CHECK(offsetof(cc2650_sample, timestamp) > offsetof(cc2650_sample, device_id));
+	CHECK(offsetof(cc2650_sample, axis) == offsetof(cc2650_sample, timestamp) + 8);
+	CHECK(strcmp(cc2650_status_string(CC2650_OK), "success") == 0);
+	CHECK(strcmp(cc2650_status_string(CC2650_ERROR_TRANSPORT), "serial port read failed") == 0);
+	CHECK(strcmp(cc2650_status_string(0xF0), "no response in time") == 0);
+	CHECK(strcmp(cc2650_status_string(-100), "unknown status") == 0);
+
+	/* a port that does not exist: no handle */
+	CHECK(cc2650_open("/nonexistent/cc2650-test-port", &device) == CC2650_ERROR_OPEN);
+	CHECK(device == 0);
+
+	/* every entry point rejects a null handle instead of crashing */
+	CHECK(cc2650_open(0, &device) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_open("x", 0) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_connect(0, macs, 1) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_start(0, 100, CC2650_SENSOR_ALL, 0) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_set_read_timeout(0, 10) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_poll(0, &samples, &count) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_set_callback(0, onBatch, &received) == CC2650_ERROR_ARGUMENT);
+	CHECK(cc2650_device_count(0) == 0);
+	CHECK(cc2650_stop(0) == CC2650_ERROR_ARGUMENT);
+	cc2650_close(0);
+
+	if (failures)
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	return failures ? 1 : 0;
+}
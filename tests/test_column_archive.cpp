@@ -0,0 +1,205 @@
+// test_column_archive.cpp : ArchiveWriter -> ArchiveReader round trips through both column encodings
+//
+
+#include "Check.h"
+#include "ColumnArchive.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+static const size_t CHUNK = 300;			// not a multiple of the 128-value blocks
+static const uint8_t COLUMN_BITPACK = 1;	// the encoding byte that starts every column
+static const uint8_t COLUMN_VARINT = 2;
+
+static std::vector<ImuSample> expected[3];
+
+/*
+Device 0: smooth motion, every column bit-packed.
+Device 1: axes jumping between -32768 and 32767 (deltas of 17 bits, wider than a
+          16-bit axis), and a timestamp gap above 2^32 us that no packed width holds.
+Device 2: constant axes with one spike per chunk, cheaper as varints.
+*/
+static ImuSample makeSample(uint16_t device, size_t i) {
+	ImuSample s;
+	s.deviceId = device;
+	s.timestamp = 1700000000000000ull + i * 10000 + device * 1000;
+	for (int a = 0; a < IMU_AXES; a++) {
+		switch (device) {
+		case 0: s.axis[a] = (int16_t)((abs((int)(i % 400) - 200) - 100) * (a + 1)); break;
+		case 1: s.axis[a] = (i + a) % 2 ? 32767 : -32768; break;
+		default: s.axis[a] = i % CHUNK == 77 ? (int16_t)(-30000 + a) : (int16_t)(a * 11); break;
+		}
+	}
+	if (device == 1 && i >= 450)
+		s.timestamp += 5000000000ull;		// about 83 minutes without samples
+	return s;
+}
+
+static bool sameSamples(const std::vector<ImuSample> &got, const std::vector<ImuSample> &want, uint16_t axisMask) {
+	if (got.size() != want.size())
+		return false;
+	for (size_t i = 0; i < got.size(); i++) {
+		if (got[i].deviceId != want[i].deviceId || got[i].timestamp != want[i].timestamp)
+			return false;
+		for (int a = 0; a < IMU_AXES; a++)
+			if (got[i].axis[a] != ((axisMask & (1 << a)) ? want[i].axis[a] : 0))
+				return false;
+	}
+	return true;
+}
+
+// The samples of device with t0 <= timestamp < t1
+static std::vector<ImuSample> between(uint16_t device, uint64_t t0, uint64_t t1) {
+	std::vector<ImuSample> out;
+	for (size_t i = 0; i < expected[device].size(); i++)
+		if (expected[device][i].timestamp >= t0 && expected[device][i].timestamp < t1)
+			out.push_back(expected[device][i]);
+	return out;
+}
+
+static bool query(ArchiveReader &reader, uint16_t device, uint16_t axisMask, uint64_t t0, uint64_t t1) {
+	std::vector<ImuSample> out;
+	if (!reader.read(device, axisMask, t0, t1, out))
+		return false;
+	return sameSamples(out, between(device, t0, t1), axisMask);
+}
+
+// Encoding byte of a column, read straight from the file
+static uint8_t columnEncoding(FILE *f, const ArchiveChunkInfo &chunk, size_t column) {
+	fseek(f, (long)(chunk.offset + chunk.columnOffset[column]), SEEK_SET);
+	return (uint8_t)fgetc(f);
+}
+
+int main() {
+	std::string path = tempPath("archive.cca");
+
+	// 1000 samples per device, interleaved as they are acquired: 3 full chunks and a partial one each
+	ArchiveWriter writer;
+	CHECK(writer.open(path, CHUNK));
+	for (size_t i = 0; i < 1000; i++) {
+		for (uint16_t d = 0; d < 3; d++) {
+			ImuSample s = makeSample(d, i);
+			expected[d].push_back(s);
+			writer.append(s);
+		}
+	}
+	CHECK(writer.close());
+
+	ArchiveReader reader;
+	CHECK(reader.open(path));
+	const std::vector<ArchiveChunkInfo> &chunks = reader.chunks();
+	CHECK(chunks.size() == 3 * 4);
+
+	// both encodings are exercised, the time gap forces varints
+	FILE *f = fopen(path.c_str(), "rb");
+	CHECK(f != 0);
+	size_t bitpacked = 0, varints = 0;
+	for (size_t c = 0; f && c < chunks.size(); c++) {
+		for (size_t column = 0; column < ARCHIVE_COLUMNS; column++) {
+			uint8_t encoding = columnEncoding(f, chunks[c], column);
+			bitpacked += encoding == COLUMN_BITPACK;
+			varints += encoding == COLUMN_VARINT;
+			if (chunks[c].deviceId == 0)
+				CHECK(encoding == COLUMN_BITPACK);
+			if (chunks[c].deviceId == 1 && column > 0)
+				CHECK(encoding == COLUMN_BITPACK);			// 17-bit deltas
+			if (chunks[c].deviceId == 1 && column == 0 && chunks[c].firstTimestamp < expected[1][450].timestamp &&
+				chunks[c].lastTimestamp >= expected[1][450].timestamp)
+				CHECK(encoding == COLUMN_VARINT);			// the gap
+			if (chunks[c].deviceId == 2 && column > 0 && chunks[c].count == CHUNK)
+				CHECK(encoding == COLUMN_VARINT);
+		}
+	}
+	if (f)
+		fclose(f);
+	CHECK(bitpacked > 0 && varints > 0);
+
+	// statistics of the index
+	for (size_t c = 0; c < chunks.size(); c++) {
+		if (chunks[c].deviceId != 1)
+			continue;
+		CHECK(chunks[c].min[AXIS_GX] == -32768 && chunks[c].max[AXIS_GX] == 32767);
+	}
+
+	// everything, then each sensor group alone
+	for (uint16_t d = 0; d < 3; d++) {
+		CHECK(query(reader, d, ARCHIVE_ALL_AXES, 0, UINT64_MAX));
+		CHECK(query(reader, d, archiveAxisMask(IMU_GYRO), 0, UINT64_MAX));
+		CHECK(query(reader, d, archiveAxisMask(IMU_ACC), 0, UINT64_MAX));
+		CHECK(query(reader, d, archiveAxisMask(IMU_MAG), 0, UINT64_MAX));
+		CHECK(query(reader, d, (1 << AXIS_GZ) | (1 << AXIS_MX), 0, UINT64_MAX));
+	}
+
+	// time ranges on and around the chunk boundaries (samples 299/300, 599/600, 899/900)
+	for (uint16_t d = 0; d < 3; d++) {
+		const std::vector<ImuSample> &e = expected[d];
+		for (size_t boundary = CHUNK; boundary < e.size(); boundary += CHUNK) {
+			uint64_t last = e[boundary - 1].timestamp, first = e[boundary].timestamp;
+			CHECK(query(reader, d, ARCHIVE_ALL_AXES, e[boundary - CHUNK].timestamp, first));	// exactly one chunk
+			CHECK(query(reader, d, ARCHIVE_ALL_AXES, last, first + 1));						// the two samples around it
+			CHECK(query(reader, d, ARCHIVE_ALL_AXES, last + 1, first));						// nothing in between
+			CHECK(query(reader, d, archiveAxisMask(IMU_ACC), last - 50000, first + 50000));
+			CHECK(query(reader, d, ARCHIVE_ALL_AXES, first, first));						// empty range
+		}
+		CHECK(query(reader, d, ARCHIVE_ALL_AXES, e.back().timestamp, UINT64_MAX));			// the partial chunk
+		CHECK(query(reader, d, ARCHIVE_ALL_AXES, 0, e.front().timestamp + 1));
+	}
+	CHECK(query(reader, 1, ARCHIVE_ALL_AXES, expected[1][449].timestamp, expected[1][451].timestamp));	// across the gap
+	std::vector<ImuSample> none;
+	CHECK(reader.read(7, ARCHIVE_ALL_AXES, 0, UINT64_MAX, none) && none.empty());				// unknown device
+	reader.close();
+
+	// an archive that was never closed has no index
+	{
+		ArchiveWriter unfinished;
+		CHECK(unfinished.open(path, CHUNK));
+		for (size_t i = 0; i < 2 * CHUNK; i++)
+			unfinished.append(makeSample(0, i));
+		FILE *copy = fopen(path.c_str(), "rb");		// what is on disk before close()
+		std::vector<uint8_t> bytes;
+		int c;
+		while (copy && (c = fgetc(copy)) != EOF)
+			bytes.push_back((uint8_t)c);
+		if (copy)
+			fclose(copy);
+		CHECK(unfinished.close());
+		FILE *truncated = fopen(path.c_str(), "wb");
+		if (truncated) {
+			fwrite(bytes.data(), 1, bytes.size(), truncated);
+			fclose(truncated);
+		}
+		ArchiveReader partial;
+		CHECK(!partial.open(path));
+	}
+
+#ifdef __linux__
+	// a disk that fills up during the capture: appends stop at the failed chunk and the
+	// archive is not closed as if it were complete
+	{
+		std::string full = tempPath("full.cca");
+		remove(full.c_str());
+		if (symlink("/dev/full", full.c_str()) == 0) {
+			ArchiveWriter failing;
+			CHECK(failing.open(full, CHUNK));		// the header is still in the stdio buffer
+			for (size_t i = 0; i < 20000 && !failing.failed(); i++)
+				failing.append(makeSample(0, i));
+			CHECK(failing.failed() && !failing.lastError().empty());
+			uint64_t written = failing.bytesWritten();
+			for (size_t i = 0; i < 2 * CHUNK; i++)
+				failing.append(makeSample(0, i));
+			CHECK(failing.bytesWritten() == written);
+			CHECK(!failing.close());
+			CHECK(!failing.isOpen());
+			remove(full.c_str());
+		}
+	}
+#endif
+
+	remove(path.c_str());
+	return checkResult();
+}
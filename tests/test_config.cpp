@@ -0,0 +1,50 @@
+// test_config.cpp : command line parsing of AcquisitionConfig
+//
+
+#include "Check.h"
+#include "Config.h"
+#include <string>
+#include <vector>
+
+// Parses the arguments after the program name; false with the parser's error
+static bool parse(std::vector<const char *> args, AcquisitionConfig &config, std::string &error) {
+	args.insert(args.begin(), "Connect_CC2650");
+	return parseCommandLine((int)args.size(), (char **)args.data(), config, error);
+}
+
+int main() {
+	std::string error;
+
+	// boolean keys: alone, with a separate value or with =, in every form the config file takes
+	{ AcquisitionConfig c; CHECK(parse({ "--daemon" }, c, error) && c.daemon); }
+	{ AcquisitionConfig c; CHECK(parse({ "--daemon", "off" }, c, error) && !c.daemon); }
+	{ AcquisitionConfig c; CHECK(parse({ "--daemon=false" }, c, error) && !c.daemon); }
+	{ AcquisitionConfig c; CHECK(parse({ "--daemon", "yes" }, c, error) && c.daemon); }
+	{ AcquisitionConfig c; CHECK(parse({ "--daemon", "--sync" }, c, error) && c.daemon && c.sync); }
+	{ AcquisitionConfig c; CHECK(parse({ "--sync", "0", "--trace" }, c, error) && !c.sync && c.trace); }
+	{ AcquisitionConfig c; CHECK(!parse({ "--daemon", "maybe" }, c, error) && error == "unexpected argument: maybe"); }
+	{ AcquisitionConfig c; CHECK(!parse({ "--sync=maybe" }, c, error) && error == "sync must be on or off"); }
+
+	// addresses are normalised; the command line replaces the default
+	{
+		AcquisitionConfig c;
+		CHECK(parse({ "--mac", "A0:E6:F8:AE:D2:04", "--mac=06-05-04-03-02-01" }, c, error));
+		CHECK(c.macs.size() == 2 && c.macs[0] == "a0e6f8aed204" && c.macs[1] == "060504030201");
+	}
+	{ AcquisitionConfig c; CHECK(!parse({ "--mac", "a0e6f8aed2" }, c, error)); }
+	{ AcquisitionConfig c; CHECK(parse({}, c, error) && c.macs.size() == 1 && c.macs[0] == "a0e6f8aed204"); }
+
+	{ AcquisitionConfig c; CHECK(parse({ "--period_ms", "250" }, c, error) && c.periodMs == 250); }
+	{ AcquisitionConfig c; CHECK(!parse({ "--period_ms", "255" }, c, error)); }
+	{ AcquisitionConfig c; CHECK(!parse({ "--port" }, c, error) && error == "missing value for --port"); }
+
+	// event capture only tests the sensors that are sent
+	{
+		AcquisitionConfig c;
+		CHECK(parse({ "--sensors", "gyro,mag", "--period_ms", "200", "--pre_trigger_s", "2" }, c, error));
+		EventCaptureConfig capture = c.eventCaptureConfig();
+		CHECK(capture.sensorMask == (IMU_GYRO | IMU_MAG) && capture.preSamples == 10 && capture.postSamples == 25);
+	}
+
+	return checkResult();
+}
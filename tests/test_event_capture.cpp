@@ -0,0 +1,135 @@
+// test_event_capture.cpp : pre-trigger rings, post-trigger windows and the sensors EventCapture tests
+//
+
+#include "Check.h"
+#include "EventCapture.h"
+#include <vector>
+
+static const int16_t ONE_G = 2048;					// accelerometer counts, 8 G range
+static const int16_t FAST_ROTATION = 131 * 50;		// gyroscope counts, about 50 deg/s
+
+static std::vector<ImuSample> out;
+
+static void collect(const ImuSample &sample, void *) {
+	out.push_back(sample);
+}
+
+// A sample numbered by its timestamp: lying still (1 G down), shaken (2 G) or turning
+static ImuSample sample(uint16_t device, uint64_t n, int16_t az = ONE_G, int16_t gz = 0) {
+	ImuSample s = {};
+	s.deviceId = device;
+	s.timestamp = n;
+	s.axis[AXIS_AZ] = az;
+	s.axis[AXIS_GZ] = gz;
+	return s;
+}
+
+// The timestamps that came out since the last call, in order
+static std::vector<uint64_t> taken() {
+	std::vector<uint64_t> numbers;
+	for (size_t i = 0; i < out.size(); i++)
+		numbers.push_back(out[i].timestamp);
+	out.clear();
+	return numbers;
+}
+
+int main() {
+	EventCaptureConfig config;
+	config.preSamples = 4;
+	config.postSamples = 3;
+
+	// idle samples are held back; on motion the last preSamples come out oldest first
+	{
+		EventCapture capture(config, collect, 0);
+		for (uint64_t n = 0; n < 10; n++)
+			CHECK(!capture.push(sample(0, n)));
+		CHECK(out.empty());
+		CHECK(capture.push(sample(0, 10, 2 * ONE_G)));
+		CHECK(taken() == std::vector<uint64_t>({ 6, 7, 8, 9, 10 }));
+
+		// postSamples after the last motion, then idle again
+		for (uint64_t n = 11; n < 15; n++)
+			CHECK(!capture.push(sample(0, n)));
+		CHECK(taken() == std::vector<uint64_t>({ 11, 12, 13 }));
+
+		// motion inside the window extends it without starting a new event
+		capture.push(sample(0, 15, 2 * ONE_G));
+		taken();
+		capture.push(sample(0, 16));
+		CHECK(!capture.push(sample(0, 17, 0)));			// free fall is motion too
+		for (uint64_t n = 18; n < 22; n++)
+			capture.push(sample(0, n));
+		CHECK(taken() == std::vector<uint64_t>({ 16, 17, 18, 19, 20 }));
+		CHECK(capture.events() == 2);
+
+		// a short lead-up: only what the ring holds since the last event
+		capture.push(sample(0, 22));
+		CHECK(capture.push(sample(0, 23, 0, FAST_ROTATION)));
+		CHECK(taken() == std::vector<uint64_t>({ 21, 22, 23 }));
+		CHECK(capture.events() == 3);
+		CHECK(capture.samplesIn() == 24 && capture.samplesOut() == 18);
+	}
+
+	// trigger(): from idle it flushes the ring and counts an event, the next sample is the trigger;
+	// during an event it restarts the window from the next sample
+	{
+		EventCapture capture(config, collect, 0);
+		for (uint64_t n = 0; n < 6; n++)
+			capture.push(sample(1, n));
+		capture.trigger(1);
+		CHECK(capture.events() == 1);
+		CHECK(taken() == std::vector<uint64_t>({ 2, 3, 4, 5 }));
+		for (uint64_t n = 6; n < 12; n++)
+			capture.push(sample(1, n));
+		CHECK(taken() == std::vector<uint64_t>({ 6, 7, 8, 9 }));
+
+		capture.push(sample(1, 12, 2 * ONE_G));
+		capture.push(sample(1, 13));
+		capture.trigger(1);
+		CHECK(capture.events() == 2);
+		for (uint64_t n = 14; n < 20; n++)
+			capture.push(sample(1, n));
+		CHECK(taken() == std::vector<uint64_t>({ 10, 11, 12, 13, 14, 15, 16, 17 }));
+
+		// devices have their own rings and windows
+		capture.push(sample(0, 100));
+		capture.push(sample(1, 20, 2 * ONE_G));
+		CHECK(taken() == std::vector<uint64_t>({ 18, 19, 20 }));
+	}
+
+	// gyroscope only: the accelerometer axes are 0, which is not free fall
+	{
+		EventCaptureConfig gyroOnly = config;
+		gyroOnly.sensorMask = IMU_GYRO;
+		EventCapture capture(gyroOnly, collect, 0);
+		for (uint64_t n = 0; n < 10; n++)
+			CHECK(!capture.push(sample(0, n, 0)));
+		CHECK(out.empty() && capture.events() == 0);
+		CHECK(capture.push(sample(0, 10, 0, FAST_ROTATION)));
+		CHECK(taken() == std::vector<uint64_t>({ 6, 7, 8, 9, 10 }));
+	}
+
+	// accelerometer only: the gyroscope is not looked at
+	{
+		EventCaptureConfig accOnly = config;
+		accOnly.sensorMask = IMU_ACC;
+		EventCapture capture(accOnly, collect, 0);
+		CHECK(!capture.isMotion(sample(0, 0, ONE_G, FAST_ROTATION)));
+		CHECK(capture.isMotion(sample(0, 0, 0)));
+	}
+
+	// magnetometer only: nothing is motion, trigger() still starts events
+	{
+		EventCaptureConfig magOnly = config;
+		magOnly.sensorMask = IMU_MAG;
+		EventCapture capture(magOnly, collect, 0);
+		for (uint64_t n = 0; n < 5; n++)
+			capture.push(sample(0, n, 0, FAST_ROTATION));
+		CHECK(out.empty() && capture.events() == 0);
+		capture.trigger(0);
+		capture.push(sample(0, 5, 0));
+		CHECK(taken() == std::vector<uint64_t>({ 1, 2, 3, 4, 5 }));
+	}
+
+	return checkResult();
+}
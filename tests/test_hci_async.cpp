@@ -0,0 +1,105 @@
+// test_hci_async.cpp : the event loop against a scripted dongle, GAP procedures that time out
+//
+
+#include "Check.h"
+#include "FakeTransport.h"
+#include "FramePool.h"
+#include "HciAsync.h"
+#include "HciFramer.h"
+#include <chrono>
+#include <thread>
+
+static Task<ScanResult> scan(HciAdapter &adapter, int timeoutMs) {
+	co_return co_await adapter.discover(std::vector<std::string>(1, "a0e6f8aed204"), timeoutMs);
+}
+
+static Task<LinkResult> link(HciAdapter &adapter, int timeoutMs) {
+	co_return co_await adapter.connect("a0e6f8aed204", timeoutMs);
+}
+
+// A task already started must not be started again by run(): pump until it ends
+template <typename T>
+static T finish(HciEventLoop &loop, Task<T> &task) {
+	while (!task.done())
+		loop.pump();
+	return task.result();
+}
+
+static void pumpFor(HciEventLoop &loop, int ms) {
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+	while (std::chrono::steady_clock::now() < end) {
+		loop.pump();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+int main() {
+	FramePool pool(512, 8);
+	HciFramer framer(pool);
+	FakeTransport dongle;
+	HciEventLoop loop(dongle, framer);
+	HciAdapter adapter(loop);
+	loop.setTimeout(300);
+
+	// a discovery that times out is cancelled; the next link waits until the dongle ends the scan
+	{
+		Task<ScanResult> scanTask = scan(adapter, 20);
+		ScanResult result = loop.run(scanTask);
+		CHECK(result.status == HCI_STATUS_TIMEOUT);
+		CHECK(dongle.count(GAP_DEVICE_DISCOVERY_CANCEL) == 1);
+
+		dongle.respond = [](FakeTransport &d, uint16_t opcode, const uint8_t *, size_t) {
+			if (opcode == GAP_ESTABLISH_LINK_REQUEST)
+				d.event(GAP_LINK_ESTABLISHED, { HCI_SUCCESS, 0x00, 0x04, 0xD2, 0xAE, 0xF8, 0xE6, 0xA0, 0x01, 0x00 });
+		};
+		Task<LinkResult> linkTask = link(adapter, 1000);
+		linkTask.start();
+		pumpFor(loop, 30);
+		CHECK(dongle.count(GAP_ESTABLISH_LINK_REQUEST) == 0);
+		CHECK(!linkTask.done());
+
+		// the late end of the scan is consumed by the cancellation, not by the link request
+		dongle.event(GAP_DEVICE_DISCOVERY_DONE, { HCI_DISCOVERY_CANCELED, 0x00 });
+		LinkResult linked = finish(loop, linkTask);
+		CHECK(dongle.count(GAP_ESTABLISH_LINK_REQUEST) == 1);
+		CHECK(linked.ok() && linked.connHandle == 0x0001);
+		dongle.respond = nullptr;
+	}
+
+	// a link that times out is cancelled; if it comes up anyway it is terminated at once
+	{
+		Task<LinkResult> linkTask = link(adapter, 20);
+		LinkResult result = loop.run(linkTask);
+		CHECK(result.status == HCI_STATUS_TIMEOUT);
+		CHECK(dongle.count(GAP_TERMINATE_LINK_REQUEST) == 1);		// GAP_CONNHANDLE_INIT: abandon the establishment
+
+		dongle.event(GAP_LINK_ESTABLISHED, { HCI_SUCCESS, 0x00, 0x04, 0xD2, 0xAE, 0xF8, 0xE6, 0xA0, 0x42, 0x00 });
+		pumpFor(loop, 5);
+		CHECK(dongle.count(GAP_TERMINATE_LINK_REQUEST) == 2);
+		const std::vector<uint8_t> &terminate = dongle.commands.back();
+		CHECK(terminate.size() == 7 && terminate[4] == 0x42 && terminate[5] == 0x00);
+
+		// the GAP slot is free again: the next scan goes out immediately
+		Task<ScanResult> scanTask = scan(adapter, 1000);
+		scanTask.start();
+		loop.pump();
+		CHECK(dongle.count(GAP_DEVICE_DISCOVERY_REQUEST) == 2);
+		dongle.event(GAP_DEVICE_DISCOVERY_DONE, { HCI_SUCCESS, 0x00 });
+		CHECK(finish(loop, scanTask).ok());
+	}
+
+	// a dongle that never reports the end of the cancelled procedure blocks GAP only until the loop timeout
+	{
+		Task<ScanResult> scanTask = scan(adapter, 20);
+		CHECK(loop.run(scanTask).status == HCI_STATUS_TIMEOUT);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Task<ScanResult> next = scan(adapter, 20);
+		ScanResult result = loop.run(next);
+		long waited = (long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		CHECK(dongle.count(GAP_DEVICE_DISCOVERY_REQUEST) == 4);
+		CHECK(result.status == HCI_STATUS_TIMEOUT);
+		CHECK(waited >= 300);
+	}
+
+	return checkResult();
+}
@@ -0,0 +1,106 @@
+// test_latency_histogram.cpp : bucket boundaries and percentiles of LatencyHistogram
+//
+
+#include "Check.h"
+#include "LatencyHistogram.h"
+#include <cmath>
+#include <sstream>
+#include <string>
+
+// The percentile is the upper bound of the true value's bucket: never below it, at most 1/16 above
+static bool closeAbove(uint64_t percentile, uint64_t value) {
+	return percentile >= value && percentile - value <= value / 16;
+}
+
+int main() {
+	// below 16 ns every value has its own bucket
+	for (uint64_t v = 0; v < 16; v++) {
+		CHECK(LatencyHistogram::bucketOf(v) == (int)v);
+		CHECK(LatencyHistogram::bucketUpperBound((int)v) == v);
+		LatencyHistogram one;
+		one.record(v);
+		CHECK(one.percentile(50) == v && one.percentile(100) == v);
+	}
+
+	// every power of two starts a bucket, the bucket before it ends just below
+	for (int k = 4; k < 64; k++) {
+		uint64_t power = (uint64_t)1 << k;
+		int bucket = LatencyHistogram::bucketOf(power);
+		CHECK(bucket == (k - 3) * LatencyHistogram::SUB_BUCKETS);
+		CHECK(LatencyHistogram::bucketOf(power - 1) == bucket - 1);
+		CHECK(LatencyHistogram::bucketUpperBound(bucket - 1) == power - 1);
+		CHECK(LatencyHistogram::bucketOf(power + power / 2) == bucket + LatencyHistogram::SUB_BUCKETS / 2);
+	}
+	CHECK(LatencyHistogram::bucketUpperBound(LatencyHistogram::bucketOf(32)) == 33);			// 2 ns wide from 32 ns
+	CHECK(LatencyHistogram::bucketOf(1000000) == LatencyHistogram::bucketOf(1015807));			// 1 ms: 32 us wide
+	CHECK(LatencyHistogram::bucketOf(UINT64_MAX) == LatencyHistogram::BUCKETS - 1);
+	CHECK(LatencyHistogram::bucketUpperBound(LatencyHistogram::BUCKETS - 1) == UINT64_MAX);
+
+	// the buckets tile the range: each one starts right after the previous one ends, no wider than 1/16
+	for (int b = 0; b + 1 < LatencyHistogram::BUCKETS; b++) {
+		uint64_t last = LatencyHistogram::bucketUpperBound(b);
+		CHECK(LatencyHistogram::bucketOf(last) == b);
+		CHECK(LatencyHistogram::bucketOf(last + 1) == b + 1);
+		uint64_t first = b ? LatencyHistogram::bucketUpperBound(b - 1) + 1 : 0;
+		CHECK(last - first <= first / 16);
+	}
+
+	// 1..1000 ns once each: the percentiles are the bounds of the buckets of 500, 990 and 999,
+	// the last one capped by the maximum
+	{
+		LatencyHistogram uniform;
+		for (uint64_t v = 1; v <= 1000; v++)
+			uniform.record(v);
+		CHECK(uniform.count() == 1000 && uniform.min() == 1 && uniform.max() == 1000 && uniform.mean() == 500.5);
+		CHECK(uniform.percentile(50) == 511);
+		CHECK(uniform.percentile(99) == 991);
+		CHECK(uniform.percentile(99.9) == 1000);
+		CHECK(closeAbove(uniform.percentile(50), 500) && closeAbove(uniform.percentile(99), 990));
+		CHECK(uniform.percentile(0.01) == 1);
+		CHECK(uniform.percentile(100) == 1000);
+	}
+
+	// a geometric spread from 1 us to 1 s: every percentile within 1/16 of the true value
+	{
+		LatencyHistogram spread;
+		uint64_t values[10000];
+		for (int i = 0; i < 10000; i++) {
+			values[i] = (uint64_t)(1000.0 * pow(1000000.0, i / 9999.0));
+			spread.record(values[i]);
+		}
+		CHECK(closeAbove(spread.percentile(50), values[4999]));
+		CHECK(closeAbove(spread.percentile(99), values[9899]));
+		CHECK(closeAbove(spread.percentile(99.9), values[9989]));
+	}
+
+	// the request's check: 10 outliers in 10000 pass p99.9, 11 do not
+	{
+		LatencyHistogram fast, slow;
+		for (int i = 0; i < 10000; i++) {
+			fast.record(i < 10 ? 2000000 : 1000);
+			slow.record(i < 11 ? 2000000 : 1000);
+		}
+		CHECK(fast.percentile(50) == 1023 && fast.percentile(99) == 1023 && fast.percentile(99.9) == 1023);
+		CHECK(slow.percentile(99.9) == 2000000);
+		std::ostringstream met, missed;
+		fast.report(met, "fast", 1000000);
+		slow.report(missed, "slow", 1000000);
+		CHECK(met.str() == "fast       n=10000  p50 1.0  p99 1.0  p99.9 1.0  max 2000.0 us  (target 1000.0 us: met)\n");
+		CHECK(missed.str().find("p99.9 2000.0") != std::string::npos && missed.str().find("MISSED") != std::string::npos);
+	}
+
+	// empty, and empty again after reset()
+	{
+		LatencyHistogram empty;
+		CHECK(empty.count() == 0 && empty.min() == 0 && empty.max() == 0 && empty.mean() == 0);
+		CHECK(empty.percentile(50) == 0 && empty.percentile(99.9) == 0);
+		std::ostringstream out;
+		empty.report(out, "empty", 0);
+		CHECK(out.str() == "empty      n=0  p50 0.0  p99 0.0  p99.9 0.0  max 0.0 us\n");
+		empty.record(12345);
+		empty.reset();
+		CHECK(empty.count() == 0 && empty.percentile(50) == 0 && empty.max() == 0 && empty.min() == 0);
+	}
+
+	return checkResult();
+}
@@ -0,0 +1,143 @@
+// test_recording.cpp : RecordingWriter -> RecordingReader round trips, flushing and write failures
+//
+
+#include "Check.h"
+#include "Recording.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+static const uint32_t INTERVAL = 16;
+static const size_t DEVICES = 3;
+
+static std::vector<ImuSample> expected[DEVICES];
+
+static ImuSample makeSample(uint16_t device, size_t i) {
+	ImuSample s;
+	s.deviceId = device;
+	s.timestamp = 1700000000000000ull + i * 10000 + device * 3000;
+	for (int a = 0; a < IMU_AXES; a++)
+		s.axis[a] = (int16_t)(i * 7 + a * 1000 - device * 5000);
+	return s;
+}
+
+static uint64_t fileSize(const std::string &path) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	uint64_t size = (uint64_t)ftell(f);
+	fclose(f);
+	return size;
+}
+
+static bool sameSamples(const std::vector<ImuSample> &got, const std::vector<ImuSample> &want) {
+	if (got.size() != want.size())
+		return false;
+	for (size_t i = 0; i < got.size(); i++) {
+		if (got[i].deviceId != want[i].deviceId || got[i].timestamp != want[i].timestamp)
+			return false;
+		for (int a = 0; a < IMU_AXES; a++)
+			if (got[i].axis[a] != want[i].axis[a])
+				return false;
+	}
+	return true;
+}
+
+// find() against the samples written, limited to the first `written` of each device
+static bool findMatches(const RecordingReader &reader, uint16_t device, uint64_t t0, uint64_t t1, size_t written) {
+	std::vector<ImuSample> want;
+	for (size_t i = 0; i < written; i++)
+		if (expected[device][i].timestamp >= t0 && expected[device][i].timestamp < t1)
+			want.push_back(expected[device][i]);
+	RecordingRange range = reader.find(device, t0, t1);
+	std::vector<ImuSample> got;
+	range.copyTo(got);
+	return range.count() == want.size() && sameSamples(got, want);
+}
+
+int main() {
+	std::string path = tempPath("recording.rec");
+	for (uint16_t d = 0; d < DEVICES; d++)
+		for (size_t i = 0; i < 1000; i++)
+			expected[d].push_back(makeSample(d, i));
+
+	// appends below the flush thresholds stay buffered: no flush per index entry
+	RecordingWriter writer;
+	CHECK(writer.open(path, INTERVAL));
+	CHECK(fileSize(path) == RECORDING_HEADER_SIZE && fileSize(path + ".idx") == RECORDING_HEADER_SIZE);
+	for (size_t i = 0; i < 100; i++)
+		for (uint16_t d = 0; d < DEVICES; d++)
+			writer.append(expected[d][i]);
+	CHECK(fileSize(path + ".idx") == RECORDING_HEADER_SIZE);
+	CHECK(writer.flushIfDue());
+	CHECK(fileSize(path + ".idx") == RECORDING_HEADER_SIZE);		// neither threshold reached yet
+
+	// flush() makes what was appended readable while the capture goes on
+	CHECK(writer.flush());
+	CHECK(fileSize(path) == RECORDING_HEADER_SIZE + 300 * sizeof(RecordedSample));
+	CHECK(fileSize(path + ".idx") == RECORDING_HEADER_SIZE + 3 * 7 * sizeof(RecordingIndexEntry));
+	{
+		RecordingReader reader;
+		CHECK(reader.open(path));
+		CHECK(reader.recordCount() == 300);
+		for (uint16_t d = 0; d < DEVICES; d++)
+			CHECK(findMatches(reader, d, 0, UINT64_MAX, 100));
+	}
+
+	// past RECORDING_FLUSH_BYTES the writer flushes by itself
+	size_t perDevice = 100 + RECORDING_FLUSH_BYTES / sizeof(RecordedSample) / DEVICES + 10;
+	CHECK(perDevice < 1000);
+	for (size_t i = 100; i < perDevice; i++)
+		for (uint16_t d = 0; d < DEVICES; d++)
+			writer.append(expected[d][i]);
+	CHECK(fileSize(path) >= RECORDING_HEADER_SIZE + 100 * DEVICES * sizeof(RecordedSample) + RECORDING_FLUSH_BYTES);
+
+	for (size_t i = perDevice; i < 1000; i++)
+		for (uint16_t d = 0; d < DEVICES; d++)
+			writer.append(expected[d][i]);
+	CHECK(writer.close());
+
+	// seek by time: whole devices, single index intervals, ranges starting and ending on index points
+	{
+		RecordingReader reader;
+		CHECK(reader.open(path));
+		CHECK(reader.recordCount() == DEVICES * 1000);
+		for (uint16_t d = 0; d < DEVICES; d++) {
+			const std::vector<ImuSample> &e = expected[d];
+			CHECK(findMatches(reader, d, 0, UINT64_MAX, 1000));
+			for (size_t i = INTERVAL; i < e.size(); i += INTERVAL * 7) {
+				CHECK(findMatches(reader, d, e[i].timestamp, e[i + 1].timestamp, 1000));		// one sample on an index point
+				CHECK(findMatches(reader, d, e[i - 1].timestamp, e[i].timestamp + 1, 1000));	// across an index point
+				CHECK(findMatches(reader, d, e[i - INTERVAL].timestamp, e[i].timestamp, 1000));	// one interval
+				CHECK(findMatches(reader, d, e[i].timestamp - 1, e[i].timestamp, 1000));		// nothing
+			}
+			CHECK(findMatches(reader, d, e[500].timestamp + 1, e[900].timestamp + 5, 1000));
+			CHECK(findMatches(reader, d, e.back().timestamp, UINT64_MAX, 1000));
+			CHECK(reader.find(d, e[600].timestamp, e[500].timestamp).count() == 0);
+		}
+		CHECK(reader.find(DEVICES, 0, UINT64_MAX).count() == 0);
+	}
+
+#ifdef __linux__
+	// a full disk fails open(), not the first flush during capture
+	{
+		std::string full = tempPath("full.rec");
+		remove(full.c_str());
+		if (symlink("/dev/full", full.c_str()) == 0) {
+			RecordingWriter failing;
+			CHECK(!failing.open(full));
+			CHECK(!failing.isOpen() && !failing.lastError().empty());
+			remove(full.c_str());
+			remove((full + ".idx").c_str());
+		}
+	}
+#endif
+
+	remove(path.c_str());
+	remove((path + ".idx").c_str());
+	return checkResult();
+}
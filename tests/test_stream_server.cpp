@@ -0,0 +1,269 @@
+// test_stream_server.cpp : StreamServer over loopback TCP, UDP and a Unix socket, decoded with StreamProtocol
+//
+
+#include "Check.h"
+#include "StreamProtocol.h"
+#include "StreamServer.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+static const size_t MAX_SAMPLES = 64;
+
+static ImuSample makeSample(int i) {
+	ImuSample s;
+	s.deviceId = (uint16_t)(i % 2);
+	s.timestamp = 1700000000000000ull + (uint64_t)i * 10000;
+	for (int a = 0; a < IMU_AXES; a++)
+		s.axis[a] = (int16_t)(i * 16 + a - 4000 * (a % 3));
+	return s;
+}
+
+static int connectTcp(int port, int receiveBuffer) {
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (receiveBuffer > 0)
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	if (connect(s, (sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static int connectUnix(const std::string &path) {
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	if (connect(s, (sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static int connectUdp(int port) {
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	connect(s, (sockaddr *)&addr, sizeof(addr));
+	return s;
+}
+
+static void sendSubscribe(int s, uint8_t sensorMask, const std::vector<uint16_t> &devices) {
+	StreamSubscription subscription;
+	subscription.sensorMask = sensorMask;
+	subscription.devices = devices;
+	std::vector<uint8_t> frame = encodeSubscribe(subscription);
+	send(s, frame.data(), frame.size(), MSG_NOSIGNAL);
+}
+
+// Everything the socket holds right now, without waiting
+static void drain(int s, std::vector<uint8_t> &bytes) {
+	uint8_t buf[4096];
+	for (;;) {
+		ssize_t n = recv(s, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n <= 0)
+			return;
+		bytes.insert(bytes.end(), buf, buf + n);
+	}
+}
+
+// The SAMPLES frames in bytes, one entry per frame: its samples and their masks
+struct Batch {
+	std::vector<ImuSample> samples;
+	std::vector<uint8_t> masks;
+};
+
+static bool decodeFrames(const std::vector<uint8_t> &bytes, std::vector<Batch> &batches) {
+	size_t used = 0;
+	while (used < bytes.size()) {
+		uint8_t type;
+		const uint8_t *payload;
+		uint32_t length;
+		long frame = parseFrame(bytes.data() + used, bytes.size() - used, type, payload, length);
+		if (frame <= 0 || type != STREAM_MSG_SAMPLES)
+			return false;
+		Batch batch;
+		batch.samples.resize(MAX_SAMPLES);
+		batch.masks.resize(MAX_SAMPLES);
+		long count = decodeSampleBatch(payload, length, batch.samples.data(), batch.masks.data(), MAX_SAMPLES);
+		if (count < 0)
+			return false;
+		batch.samples.resize((size_t)count);
+		batch.masks.resize((size_t)count);
+		batches.push_back(batch);
+		used += (size_t)frame;
+	}
+	return true;
+}
+
+// The decoded sample carries the axes of mask and zeros elsewhere
+static bool sameSample(const ImuSample &decoded, const ImuSample &sent, uint8_t mask) {
+	if (decoded.deviceId != sent.deviceId || decoded.timestamp != sent.timestamp)
+		return false;
+	for (int a = 0; a < IMU_AXES; a++) {
+		int16_t expected = (mask & (1 << (a / 3))) ? sent.axis[a] : 0;
+		if (decoded.axis[a] != expected)
+			return false;
+	}
+	return true;
+}
+
+static void pollFor(StreamServer &server, int passes) {
+	for (int i = 0; i < passes; i++)
+		server.poll(5);
+}
+
+// Three clients with different subscriptions get only what they asked for, in batches of batchSize
+static void subscriptions() {
+	std::string unixPath = tempPath("stream.sock");
+	StreamServerConfig config;
+	config.bindAddress = "127.0.0.1";
+	config.tcpPort = 0;
+	config.udpPort = 0;
+	config.unixPath = unixPath;
+	config.batchSize = 4;
+	StreamServer server;
+	CHECK(server.open(config));
+	CHECK(server.tcpPort() > 0 && server.udpPort() > 0);
+
+	int tcp = connectTcp(server.tcpPort(), 0);				// device 1, accelerometer only
+	int unixClient = connectUnix(unixPath);					// everything, the default
+	int udp = connectUdp(server.udpPort());					// device 0, gyroscope and magnetometer
+	CHECK(tcp >= 0 && unixClient >= 0 && udp >= 0);
+	sendSubscribe(tcp, IMU_ACC, std::vector<uint16_t>(1, 1));
+	sendSubscribe(udp, IMU_GYRO | IMU_MAG, std::vector<uint16_t>(1, 0));
+	for (int i = 0; i < 200 && server.clientCount() < 3; i++)
+		server.poll(5);
+	pollFor(server, 5);										// the TCP subscription
+	CHECK(server.clientCount() == 3);
+
+	ImuSample sent[10];
+	for (int i = 0; i < 10; i++) {
+		sent[i] = makeSample(i);
+		server.publish(sent[i]);
+	}
+	server.flush();
+	pollFor(server, 5);
+
+	std::vector<uint8_t> tcpBytes, unixBytes, udpBytes;
+	drain(tcp, tcpBytes);
+	drain(unixClient, unixBytes);
+	drain(udp, udpBytes);				// one datagram per batch, each a complete frame
+
+	// the 5 samples of device 1: a full batch of 4, then the flushed one
+	std::vector<Batch> batches;
+	CHECK(decodeFrames(tcpBytes, batches));
+	CHECK(batches.size() == 2 && batches[0].samples.size() == 4 && batches[1].samples.size() == 1);
+	for (size_t b = 0, i = 1; b < batches.size(); b++) {
+		for (size_t s = 0; s < batches[b].samples.size(); s++, i += 2) {
+			CHECK(batches[b].masks[s] == IMU_ACC);
+			CHECK(sameSample(batches[b].samples[s], sent[i], IMU_ACC));
+		}
+	}
+
+	// all 10: 4 + 4 + 2
+	batches.clear();
+	CHECK(decodeFrames(unixBytes, batches));
+	CHECK(batches.size() == 3 && batches[2].samples.size() == 2);
+	for (size_t b = 0, i = 0; b < batches.size(); b++) {
+		for (size_t s = 0; s < batches[b].samples.size(); s++, i++) {
+			CHECK(batches[b].masks[s] == IMU_ALL);
+			CHECK(sameSample(batches[b].samples[s], sent[i], IMU_ALL));
+		}
+	}
+
+	// the 5 samples of device 0
+	batches.clear();
+	CHECK(decodeFrames(udpBytes, batches));
+	CHECK(batches.size() == 2 && batches[0].samples.size() == 4 && batches[1].samples.size() == 1);
+	for (size_t b = 0, i = 0; b < batches.size(); b++) {
+		for (size_t s = 0; s < batches[b].samples.size(); s++, i += 2) {
+			CHECK(batches[b].masks[s] == (IMU_GYRO | IMU_MAG));
+			CHECK(sameSample(batches[b].samples[s], sent[i], IMU_GYRO | IMU_MAG));
+		}
+	}
+
+	// a UDP client that unsubscribes is forgotten, a closed stream client is reaped
+	sendSubscribe(udp, 0, std::vector<uint16_t>());
+	close(tcp);
+	pollFor(server, 10);
+	CHECK(server.clientCount() == 1);
+	CHECK(server.stats().clientsAccepted == 3 && server.stats().clientsClosed == 2);
+	CHECK(server.stats().packetsDropped == 0);
+
+	close(unixClient);
+	close(udp);
+	server.close();
+	CHECK(access(unixPath.c_str(), F_OK) != 0);			// the socket file goes with the server
+}
+
+// A client that never reads: its queue stays bounded and every packet is either queued or counted as dropped
+static void slowClient() {
+	StreamServerConfig config;
+	config.bindAddress = "127.0.0.1";
+	config.tcpPort = 0;
+	config.udpPort = -1;
+	config.batchSize = 1;
+	config.maxQueueBytes = 4096;
+	StreamServer server;
+	CHECK(server.open(config));
+	int client = connectTcp(server.tcpPort(), 4096);
+	CHECK(client >= 0);
+	for (int i = 0; i < 200 && server.clientCount() < 1; i++)
+		server.poll(5);
+
+	// far more than the socket buffers hold; publish() must never wait for the client
+	const int SAMPLES = 100000;
+	for (int i = 0; i < SAMPLES; i++) {
+		server.publish(makeSample(i));
+		if (i % 100 == 0)
+			server.poll(0);
+	}
+	const StreamServerStats &stats = server.stats();
+	CHECK(stats.packetsDropped > 0);
+	CHECK(stats.packetsSent + stats.packetsDropped == (uint64_t)SAMPLES);
+	CHECK(server.clientCount() == 1);
+
+	// now read: exactly the packets counted as sent arrive, each one whole
+	std::vector<uint8_t> bytes;
+	for (int idle = 0; idle < 20; ) {
+		size_t before = bytes.size();
+		server.poll(5);
+		drain(client, bytes);
+		idle = bytes.size() == before ? idle + 1 : 0;
+	}
+	std::vector<Batch> batches;
+	CHECK(decodeFrames(bytes, batches));
+	CHECK(batches.size() == stats.packetsSent);
+	for (size_t b = 1; b < batches.size(); b++)
+		if (batches[b].samples.size() != 1 || batches[b].samples[0].timestamp <= batches[b - 1].samples[0].timestamp) {
+			CHECK(!"batches out of order");
+			break;
+		}
+
+	close(client);
+	server.close();
+}
+
+int main() {
+	subscriptions();
+	slowClient();
+	return checkResult();
+}
@@ -0,0 +1,260 @@
+// test_trace.cpp : TraceBuffer rings, snapshots while recording, and the JSON of traceDump()
+//
+
+#include "Check.h"
+#include "Trace.h"
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Events a test thread records: every field follows from the sequence number, so a torn copy shows
+static TraceEvent numbered(uint64_t n) {
+	TraceEvent e;
+	e.start = n;
+	e.duration = n * 3;
+	e.name = "numbered";
+	e.pass = (uint32_t)n;
+	e.device = (uint16_t)(n * 7);
+	return e;
+}
+
+static bool isNumbered(const TraceEvent &e, uint64_t n) {
+	return e.start == n && e.duration == n * 3 && e.pass == (uint32_t)n && e.device == (uint16_t)(n * 7) &&
+		   strcmp(e.name, "numbered") == 0;
+}
+
+/*
+A strict JSON reader that only says whether the text is one valid value:
+objects, arrays, strings with escapes, numbers, true/false/null.
+*/
+class JsonCheck {
+public:
+	explicit JsonCheck(const std::string &text) : m_s(text), m_p(0) {}
+	bool valid() {
+		bool ok = value();
+		space();
+		return ok && m_p == m_s.size();
+	}
+
+private:
+	void space() {
+		while (m_p < m_s.size() && strchr(" \t\r\n", m_s[m_p]))
+			m_p++;
+	}
+	bool eat(char c) {
+		space();
+		if (m_p < m_s.size() && m_s[m_p] == c) {
+			m_p++;
+			return true;
+		}
+		return false;
+	}
+	bool literal(const char *word) {
+		size_t n = strlen(word);
+		if (m_s.compare(m_p, n, word) != 0)
+			return false;
+		m_p += n;
+		return true;
+	}
+	bool string() {
+		if (!eat('"'))
+			return false;
+		while (m_p < m_s.size()) {
+			unsigned char c = (unsigned char)m_s[m_p++];
+			if (c == '"')
+				return true;
+			if (c < 0x20)
+				return false;
+			if (c == '\\') {
+				if (m_p >= m_s.size() || !strchr("\"\\/bfnrtu", m_s[m_p]))
+					return false;
+				m_p++;
+			}
+		}
+		return false;
+	}
+	bool number() {
+		size_t first = m_p;
+		if (m_p < m_s.size() && m_s[m_p] == '-')
+			m_p++;
+		size_t digits = m_p;
+		while (m_p < m_s.size() && isdigit((unsigned char)m_s[m_p]))
+			m_p++;
+		if (m_p == digits || (m_s[digits] == '0' && m_p - digits > 1))
+			return false;
+		if (m_p < m_s.size() && m_s[m_p] == '.') {
+			size_t fraction = ++m_p;
+			while (m_p < m_s.size() && isdigit((unsigned char)m_s[m_p]))
+				m_p++;
+			if (m_p == fraction)
+				return false;
+		}
+		return m_p > first;
+	}
+	bool value() {
+		space();
+		if (m_p >= m_s.size())
+			return false;
+		char c = m_s[m_p];
+		if (c == '{') {
+			m_p++;
+			if (eat('}'))
+				return true;
+			do {
+				if (!string() || !eat(':') || !value())
+					return false;
+			} while (eat(','));
+			return eat('}');
+		}
+		if (c == '[') {
+			m_p++;
+			if (eat(']'))
+				return true;
+			do {
+				if (!value())
+					return false;
+			} while (eat(','));
+			return eat(']');
+		}
+		if (c == '"')
+			return string();
+		if (c == 't')
+			return literal("true");
+		if (c == 'f')
+			return literal("false");
+		if (c == 'n')
+			return literal("null");
+		return number();
+	}
+
+	const std::string &m_s;
+	size_t m_p;
+};
+
+static std::string readFile(const std::string &path) {
+	std::string text;
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return text;
+	char block[4096];
+	size_t n;
+	while ((n = fread(block, 1, sizeof(block), f)) > 0)
+		text.append(block, n);
+	fclose(f);
+	return text;
+}
+
+int main() {
+	// the capacity is rounded up to a power of two; after wrapping the snapshot has the newest events,
+	// oldest first, less the slot the owner may be writing
+	{
+		TraceBuffer ring("ring", 1, 5);
+		std::vector<TraceEvent> events;
+		ring.snapshot(events);
+		CHECK(events.empty());
+		for (uint64_t n = 0; n < 6; n++)
+			ring.record(numbered(n));
+		ring.snapshot(events);
+		CHECK(events.size() == 6 && isNumbered(events[0], 0) && isNumbered(events[5], 5));
+		for (uint64_t n = 6; n < 21; n++)
+			ring.record(numbered(n));
+		events.clear();
+		ring.snapshot(events);
+		CHECK(ring.recorded() == 21);
+		CHECK(events.size() == 7);
+		for (size_t i = 0; i < events.size(); i++)
+			CHECK(isNumbered(events[i], 14 + i));
+	}
+
+	// snapshots while the owner records as fast as it can: whatever is kept is whole and in order
+	{
+		TraceBuffer ring("racing", 2, 256);
+		std::atomic<bool> stop(false);
+		std::thread owner([&]() {
+			for (uint64_t n = 0; !stop.load(std::memory_order_relaxed); n++)
+				ring.record(numbered(n));
+		});
+		while (ring.recorded() < 1024)
+			std::this_thread::yield();
+		std::vector<TraceEvent> events;
+		size_t torn = 0, kept = 0;
+		for (size_t snapshots = 0; snapshots < 20000; snapshots++) {
+			events.clear();
+			ring.snapshot(events);
+			kept += events.size();
+			for (size_t i = 0; i < events.size(); i++) {
+				if (!isNumbered(events[i], events[0].start + i)) {
+					torn++;
+					break;
+				}
+			}
+		}
+		stop = true;
+		owner.join();
+		CHECK(torn == 0);
+		CHECK(kept > 0);
+	}
+
+	// the global API: spans, instants and scopes of registered threads; nothing from the others
+	traceStart(64);
+	traceRegisterThread("main");
+	TraceBuffer *buffer = traceThreadBuffer();
+	CHECK(buffer != 0);
+	{
+		std::thread unregistered([]() { traceInstant("lost"); });
+		unregistered.join();
+	}
+	uint32_t pass = traceNextPass();
+	traceSpan("read", 1000, 3500, 2);
+	traceSpan("backwards", 5000, 4000);
+	traceInstant("mark \"quoted\" \\ and\ttab");
+	{
+		TraceScope scope("scope", 1);
+		scope.setDevice(3);
+	}
+	{
+		TraceScope dropped("dropped");
+		dropped.cancel();
+	}
+	std::thread worker([]() {
+		traceRegisterThread("worker");
+		traceNextPass();
+		traceSpan("decode", 10, 20, 0);
+	});
+	worker.join();
+
+	if (buffer) {
+		std::vector<TraceEvent> events;
+		buffer->snapshot(events);
+		CHECK(events.size() == 4);
+		if (events.size() == 4) {
+			CHECK(strcmp(events[0].name, "read") == 0 && events[0].start == 1000 && events[0].duration == 2500 &&
+				  events[0].device == 2 && events[0].pass == pass);
+			CHECK(events[1].duration == 0 && events[1].device == TRACE_NO_DEVICE);
+			CHECK(events[2].duration == TRACE_INSTANT);
+			CHECK(strcmp(events[3].name, "scope") == 0 && events[3].duration != TRACE_INSTANT && events[3].device == 3);
+		}
+	}
+
+	// the dump is valid JSON with both kinds of events, including the thread that has ended
+	std::string path = tempPath("trace.json"), error;
+	CHECK(traceDump(path, error));
+	std::string json = readFile(path);
+	CHECK(JsonCheck(json).valid());
+	CHECK(json.find("\"ph\":\"X\",\"ts\":1.000,\"dur\":2.500") != std::string::npos);
+	CHECK(json.find("\"ph\":\"i\"") != std::string::npos);
+	CHECK(json.find("\"mark \\\"quoted\\\" \\\\ andtab\"") != std::string::npos);
+	CHECK(json.find("\"args\":{\"name\":\"worker\"}") != std::string::npos);
+	CHECK(json.find("\"decode\"") != std::string::npos);
+	CHECK(json.find("lost") == std::string::npos && json.find("dropped") == std::string::npos);
+	CHECK(!JsonCheck(json.substr(0, json.size() - 3)).valid());		// the checker does reject
+	traceStop();
+	remove(path.c_str());
+
+	CHECK(!traceDump(tempPath("no-such-directory/trace.json"), error) && !error.empty());
+	return checkResult();
+}
@@ -0,0 +1,177 @@
+// archive_bench.cpp : size and decode speed of ColumnArchive against raw 28-byte records
+//
+
+#include "ColumnArchive.h"
+#include "StreamProtocol.h"		// putU16()... little endian helpers
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	archive_bench [minutes] [directory]
+
+Generates synthetic 100 Hz data of 3 tags (60 minutes by default): slow motion
+plus sensor noise on every axis and +-0.5 ms of timestamp jitter, with a fixed
+seed so that runs compare. The samples are written in acquisition order both
+as a ColumnArchive and as raw records (uint16 deviceId, uint64 timestamp,
+int16 axes[9]), then both are decoded completely. Times are the best of 5 runs
+and include the file reads (from the page cache after the first run).
+*/
+
+static const int TAGS = 3;
+static const int RATE_HZ = 100;
+static const size_t RAW_RECORD_SIZE = 2 + 8 + IMU_AXES * 2;
+static const int RUNS = 5;
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int16_t clampAxis(double v) {
+	return (int16_t)std::max(-32768.0, std::min(32767.0, std::round(v)));
+}
+
+static void generate(int minutes, std::vector<ImuSample> &samples) {
+	std::mt19937 random(2650);
+	std::normal_distribution<double> gyroNoise(0, 25), accNoise(0, 12), magNoise(0, 3);
+	std::uniform_int_distribution<int> jitter(-500, 500);
+	size_t perTag = (size_t)minutes * 60 * RATE_HZ;
+	uint64_t start = 1700000000000000ull;
+	samples.resize(perTag * TAGS);
+	for (size_t i = 0; i < perTag; i++) {
+		for (int t = 0; t < TAGS; t++) {
+			ImuSample &s = samples[i * TAGS + t];
+			double phase = (double)i / RATE_HZ * (0.2 + 0.1 * t);
+			s.deviceId = (uint16_t)t;
+			s.timestamp = start + i * (1000000 / RATE_HZ) + (uint64_t)(jitter(random) + 1000) + t * 3000;
+			for (int a = 0; a < 3; a++) {
+				s.axis[AXIS_GX + a] = clampAxis(400 * std::sin(phase + a) + gyroNoise(random));
+				s.axis[AXIS_AX + a] = clampAxis((a == 2 ? 2048 : 0) + 150 * std::sin(phase * 0.5 + a) + accNoise(random));
+				s.axis[AXIS_MX + a] = clampAxis(40 * std::cos(phase * 0.1 + a) + magNoise(random));
+			}
+		}
+	}
+}
+
+static bool writeRaw(const std::string &path, const std::vector<ImuSample> &samples) {
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	std::vector<uint8_t> buffer(samples.size() * RAW_RECORD_SIZE);
+	for (size_t i = 0; i < samples.size(); i++) {
+		uint8_t *p = &buffer[i * RAW_RECORD_SIZE];
+		putU16(p, samples[i].deviceId);
+		putU64(p + 2, samples[i].timestamp);
+		for (int a = 0; a < IMU_AXES; a++)
+			putU16(p + 10 + a * 2, (uint16_t)samples[i].axis[a]);
+	}
+	bool ok = fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+	return fclose(f) == 0 && ok;
+}
+
+static bool readRaw(const std::string &path, std::vector<uint8_t> &buffer, std::vector<ImuSample> &out) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	buffer.resize((size_t)ftell(f));
+	fseek(f, 0, SEEK_SET);
+	bool ok = fread(buffer.data(), 1, buffer.size(), f) == buffer.size();
+	fclose(f);
+	size_t n = buffer.size() / RAW_RECORD_SIZE;
+	out.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		const uint8_t *p = &buffer[i * RAW_RECORD_SIZE];
+		out[i].deviceId = getU16(p);
+		out[i].timestamp = getU64(p + 2);
+		for (int a = 0; a < IMU_AXES; a++)
+			out[i].axis[a] = (int16_t)getU16(p + 10 + a * 2);
+	}
+	return ok;
+}
+
+static uint64_t fileBytes(const std::string &path) {
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	uint64_t size = (uint64_t)ftell(f);
+	fclose(f);
+	return size;
+}
+
+int main(int argc, char *argv[]) {
+	int minutes = argc > 1 ? atoi(argv[1]) : 60;
+	std::string directory = argc > 2 ? argv[2] : ".";
+	if (minutes <= 0) {
+		fprintf(stderr, "usage: archive_bench [minutes] [directory]\n");
+		return 2;
+	}
+	std::string archivePath = directory + "/archive_bench.cca";
+	std::string rawPath = directory + "/archive_bench.raw";
+
+	std::vector<ImuSample> samples;
+	generate(minutes, samples);
+	printf("%d min of %d Hz data from %d tags: %zu samples\n", minutes, RATE_HZ, TAGS, samples.size());
+
+	ArchiveWriter writer;
+	if (!writer.open(archivePath)) {
+		fprintf(stderr, "%s\n", writer.lastError().c_str());
+		return 1;
+	}
+	for (size_t i = 0; i < samples.size(); i++)
+		writer.append(samples[i]);
+	if (!writer.close() || !writeRaw(rawPath, samples)) {
+		fprintf(stderr, "writing to %s failed\n", directory.c_str());
+		return 1;
+	}
+	uint64_t archiveSize = fileBytes(archivePath), rawSize = fileBytes(rawPath);
+	printf("raw (%zu-byte records): %.1f MB, archive: %.1f MB (%.1fx smaller)\n", RAW_RECORD_SIZE,
+		   rawSize / 1e6, archiveSize / 1e6, (double)rawSize / archiveSize);
+
+	// full decode, every device and axis
+	double archiveMs = 1e9, rawMs = 1e9, windowMs = 1e9;
+	size_t archiveCount = 0, rawCount = 0, windowCount = 0;
+	std::vector<ImuSample> out;
+	std::vector<uint8_t> buffer;
+	for (int run = 0; run < RUNS; run++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ArchiveReader reader;
+		out.clear();
+		bool ok = reader.open(archivePath);
+		for (int t = 0; ok && t < TAGS; t++)
+			ok = reader.read((uint16_t)t, ARCHIVE_ALL_AXES, 0, UINT64_MAX, out);
+		archiveMs = std::min(archiveMs, millisecondsSince(start));
+		archiveCount = ok ? out.size() : 0;
+
+		start = std::chrono::steady_clock::now();
+		ok = readRaw(rawPath, buffer, out);
+		rawMs = std::min(rawMs, millisecondsSince(start));
+		rawCount = ok ? out.size() : 0;
+
+		// 10 s in the middle, one tag, gyroscope only
+		uint64_t t0 = samples[samples.size() / 2].timestamp;
+		start = std::chrono::steady_clock::now();
+		out.clear();
+		ok = reader.read(1, archiveAxisMask(IMU_GYRO), t0, t0 + 10000000, out);
+		windowMs = std::min(windowMs, millisecondsSince(start));
+		windowCount = ok ? out.size() : 0;
+	}
+	if (archiveCount != samples.size() || rawCount != samples.size()) {
+		fprintf(stderr, "decoded %zu (archive) and %zu (raw) samples instead of %zu\n", archiveCount, rawCount, samples.size());
+		return 1;
+	}
+	printf("full decode: archive %.1f ms (%.1f M samples/s), raw %.1f ms (%.1f M samples/s)\n",
+		   archiveMs, samples.size() / archiveMs / 1e3, rawMs, samples.size() / rawMs / 1e3);
+	printf("10 s window, one tag, gyro only: %.2f ms (%zu samples)\n", windowMs, windowCount);
+
+	remove(archivePath.c_str());
+	remove(rawPath.c_str());
+	return 0;
+}